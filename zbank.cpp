@@ -7,13 +7,223 @@
 #include <sstream>
 #include <cmath>
 #include <stdexcept>
+#include <chrono>
+#include <new>
+#include <algorithm>
+#include <iterator>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <filesystem>
+#include <mutex>
+#include <condition_variable>
+#include <shared_mutex>
+#include <thread>
+#include <atomic>
+#include <deque>
+#include <unordered_map>
+#include <map>
+#include <string_view>
+#include <charconv>
+#include <cstdlib>
+#include <memory>
+#include <functional>
+#include <random>
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef __linux__
+#include <csignal>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
 
 using namespace std;
 
+// Amount of money as a whole number of cents, so sums and comparisons are exact
+// Parsing and formatting are done by hand rather than through the stream and locale machinery
+class Money
+{
+private:
+    int64_t cents;
+
+public:
+    constexpr Money() : cents(0) {}
+
+    static constexpr Money fromCents(int64_t amount)
+    {
+        Money money;
+        money.cents = amount;
+        return money;
+    }
+    static constexpr Money dollars(int64_t amount) { return fromCents(amount * 100); }
+
+    constexpr int64_t getCents() const { return cents; }
+
+    constexpr Money operator+(Money other) const { return fromCents(cents + other.cents); }
+    constexpr Money operator-(Money other) const { return fromCents(cents - other.cents); }
+    constexpr Money operator-() const { return fromCents(-cents); }
+    Money &operator+=(Money other)
+    {
+        cents += other.cents;
+        return *this;
+    }
+    Money &operator-=(Money other)
+    {
+        cents -= other.cents;
+        return *this;
+    }
+    constexpr bool operator==(Money other) const { return cents == other.cents; }
+    constexpr bool operator!=(Money other) const { return cents != other.cents; }
+    constexpr bool operator<(Money other) const { return cents < other.cents; }
+    constexpr bool operator<=(Money other) const { return cents <= other.cents; }
+    constexpr bool operator>(Money other) const { return cents > other.cents; }
+    constexpr bool operator>=(Money other) const { return cents >= other.cents; }
+
+    // Scales by a rate, rounding to the nearest cent (halves away from zero)
+    Money times(double factor) const { return fromCents(llroundl((long double)cents * factor)); }
+
+    // Accepts things like 12, 12.5, 12.34, $12.34 and -0.50
+    static bool parse(string_view text, Money &value)
+    {
+        size_t pos = 0;
+        bool negative = false;
+        if (pos < text.size() && (text[pos] == '-' || text[pos] == '+'))
+        {
+            negative = text[pos++] == '-';
+        }
+        if (pos < text.size() && text[pos] == '$')
+        {
+            pos++;
+        }
+        int64_t whole = 0;
+        size_t digits = 0;
+        for (; pos < text.size() && text[pos] >= '0' && text[pos] <= '9'; pos++, digits++)
+        {
+            if (digits == 15)
+                return false;
+            whole = whole * 10 + (text[pos] - '0');
+        }
+        int64_t fraction = 0;
+        size_t fractionDigits = 0;
+        if (pos < text.size() && text[pos] == '.')
+        {
+            for (pos++; pos < text.size() && text[pos] >= '0' && text[pos] <= '9'; pos++, fractionDigits++)
+            {
+                if (fractionDigits == 2)
+                    return false;
+                fraction = fraction * 10 + (text[pos] - '0');
+            }
+        }
+        if (pos != text.size() || digits + fractionDigits == 0)
+        {
+            return false;
+        }
+        if (fractionDigits == 1)
+        {
+            fraction *= 10;
+        }
+        value = fromCents((negative ? -1 : 1) * (whole * 100 + fraction));
+        return true;
+    }
+
+    // Writes the amount as e.g. -12.34 into out, which needs room for 24 characters, returns the length
+    size_t format(char *out) const
+    {
+        char digits[24];
+        size_t count = 0;
+        uint64_t magnitude = cents < 0 ? 0 - uint64_t(cents) : uint64_t(cents);
+        do
+        {
+            digits[count++] = char('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude || count < 3);
+
+        size_t length = 0;
+        if (cents < 0)
+        {
+            out[length++] = '-';
+        }
+        while (count > 2)
+        {
+            out[length++] = digits[--count];
+        }
+        out[length++] = '.';
+        out[length++] = digits[1];
+        out[length++] = digits[0];
+        return length;
+    }
+
+    string toString() const
+    {
+        char text[24];
+        return string(text, format(text));
+    }
+
+    friend ostream &operator<<(ostream &os, Money money)
+    {
+        char text[24];
+        return os.write(text, streamsize(money.format(text)));
+    }
+};
+
+// A balance several threads can update at once without a lock
+class AtomicMoney
+{
+private:
+    atomic<int64_t> cents;
+
+public:
+    AtomicMoney(Money value = Money()) : cents(value.getCents()) {}
+
+    Money load() const { return Money::fromCents(cents.load(memory_order_acquire)); }
+    operator Money() const { return load(); }
+    AtomicMoney &operator=(Money value)
+    {
+        cents.store(value.getCents(), memory_order_release);
+        return *this;
+    }
+
+    void add(Money amount) { cents.fetch_add(amount.getCents(), memory_order_acq_rel); }
+
+    // Takes amount out only if allowed(current balance) still holds when the update lands,
+    // retrying when another thread got in first, returns false if it is not allowed
+    template <typename Check>
+    bool takeIf(Money amount, Check allowed)
+    {
+        int64_t current = cents.load(memory_order_acquire);
+        do
+        {
+            if (!allowed(Money::fromCents(current)))
+            {
+                return false;
+            }
+        } while (!cents.compare_exchange_weak(current, current - amount.getCents(), memory_order_acq_rel, memory_order_acquire));
+        return true;
+    }
+};
+
 // C++14 | Variable template
 template <typename T>
 constexpr T overdraftLimit_V = T{100};
 
+template <>
+constexpr Money overdraftLimit_V<Money> = Money::dollars(100);
+
 // Some utils
 bool startswith(const string &s, char c)
 {
@@ -23,20 +233,499 @@ bool startswith(const string &s, char c)
 // C++14 | Lambda capture
 auto clearScreen = []
 {
-    system("clear"); // for linux users
-    system("cls");   // for windows users
+#ifdef _WIN32
+    system("cls"); // for windows users
+#else
+    cout << "\033[H\033[2J\033[3J" << flush; // same escape codes "clear" prints, without starting a process
+#endif
+};
+
+// Per-command counters and latency histograms
+// Every thread records into its own shard, so a probe costs two clock reads and a few uncontended stores,
+// and the report adds the shards up without stopping anyone
+// Building with -DZBANK_NO_METRICS compiles the probes away
+namespace Metrics
+{
+    enum Probe : uint8_t
+    {
+        LOGIN,
+        BALANCE,
+        DEPOSIT,
+        WITHDRAW,
+        TRANSFER,
+        TRANSACTIONS,
+        TOTALS,
+        VERIFY,
+        OPEN,
+        CLOSE,
+        ACCRUE,
+        SNAPSHOT,
+        IMPORT,
+        EXPORT,
+        SUMMARY,
+        MONTHLY,
+        TOP,
+        ORDER,
+        PAY,
+        CREDIT,
+        DEBIT,
+        MOVE,
+        STATEMENT,
+        PUBLISH,
+        PROBE_COUNT
+    };
+
+    // Commands first, then the Account methods every front end ends up in
+    const char *const PROBE_NAMES[PROBE_COUNT] = {"login", "balance", "deposit", "withdraw", "transfer", "transactions", "totals", "verify",
+                                                  "open", "close", "accrue", "snapshot", "import", "export", "summary", "monthly", "top", "order", "pay", "account.credit", "account.debit", "account.transfer", "account.statement",
+                                                  "audit.publish"};
+
+    // HDR style log-linear buckets: values below 16 ns are exact, above that every power of two is split into 16 steps,
+    // so any latency lands in a bucket within 1/16 of its value
+    const int SUB_BITS = 4;
+    const int SUB_BUCKETS = 1 << SUB_BITS;
+    const int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    inline int bucketOf(uint64_t nanos)
+    {
+        if (nanos < uint64_t(SUB_BUCKETS))
+        {
+            return int(nanos);
+        }
+#ifdef __GNUC__
+        int top = 63 - __builtin_clzll(nanos);
+#else
+        int top = 0;
+        while (nanos >> (top + 1))
+            top++;
+#endif
+        int shift = top - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + int((nanos >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    // Middle of the range a bucket covers
+    inline double bucketValue(int bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+        {
+            return bucket;
+        }
+        int shift = bucket / SUB_BUCKETS - 1;
+        double low = double(uint64_t(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift);
+        return low + double(uint64_t(1) << shift) / 2;
+    }
+
+    // Only the owning thread writes a shard, readers may look at it any time
+    struct Shard
+    {
+        atomic<uint64_t> counts[PROBE_COUNT][BUCKETS];
+        atomic<uint64_t> errors[PROBE_COUNT];
+        atomic<uint64_t> nanos[PROBE_COUNT];
+    };
+
+    class Registry
+    {
+    private:
+        mutex lock;
+        vector<unique_ptr<Shard>> shards;
+        // shards whose thread has exited, handed to the next new thread so their counts stay in the totals
+        vector<Shard *> released;
+
+    public:
+        const chrono::steady_clock::time_point started = chrono::steady_clock::now();
+
+        Shard *acquire()
+        {
+            lock_guard<mutex> held(lock);
+            if (!released.empty())
+            {
+                Shard *shard = released.back();
+                released.pop_back();
+                return shard;
+            }
+            shards.push_back(make_unique<Shard>());
+            return shards.back().get();
+        }
+
+        void release(Shard *shard)
+        {
+            lock_guard<mutex> held(lock);
+            released.push_back(shard);
+        }
+
+        // Runs f on every shard there has ever been
+        template <typename F>
+        void forEach(F f)
+        {
+            lock_guard<mutex> held(lock);
+            for (const unique_ptr<Shard> &shard : shards)
+            {
+                f(*shard);
+            }
+        }
+    };
+
+    inline Registry &registry()
+    {
+        static Registry instance;
+        return instance;
+    }
+
+    // The calling thread's shard, taken on first use and given back when the thread exits
+    inline Shard &localShard()
+    {
+        struct Lease
+        {
+            Shard *shard = registry().acquire();
+            ~Lease() { registry().release(shard); }
+        };
+        thread_local Lease lease;
+        return *lease.shard;
+    }
+
+    inline void bump(atomic<uint64_t> &counter, uint64_t by)
+    {
+        counter.store(counter.load(memory_order_relaxed) + by, memory_order_relaxed);
+    }
+
+    inline void record(Probe probe, uint64_t nanos, bool failed)
+    {
+        Shard &shard = localShard();
+        bump(shard.counts[probe][bucketOf(nanos)], 1);
+        bump(shard.nanos[probe], nanos);
+        if (failed)
+        {
+            bump(shard.errors[probe], 1);
+        }
+    }
+
+    // Times the rest of the scope, a scope left by an exception counts as an error
+    class Timer
+    {
+    private:
+        Probe probe;
+        int exceptions;
+        chrono::steady_clock::time_point start;
+
+    public:
+        explicit Timer(Probe timed) : probe(timed), exceptions(uncaught_exceptions()), start(chrono::steady_clock::now()) {}
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+        ~Timer()
+        {
+            if (probe >= PROBE_COUNT)
+            {
+                return;
+            }
+            uint64_t elapsed = uint64_t(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+            record(probe, elapsed, uncaught_exceptions() > exceptions);
+        }
+    };
+
+    // Probe for a batch command name, PROBE_COUNT if it has none
+    inline Probe probeFor(string_view command)
+    {
+        for (int probe = LOGIN; probe <= PAY; probe++)
+        {
+            if (command == PROBE_NAMES[probe])
+                return Probe(probe);
+        }
+        return PROBE_COUNT;
+    }
+}
+
+#ifdef ZBANK_NO_METRICS
+#define ZBANK_PROBE(probe)
+#else
+#define ZBANK_PROBE(probe) Metrics::Timer zbankProbe(probe)
+#endif
+
+// Days since 1970-01-01 for a calendar date, and back (proleptic Gregorian calendar)
+int64_t daysFromCivil(int year, unsigned month, unsigned day)
+{
+    year -= month <= 2;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned yearOfEra = unsigned(year - era * 400);
+    const unsigned dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + int64_t(dayOfEra) - 719468;
+}
+
+void civilFromDays(int64_t days, int &year, unsigned &month, unsigned &day)
+{
+    days += 719468;
+    const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const unsigned dayOfEra = unsigned(days - era * 146097);
+    const unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    const unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    const unsigned shifted = (5 * dayOfYear + 2) / 153;
+    day = dayOfYear - (153 * shifted + 2) / 5 + 1;
+    month = shifted < 10 ? shifted + 3 : shifted - 9;
+    year = int(int64_t(yearOfEra) + era * 400 + (month <= 2));
+}
+
+// Thread safe localtime
+bool localTime(time_t date, tm &local)
+{
+#ifdef _WIN32
+    return localtime_s(&local, &date) == 0;
+#else
+    return localtime_r(&date, &local) != nullptr;
+#endif
+}
+
+// Formats timestamps as local time without a timezone lookup per call
+// The UTC offset is looked up once per UTC day and kept in a small direct mapped table,
+// days where the offset changes (daylight saving switches) go through localtime for every timestamp
+class DateCache
+{
+private:
+    struct Day
+    {
+        int64_t day = INT64_MIN;
+        int64_t offset = 0;
+        bool steady = false;
+    };
+    static const size_t DAYS = 64;
+    Day days[DAYS];
+
+    static int64_t offsetAt(int64_t date)
+    {
+        tm local = {};
+        localTime(time_t(date), local);
+        return daysFromCivil(local.tm_year + 1900, unsigned(local.tm_mon + 1), unsigned(local.tm_mday)) * 86400 +
+               local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec - date;
+    }
+
+    // UTC offset in seconds at a timestamp
+    int64_t offsetFor(int64_t t)
+    {
+        int64_t utcDay = t >= 0 ? t / 86400 : (t - 86399) / 86400;
+        Day &entry = days[size_t(utcDay) % DAYS];
+        if (entry.day != utcDay)
+        {
+            entry.day = utcDay;
+            entry.offset = offsetAt(utcDay * 86400);
+            entry.steady = offsetAt(utcDay * 86400 + 86399) == entry.offset;
+        }
+        return entry.steady ? entry.offset : offsetAt(t);
+    }
+
+    // Local date and time of day for a timestamp
+    void split(time_t date, int &year, unsigned &month, unsigned &day, int &weekday, int &seconds)
+    {
+        int64_t t = int64_t(date);
+        int64_t local = t + offsetFor(t);
+        int64_t localDay = local >= 0 ? local / 86400 : (local - 86399) / 86400;
+        seconds = int(local - localDay * 86400);
+        weekday = int(((localDay % 7) + 11) % 7); // 1970-01-01 was a Thursday
+        civilFromDays(localDay, year, month, day);
+    }
+
+    static void twoDigits(char *out, int value)
+    {
+        out[0] = char('0' + value / 10);
+        out[1] = char('0' + value % 10);
+    }
+
+    static void clock(char *out, int seconds)
+    {
+        twoDigits(out, seconds / 3600);
+        out[2] = ':';
+        twoDigits(out + 3, seconds / 60 % 60);
+        out[5] = ':';
+        twoDigits(out + 6, seconds % 60);
+    }
+
+public:
+    // The layout asctime uses, without its newline: "Sat Oct 17 00:32:51 2026"
+    // out needs room for 32 characters
+    size_t formatClassic(time_t date, char *out)
+    {
+        static const char weekdays[] = "SunMonTueWedThuFriSat";
+        static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+        int year, weekday, seconds;
+        unsigned month, day;
+        split(date, year, month, day, weekday, seconds);
+        if (year < 1000 || year > 9999)
+        {
+            return size_t(snprintf(out, 32, "%.3s %.3s%3u %02d:%02d:%02d %d", weekdays + weekday * 3, months + (month - 1) * 3, day,
+                                   seconds / 3600, seconds / 60 % 60, seconds % 60, year));
+        }
+        memcpy(out, weekdays + weekday * 3, 3);
+        out[3] = ' ';
+        memcpy(out + 4, months + (month - 1) * 3, 3);
+        out[7] = ' ';
+        out[8] = day < 10 ? ' ' : char('0' + day / 10);
+        out[9] = char('0' + day % 10);
+        out[10] = ' ';
+        clock(out + 11, seconds);
+        out[19] = ' ';
+        twoDigits(out + 20, year / 100);
+        twoDigits(out + 22, year % 100);
+        return 24;
+    }
+
+    // "2026-10-17 00:32:51", out needs room for 32 characters
+    size_t formatIso(time_t date, char *out)
+    {
+        int year, weekday, seconds;
+        unsigned month, day;
+        split(date, year, month, day, weekday, seconds);
+        if (year < 1000 || year > 9999)
+        {
+            return size_t(snprintf(out, 32, "%d-%02u-%02u %02d:%02d:%02d", year, month, day, seconds / 3600, seconds / 60 % 60, seconds % 60));
+        }
+        twoDigits(out, year / 100);
+        twoDigits(out + 2, year % 100);
+        out[4] = '-';
+        twoDigits(out + 5, int(month));
+        out[7] = '-';
+        twoDigits(out + 8, int(day));
+        out[10] = ' ';
+        clock(out + 11, seconds);
+        return 19;
+    }
+
+    // "2026-10-17T00:32:51Z", the timestamp in UTC, out needs room for 32 characters
+    static size_t formatUtc(time_t date, char *out)
+    {
+        int64_t t = int64_t(date);
+        int64_t day = t >= 0 ? t / 86400 : (t - 86399) / 86400;
+        int year;
+        unsigned month, mday;
+        civilFromDays(day, year, month, mday);
+        int seconds = int(t - day * 86400);
+        if (year < 1000 || year > 9999)
+        {
+            return size_t(snprintf(out, 32, "%d-%02u-%02uT%02d:%02d:%02dZ", year, month, mday, seconds / 3600, seconds / 60 % 60, seconds % 60));
+        }
+        twoDigits(out, year / 100);
+        twoDigits(out + 2, year % 100);
+        out[4] = '-';
+        twoDigits(out + 5, int(month));
+        out[7] = '-';
+        twoDigits(out + 8, int(mday));
+        out[10] = 'T';
+        clock(out + 11, seconds);
+        out[19] = 'Z';
+        return 20;
+    }
+
+    // Month of a timestamp's local date, counted as year * 12 + month - 1
+    int monthOf(time_t date)
+    {
+        int year, weekday, seconds;
+        unsigned month, day;
+        split(date, year, month, day, weekday, seconds);
+        return year * 12 + int(month) - 1;
+    }
+
+    // Local midnight on the first day of a month counted like monthOf does
+    time_t monthStart(int month)
+    {
+        int year = month >= 0 ? month / 12 : (month - 11) / 12;
+        return fromLocal(daysFromCivil(year, unsigned(month - year * 12 + 1), 1) * 86400);
+    }
+
+    // Timestamp for a local date and time given as seconds since 1970-01-01, like mktime with tm_isdst = -1
+    // A time skipped or repeated by a daylight saving switch comes out as one of its neighbours
+    time_t fromLocal(int64_t local)
+    {
+        int64_t guess = local - offsetFor(local);
+        return time_t(local - offsetFor(guess));
+    }
+
+    // Each thread keeps its own table
+    static DateCache &local()
+    {
+        thread_local DateCache cache;
+        return cache;
+    }
 };
 
-// Class to handle date parsing
+// Hand written parser for "YYYY-MM-DD" with an optional time of day, "YYYY-MM-DDTHH:MM:SS" (or a space instead of the T),
+// and an optional trailing Z for UTC. It allocates nothing and never looks at the locale, so bulk imports can call it per row
 class DateParser
 {
+private:
+    static bool digits(const char *text, size_t count, int &value)
+    {
+        value = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            unsigned digit = unsigned(text[i] - '0');
+            if (digit > 9)
+                return false;
+            value = value * 10 + int(digit);
+        }
+        return true;
+    }
+
 public:
-    static tm parseDate(const std::string &dateStr)
+    // Day since 1970-01-01 and seconds into that day, false if text is not one of the forms above or names a day that doesn't exist
+    static bool parse(string_view text, int64_t &day, int &seconds, bool &utc)
     {
-        tm date = {};
-        std::istringstream iss(dateStr);
-        iss >> std::get_time(&date, "%Y-%m-%d");
-        return date;
+        static const int monthDays[12] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+        size_t size = text.size();
+        utc = size > 0 && text[size - 1] == 'Z';
+        size -= utc;
+        const char *p = text.data();
+        int year, month, mday, hour = 0, minute = 0, second = 0;
+        if ((size != 10 && size != 19) || p[4] != '-' || p[7] != '-' || !digits(p, 4, year) || !digits(p + 5, 2, month) || !digits(p + 8, 2, mday))
+            return false;
+        if (size == 19 && ((p[10] != 'T' && p[10] != ' ') || p[13] != ':' || p[16] != ':' || !digits(p + 11, 2, hour) ||
+                           !digits(p + 14, 2, minute) || !digits(p + 17, 2, second) || hour > 23 || minute > 59 || second > 59))
+            return false;
+        bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+        if (month < 1 || month > 12 || mday < 1 || mday > monthDays[month - 1] || (month == 2 && mday == 29 && !leap))
+            return false;
+        day = daysFromCivil(year, unsigned(month), unsigned(mday));
+        seconds = hour * 3600 + minute * 60 + second;
+        return true;
+    }
+
+    // Day since 1970-01-01 of a date, the time of day is ignored
+    static int64_t parseDay(string_view text)
+    {
+        int64_t day;
+        int seconds;
+        bool utc;
+        if (!parse(text, day, seconds, utc))
+        {
+            throw runtime_error("Invalid date '" + string(text) + "', use YYYY-MM-DD.");
+        }
+        return day;
+    }
+
+    // Month of "YYYY-MM", counted like DateCache::monthOf
+    static int parseMonth(string_view text)
+    {
+        int year, month;
+        if (text.size() != 7 || text[4] != '-' || !digits(text.data(), 4, year) || !digits(text.data() + 5, 2, month) || month < 1 || month > 12)
+        {
+            throw runtime_error("Invalid month '" + string(text) + "', use YYYY-MM.");
+        }
+        return year * 12 + month - 1;
+    }
+
+    // The moment a date names, in local time unless it ends in Z
+    // Without a time that is midnight, or the last second of the day when endOfDay is set
+    static time_t parseTime(string_view text, bool endOfDay = false)
+    {
+        int64_t day;
+        int seconds;
+        bool utc;
+        if (!parse(text, day, seconds, utc))
+        {
+            throw runtime_error("Invalid date '" + string(text) + "', use YYYY-MM-DD.");
+        }
+        if (endOfDay && text.size() - utc == 10)
+        {
+            seconds = 86399;
+        }
+        int64_t moment = day * 86400 + seconds;
+        return utc ? time_t(moment) : DateCache::local().fromLocal(moment);
     }
 };
 
@@ -44,399 +733,8814 @@ public:
 enum class TransactionType
 {
     DEPOSIT,
-    WITHDRAW
+    WITHDRAW,
+    INTEREST
 };
 
-// Single transaction
-class Transaction
+const char *transactionTypeName(TransactionType type)
+{
+    switch (type)
+    {
+    case TransactionType::DEPOSIT:
+        return "Deposit";
+    case TransactionType::WITHDRAW:
+        return "Withdrawal";
+    case TransactionType::INTEREST:
+        return "Interest";
+    default:
+        return "Unknown";
+    }
+}
+
+// Fixed size form of a transaction, this is what the ledger keeps in memory and what snapshots hold on disk
+// The description is an ID in the shared Descriptions table, 0 when it is just the name of the transaction type
+// A description that doesn't fit the table is a memo, kept out of line by the list holding the record
+struct TransactionRecord
 {
+    // flags
+    static const uint8_t MEMO = 1;
+
+    int64_t amount;       // cents
+    uint32_t date;        // seconds since 1970-01-01 UTC, unsigned so it lasts until 2106
+    uint8_t type;
+    uint8_t flags;
+    uint16_t description;
+
+    static bool validDate(int64_t date) { return date >= 0 && date <= int64_t(UINT32_MAX); }
+};
+static_assert(sizeof(TransactionRecord) == 16, "snapshot files depend on the record layout");
+
+// Every distinct transaction description in the ledger, kept once and shared by all accounts
+// Interning takes a lock, but each thread remembers the descriptions it used last, and looking one up by ID takes no lock
+class Descriptions
+{
+public:
+    static const size_t CAPACITY = 65536;
+
 private:
-    string description;
-    double amount;
-    TransactionType type;
-    time_t date;
+    mutex lock;
+    unordered_map<string, uint16_t> ids;
+    deque<string> texts; // never moves an entry
+    atomic<const string *> byID[CAPACITY];
+    atomic<size_t> count;
+
+    struct Recent
+    {
+        string text;
+        uint16_t id = 0;
+    };
 
 public:
-    Transaction(string transDescription, double transAmount, TransactionType transType, time_t transDate) : description(transDescription), amount{transAmount}, type(transType), date(transDate) {}
-    string getDescription() const { return description; }
-    double getAmount() const { return amount; }
-    TransactionType getType() const { return type; }
-    time_t getDate() const { return date; }
+    Descriptions() : byID{}, count(1) {}
+    Descriptions(const Descriptions &) = delete;
+    Descriptions &operator=(const Descriptions &) = delete;
 
-    // overloaded << operator for transaction printing
-    friend ostream &operator<<(ostream &os, const Transaction &transaction)
+    static Descriptions &shared()
+    {
+        static Descriptions table;
+        return table;
+    }
+
+    // ID of text, adding it if it's new, 0 once the table is full
+    uint16_t intern(string_view text)
     {
-        string typeString;
-        switch (transaction.type)
+        thread_local Recent recent[64];
+        Recent &slot = recent[hash<string_view>()(text) % 64];
+        if (slot.id != 0 && slot.text == text)
         {
-        case TransactionType::DEPOSIT:
-            typeString = "Deposit";
-            break;
-        case TransactionType::WITHDRAW:
-            typeString = "Withdrawal";
-            break;
-        default:
-            typeString = "Unknown";
-            break;
+            return slot.id;
+        }
+        lock_guard<mutex> held(lock);
+        auto found = ids.find(string(text));
+        uint16_t id = 0;
+        if (found != ids.end())
+        {
+            id = found->second;
+        }
+        else if (count.load(memory_order_relaxed) < CAPACITY)
+        {
+            id = uint16_t(count.load(memory_order_relaxed));
+            texts.emplace_back(text);
+            ids.emplace(texts.back(), id);
+            byID[id].store(&texts.back(), memory_order_release);
+            count.store(size_t(id) + 1, memory_order_release);
+        }
+        if (id != 0)
+        {
+            slot.text.assign(text);
+            slot.id = id;
         }
-        os << "Description: " << transaction.description << " | " << typeString << " of "
-           << "$" << transaction.amount << " | Date: " << asctime(localtime(&transaction.date));
-        return os;
+        return id;
     }
-};
 
-// Transaction List Node
-class TransactionNode
-{
-public:
-    Transaction transaction;
-    TransactionNode *next;
+    // Text of an ID handed out by intern
+    const string &text(uint16_t id) const { return *byID[id].load(memory_order_acquire); }
 
-    TransactionNode(Transaction trans) : transaction(trans), next(nullptr) {}
-};
+    // What a record's description reads, for records without a memo
+    string_view describe(const TransactionRecord &record) const
+    {
+        return record.description ? string_view(text(record.description)) : string_view(transactionTypeName(TransactionType(record.type)));
+    }
 
-// Transaction List
-class TransactionList
-{
-private:
-    TransactionNode *head;
+    // Number of descriptions, counting the type names as ID 0
+    size_t size() const { return count.load(memory_order_acquire); }
+
+    // Every description from ID 1 on, what a snapshot saves
+    vector<string> all()
+    {
+        lock_guard<mutex> held(lock);
+        return vector<string>(texts.begin(), texts.end());
+    }
+
+    // Puts the descriptions a snapshot saved back under the IDs its records use
+    // They have to agree with what is already in the table, which holds as long as a snapshot is loaded first
+    void restore(const vector<string_view> &saved)
+    {
+        for (size_t i = 0; i < saved.size(); i++)
+        {
+            if (intern(saved[i]) != i + 1)
+            {
+                throw runtime_error("Snapshot descriptions don't match the ones already in use.");
+            }
+        }
+    }
+
+    size_t bytes()
+    {
+        lock_guard<mutex> held(lock);
+        size_t total = sizeof(*this) + ids.size() * (sizeof(pair<const string, uint16_t>) + 2 * sizeof(void *));
+        for (const string &text : texts)
+        {
+            // the deque's copy and the map key's
+            total += 2 * (sizeof(string) + (text.size() > 15 ? text.size() + 1 : 0));
+        }
+        return total;
+    }
+};
+
+// Single transaction
+class Transaction
+{
+private:
+    string description;
+    Money amount;
+    TransactionType type;
+    time_t date;
+
+public:
+    Transaction(string transDescription, Money transAmount, TransactionType transType, time_t transDate) : description(transDescription), amount{transAmount}, type(transType), date(transDate) {}
+    Transaction(const TransactionRecord &record)
+        : description(Descriptions::shared().describe(record)), amount{Money::fromCents(record.amount)}, type(TransactionType(record.type)), date(time_t(record.date)) {}
+    // A record whose description is a memo kept elsewhere
+    Transaction(const TransactionRecord &record, string_view memo)
+        : description(memo), amount{Money::fromCents(record.amount)}, type(TransactionType(record.type)), date(time_t(record.date)) {}
+    string getDescription() const { return description; }
+    Money getAmount() const { return amount; }
+    TransactionType getType() const { return type; }
+    time_t getDate() const { return date; }
+
+    // The description is interned here, a record that comes back flagged MEMO needs its description kept by the caller
+    // Dates outside what a record holds are clamped to 1970-01-01 and 2106-02-07
+    TransactionRecord toRecord() const
+    {
+        TransactionRecord record = {};
+        record.amount = amount.getCents();
+        record.date = uint32_t(clamp<int64_t>(int64_t(date), 0, int64_t(UINT32_MAX)));
+        record.type = uint8_t(type);
+        if (description != transactionTypeName(type))
+        {
+            record.description = Descriptions::shared().intern(description);
+            record.flags = record.description ? 0 : TransactionRecord::MEMO;
+        }
+        return record;
+    }
+
+    // overloaded << operator for transaction printing
+    friend ostream &operator<<(ostream &os, const Transaction &transaction)
+    {
+        char date[32];
+        size_t length = DateCache::local().formatClassic(transaction.date, date);
+        os << "Description: " << transaction.description << " | " << transactionTypeName(transaction.type) << " of "
+           << "$" << transaction.amount << " | Date: ";
+        os.write(date, streamsize(length));
+        return os << '\n';
+    }
+};
+
+// Renders transaction records into a reusable buffer, as the classic history text, CSV or fixed width columns
+// Rows are built in place without allocating, and the buffer only goes out to the stream once it is large
+// (or never, when there is no stream and the caller takes the text from the buffer itself)
+class StatementRenderer
+{
+public:
+    enum class Format
+    {
+        TEXT,
+        CSV,
+        FIXED
+    };
+
+    static const size_t FLUSH_BYTES = 1 << 16;
+
+private:
+    string &buffer;
+    ostream *out;
+    Format format;
+    bool spaced;
+    size_t first;
+    size_t last;
+    size_t seen;
+    DateCache &dates;
+
+    void pad(size_t width, size_t used)
+    {
+        if (used < width)
+            buffer.append(width - used, ' ');
+    }
+
+public:
+    // spaced adds the empty line the interactive history has always had between rows
+    StatementRenderer(string &into, ostream *sink, Format rowFormat = Format::TEXT, bool spacedRows = false)
+        : buffer(into), out(sink), format(rowFormat), spaced(spacedRows), first(0), last(SIZE_MAX), seen(0), dates(DateCache::local()) {}
+    StatementRenderer(const StatementRenderer &) = delete;
+    StatementRenderer &operator=(const StatementRenderer &) = delete;
+
+    // Reads a format name, returns false if there is no such format
+    static bool parseFormat(string_view name, Format &format)
+    {
+        if (name == "text")
+            format = Format::TEXT;
+        else if (name == "csv")
+            format = Format::CSV;
+        else if (name == "fixed")
+            format = Format::FIXED;
+        else
+            return false;
+        return true;
+    }
+
+    // Only renders rows of the given page (counting from 1), every row is still counted
+    void page(size_t number, size_t pageSize)
+    {
+        first = (max<size_t>(number, 1) - 1) * pageSize;
+        last = first + pageSize;
+    }
+
+    // Column titles, for the CSV and fixed width formats
+    void header()
+    {
+        if (format == Format::CSV)
+            buffer += "date,type,amount\n";
+        else if (format == Format::FIXED)
+            buffer += "Date                 Type                 Amount\n";
+    }
+
+    // description defaults to the record's own, a list passes the memo of a record that has one
+    void row(const TransactionRecord &record, string_view description = string_view())
+    {
+        size_t index = seen++;
+        if (index < first || index >= last)
+        {
+            return;
+        }
+        char date[32], amount[24];
+        const char *type = transactionTypeName(TransactionType(record.type));
+        size_t amountLength = Money::fromCents(record.amount).format(amount);
+        switch (format)
+        {
+        case Format::TEXT:
+            buffer += "Description: ";
+            buffer += description.empty() ? Descriptions::shared().describe(record) : description;
+            buffer += " | ";
+            buffer += type;
+            buffer += " of $";
+            buffer.append(amount, amountLength);
+            buffer += " | Date: ";
+            buffer.append(date, dates.formatClassic(time_t(record.date), date));
+            buffer += spaced ? "\n\n" : "\n";
+            break;
+        case Format::CSV:
+            buffer.append(date, dates.formatIso(time_t(record.date), date));
+            buffer += ',';
+            buffer += type;
+            buffer += ',';
+            buffer.append(amount, amountLength);
+            buffer += '\n';
+            break;
+        case Format::FIXED:
+        {
+            size_t dateLength = dates.formatIso(time_t(record.date), date);
+            buffer.append(date, dateLength);
+            pad(21, dateLength);
+            buffer += type;
+            pad(12, strlen(type));
+            pad(15, amountLength);
+            buffer.append(amount, amountLength);
+            buffer += '\n';
+            break;
+        }
+        }
+        if (out && buffer.size() >= FLUSH_BYTES)
+        {
+            flush();
+        }
+    }
+
+    // Rows offered so far, rendered or not
+    size_t rows() const { return seen; }
+
+    // An empty buffer for this thread that keeps its capacity from one statement to the next
+    static string &scratch()
+    {
+        thread_local string buffer;
+        buffer.clear();
+        return buffer;
+    }
+
+    void flush()
+    {
+        if (out)
+        {
+            out->write(buffer.data(), streamsize(buffer.size()));
+            buffer.clear();
+        }
+    }
+
+    ~StatementRenderer() { flush(); }
+};
+
+// Arena that hands out records in chunks that double in size (16, 32, 64, ...)
+// Records never move once placed, appends are O(1), and index lookup is a couple of bit operations
+template <typename T>
+class ChunkArena
+{
+private:
+    static const size_t FIRST_CHUNK_BITS = 4;
+    static const size_t FIRST_CHUNK = size_t{1} << FIRST_CHUNK_BITS;
+
+    vector<T *> chunks;
+    size_t count;
+
+    // chunk c starts at FIRST_CHUNK * (2^c - 1), so it is the top bit of (index >> FIRST_CHUNK_BITS) + 1
+    static size_t chunkOf(size_t index)
+    {
+        unsigned long long j = (index >> FIRST_CHUNK_BITS) + 1;
+#ifdef __GNUC__
+        return size_t(63 - __builtin_clzll(j));
+#else
+        size_t bit = 0;
+        while (j >>= 1)
+            bit++;
+        return bit;
+#endif
+    }
+    static size_t chunkStart(size_t chunk) { return FIRST_CHUNK * ((size_t{1} << chunk) - 1); }
+    static size_t chunkSize(size_t chunk) { return FIRST_CHUNK << chunk; }
+
+public:
+    ChunkArena() : count(0) {}
+    ChunkArena(const ChunkArena &) = delete;
+    ChunkArena &operator=(const ChunkArena &) = delete;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    T &push_back(const T &value)
+    {
+        size_t chunk = chunkOf(count);
+        if (chunk == chunks.size())
+        {
+            chunks.push_back(static_cast<T *>(::operator new(sizeof(T) * chunkSize(chunk))));
+        }
+        T *slot = chunks[chunk] + (count - chunkStart(chunk));
+        new (slot) T(value);
+        count++;
+        return *slot;
+    }
+
+    // Appends n values, copying them in one run per chunk
+    void append(const T *values, size_t n)
+    {
+        while (n)
+        {
+            size_t chunk = chunkOf(count);
+            if (chunk == chunks.size())
+            {
+                chunks.push_back(static_cast<T *>(::operator new(sizeof(T) * chunkSize(chunk))));
+            }
+            size_t offset = count - chunkStart(chunk);
+            size_t room = min(n, chunkSize(chunk) - offset);
+            uninitialized_copy(values, values + room, chunks[chunk] + offset);
+            count += room;
+            values += room;
+            n -= room;
+        }
+    }
+
+    const T &operator[](size_t index) const
+    {
+        size_t chunk = chunkOf(index);
+        return chunks[chunk][index - chunkStart(chunk)];
+    }
+
+    // Walks records chunk by chunk, which is much friendlier to the cache than indexing
+    template <typename Func>
+    void forEach(size_t from, size_t to, Func func) const
+    {
+        while (from < to)
+        {
+            size_t chunk = chunkOf(from);
+            const T *records = chunks[chunk];
+            size_t last = min(to, chunkStart(chunk) + chunkSize(chunk));
+            for (size_t i = from - chunkStart(chunk), n = last - chunkStart(chunk); i < n; i++)
+            {
+                func(records[i]);
+            }
+            from = last;
+        }
+    }
+
+    // Bytes reserved by the arena, used or not
+    size_t capacityBytes() const
+    {
+        size_t total = 0;
+        for (size_t chunk = 0; chunk < chunks.size(); chunk++)
+        {
+            total += chunkSize(chunk) * sizeof(T);
+        }
+        return total;
+    }
+
+    ~ChunkArena()
+    {
+        forEach(0, count, [](const T &record)
+                { record.~T(); });
+        for (T *chunk : chunks)
+        {
+            ::operator delete(chunk);
+        }
+    }
+};
+
+// Optional structure-of-arrays copy of an account's history, one column per field
+// Aggregations read only the columns they need, which is what makes the SIMD kernels below worthwhile
+class TransactionColumns
+{
+public:
+    vector<int64_t> amounts; // cents
+    vector<int64_t> dates;
+    vector<uint8_t> types;
+
+    void append(const TransactionRecord &record)
+    {
+        amounts.push_back(record.amount);
+        dates.push_back(record.date);
+        types.push_back(record.type);
+    }
+
+    size_t size() const { return amounts.size(); }
+    size_t bytes() const { return amounts.capacity() * 8 + dates.capacity() * 8 + types.capacity(); }
+};
+
+// Aggregation kernels over transaction columns, with AVX2 and SSE4.2 versions picked at runtime
+// and a scalar fallback for other CPUs and compilers
+namespace Kernels
+{
+    enum class Isa
+    {
+        SCALAR,
+        SSE42,
+        AVX2
+    };
+
+    const char *isaName(Isa isa)
+    {
+        return isa == Isa::AVX2 ? "avx2" : isa == Isa::SSE42 ? "sse4.2" : "scalar";
+    }
+
+    int64_t totalScalar(const int64_t *amounts, size_t n)
+    {
+        int64_t sum = 0;
+        for (size_t i = 0; i < n; i++)
+            sum += amounts[i];
+        return sum;
+    }
+
+    int64_t totalOfTypeScalar(const int64_t *amounts, const uint8_t *types, size_t n, uint8_t type)
+    {
+        int64_t sum = 0;
+        for (size_t i = 0; i < n; i++)
+            sum += types[i] == type ? amounts[i] : 0;
+        return sum;
+    }
+
+    int64_t totalInWindowScalar(const int64_t *amounts, const int64_t *dates, size_t n, int64_t start, int64_t end)
+    {
+        int64_t sum = 0;
+        for (size_t i = 0; i < n; i++)
+            sum += (dates[i] >= start && dates[i] <= end) ? amounts[i] : 0;
+        return sum;
+    }
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ZBANK_X86_KERNELS
+    __attribute__((target("avx2"))) int64_t horizontalSum(__m256i v)
+    {
+        __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        return _mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1);
+    }
+
+    __attribute__((target("avx2"))) int64_t totalAvx2(const int64_t *amounts, size_t n)
+    {
+        __m256i a = _mm256_setzero_si256(), b = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            a = _mm256_add_epi64(a, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(amounts + i)));
+            b = _mm256_add_epi64(b, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(amounts + i + 4)));
+        }
+        return horizontalSum(_mm256_add_epi64(a, b)) + totalScalar(amounts + i, n - i);
+    }
+
+    __attribute__((target("avx2"))) int64_t totalOfTypeAvx2(const int64_t *amounts, const uint8_t *types, size_t n, uint8_t type)
+    {
+        const __m256i wanted = _mm256_set1_epi64x(type);
+        __m256i sum = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            int32_t packed;
+            memcpy(&packed, types + i, 4);
+            __m256i kinds = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(packed));
+            __m256i mask = _mm256_cmpeq_epi64(kinds, wanted);
+            sum = _mm256_add_epi64(sum, _mm256_and_si256(mask, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(amounts + i))));
+        }
+        return horizontalSum(sum) + totalOfTypeScalar(amounts + i, types + i, n - i, type);
+    }
+
+    __attribute__((target("avx2"))) int64_t totalInWindowAvx2(const int64_t *amounts, const int64_t *dates, size_t n, int64_t start, int64_t end)
+    {
+        const __m256i first = _mm256_set1_epi64x(start), last = _mm256_set1_epi64x(end);
+        __m256i sum = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dates + i));
+            __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi64(first, d), _mm256_cmpgt_epi64(d, last));
+            sum = _mm256_add_epi64(sum, _mm256_andnot_si256(outside, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(amounts + i))));
+        }
+        return horizontalSum(sum) + totalInWindowScalar(amounts + i, dates + i, n - i, start, end);
+    }
+
+    __attribute__((target("sse4.2"))) int64_t totalSse42(const int64_t *amounts, size_t n)
+    {
+        __m128i a = _mm_setzero_si128(), b = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            a = _mm_add_epi64(a, _mm_loadu_si128(reinterpret_cast<const __m128i *>(amounts + i)));
+            b = _mm_add_epi64(b, _mm_loadu_si128(reinterpret_cast<const __m128i *>(amounts + i + 2)));
+        }
+        a = _mm_add_epi64(a, b);
+        return _mm_cvtsi128_si64(a) + _mm_extract_epi64(a, 1) + totalScalar(amounts + i, n - i);
+    }
+
+    __attribute__((target("sse4.2"))) int64_t totalOfTypeSse42(const int64_t *amounts, const uint8_t *types, size_t n, uint8_t type)
+    {
+        const __m128i wanted = _mm_set1_epi64x(type);
+        __m128i sum = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2)
+        {
+            uint16_t packed;
+            memcpy(&packed, types + i, 2);
+            __m128i kinds = _mm_cvtepu8_epi64(_mm_cvtsi32_si128(packed));
+            __m128i mask = _mm_cmpeq_epi64(kinds, wanted);
+            sum = _mm_add_epi64(sum, _mm_and_si128(mask, _mm_loadu_si128(reinterpret_cast<const __m128i *>(amounts + i))));
+        }
+        return _mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1) + totalOfTypeScalar(amounts + i, types + i, n - i, type);
+    }
+
+    __attribute__((target("sse4.2"))) int64_t totalInWindowSse42(const int64_t *amounts, const int64_t *dates, size_t n, int64_t start, int64_t end)
+    {
+        const __m128i first = _mm_set1_epi64x(start), last = _mm_set1_epi64x(end);
+        __m128i sum = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2)
+        {
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dates + i));
+            __m128i outside = _mm_or_si128(_mm_cmpgt_epi64(first, d), _mm_cmpgt_epi64(d, last));
+            sum = _mm_add_epi64(sum, _mm_andnot_si128(outside, _mm_loadu_si128(reinterpret_cast<const __m128i *>(amounts + i))));
+        }
+        return _mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1) + totalInWindowScalar(amounts + i, dates + i, n - i, start, end);
+    }
+#endif
+
+    // Best instruction set this CPU supports
+    Isa detect()
+    {
+#ifdef ZBANK_X86_KERNELS
+        static const Isa best = __builtin_cpu_supports("avx2") ? Isa::AVX2 : __builtin_cpu_supports("sse4.2") ? Isa::SSE42 : Isa::SCALAR;
+        return best;
+#else
+        return Isa::SCALAR;
+#endif
+    }
+
+    int64_t total(const int64_t *amounts, size_t n, Isa isa = detect())
+    {
+#ifdef ZBANK_X86_KERNELS
+        if (isa == Isa::AVX2)
+            return totalAvx2(amounts, n);
+        if (isa == Isa::SSE42)
+            return totalSse42(amounts, n);
+#endif
+        return totalScalar(amounts, n);
+    }
+
+    int64_t totalOfType(const int64_t *amounts, const uint8_t *types, size_t n, uint8_t type, Isa isa = detect())
+    {
+#ifdef ZBANK_X86_KERNELS
+        if (isa == Isa::AVX2)
+            return totalOfTypeAvx2(amounts, types, n, type);
+        if (isa == Isa::SSE42)
+            return totalOfTypeSse42(amounts, types, n, type);
+#endif
+        return totalOfTypeScalar(amounts, types, n, type);
+    }
+
+    int64_t totalInWindow(const int64_t *amounts, const int64_t *dates, size_t n, int64_t start, int64_t end, Isa isa = detect())
+    {
+#ifdef ZBANK_X86_KERNELS
+        if (isa == Isa::AVX2)
+            return totalInWindowAvx2(amounts, dates, n, start, end);
+        if (isa == Isa::SSE42)
+            return totalInWindowSse42(amounts, dates, n, start, end);
+#endif
+        return totalInWindowScalar(amounts, dates, n, start, end);
+    }
+}
+
+// Aggregates of an account's history that are kept up to date as transactions are added, so summaries never walk the history:
+// sums and counts by type, the smallest and largest amount and the time-weighted average balance for every month and for
+// the whole history, plus the largest transactions so far. Adding a record costs O(1) apart from the months it spans
+// Months are local calendar months, numbered year * 12 + month - 1
+class TransactionAnalytics
+{
+public:
+    static constexpr size_t TOP = 10;
+
+    struct Month
+    {
+        int month;
+        int64_t sums[3]; // cents, by TransactionType
+        uint32_t counts[3];
+        int64_t smallest, largest;
+        // Seconds of the month the history covers so far, and the balance in cents summed over them
+        int64_t seconds;
+        double balanceSeconds;
+
+        explicit Month(int number = 0) : month(number), sums{}, counts{}, smallest(INT64_MAX), largest(INT64_MIN), seconds(0), balanceSeconds(0) {}
+        uint32_t count() const { return counts[0] + counts[1] + counts[2]; }
+    };
+
+private:
+    vector<Month> months; // in month order, including quiet months in between
+    Month whole;
+    TransactionRecord top[TOP]; // largest amounts either way first
+    size_t topCount;
+    int64_t balance;
+    int64_t first, last; // earliest and latest date seen
+    int cachedMonth;
+    int64_t cachedStart, cachedEnd;
+
+    static int64_t magnitude(int64_t amount) { return amount < 0 ? -amount : amount; }
+
+    static void tally(Month &month, const TransactionRecord &record)
+    {
+        size_t type = min<size_t>(record.type, 2);
+        month.sums[type] += record.amount;
+        month.counts[type]++;
+        month.smallest = min(month.smallest, record.amount);
+        month.largest = max(month.largest, record.amount);
+    }
+
+    // Month a timestamp falls in, the bounds of the last one asked for are kept
+    int monthAt(int64_t date)
+    {
+        if (date < cachedStart || date >= cachedEnd)
+        {
+            DateCache &dates = DateCache::local();
+            cachedMonth = dates.monthOf(time_t(date));
+            cachedStart = int64_t(dates.monthStart(cachedMonth));
+            cachedEnd = int64_t(dates.monthStart(cachedMonth + 1));
+        }
+        return cachedMonth;
+    }
+
+    Month &entry(int month)
+    {
+        if (months.empty() || months.back().month < month)
+        {
+            months.emplace_back(month);
+            return months.back();
+        }
+        if (months.back().month == month)
+        {
+            return months.back();
+        }
+        auto it = lower_bound(months.begin(), months.end(), month, [](const Month &m, int number)
+                              { return m.month < number; });
+        if (it == months.end() || it->month != month)
+        {
+            it = months.insert(it, Month(month));
+        }
+        return *it;
+    }
+
+    // Adds a balance of cents held from one moment to another, month by month
+    // cover marks those seconds as part of the history, which only happens the first time they are seen
+    void accrue(int64_t from, int64_t to, int64_t cents, bool cover)
+    {
+        while (from < to)
+        {
+            Month &month = entry(monthAt(from));
+            int64_t upto = min(to, cachedEnd);
+            double amount = double(cents) * double(upto - from);
+            month.balanceSeconds += amount;
+            whole.balanceSeconds += amount;
+            if (cover)
+            {
+                month.seconds += upto - from;
+                whole.seconds += upto - from;
+            }
+            from = upto;
+        }
+    }
+
+    void keepTop(const TransactionRecord &record)
+    {
+        int64_t size = magnitude(record.amount);
+        if (topCount == TOP && size <= magnitude(top[TOP - 1].amount))
+        {
+            return;
+        }
+        size_t at = min(topCount, TOP - 1);
+        while (at > 0 && magnitude(top[at - 1].amount) < size)
+        {
+            top[at] = top[at - 1];
+            at--;
+        }
+        top[at] = record;
+        topCount = min(topCount + 1, TOP);
+    }
+
+public:
+    TransactionAnalytics() : topCount(0), balance(0), first(0), last(0), cachedMonth(0), cachedStart(0), cachedEnd(0) {}
+
+    void add(const TransactionRecord &record)
+    {
+        Month &month = entry(monthAt(record.date));
+        tally(month, record);
+        tally(whole, record);
+        // The balance before this record has been held since the latest date, a back dated record changes every balance since
+        if (whole.count() == 1)
+        {
+            first = last = record.date;
+        }
+        else if (record.date >= last)
+        {
+            accrue(last, record.date, balance, true);
+            last = record.date;
+        }
+        else
+        {
+            if (record.date < first)
+            {
+                accrue(record.date, first, 0, true);
+                first = record.date;
+            }
+            accrue(record.date, last, record.amount, false);
+        }
+        balance += record.amount;
+        keepTop(record);
+    }
+
+    const vector<Month> &byMonth() const { return months; }
+    const Month &lifetime() const { return whole; }
+
+    // The month with that number, null if the history doesn't reach it
+    const Month *find(int month) const
+    {
+        auto it = lower_bound(months.begin(), months.end(), month, [](const Month &m, int number)
+                              { return m.month < number; });
+        return it != months.end() && it->month == month ? &*it : nullptr;
+    }
+
+    // Largest transactions by size, deposits and withdrawals alike, biggest first
+    size_t topSize() const { return topCount; }
+    const TransactionRecord *topRecords() const { return top; }
+
+    // Average balance over the part of the month (or lifetime) the history covers, the current balance counting up to now
+    Money averageBalance(const Month &month, time_t now) const
+    {
+        int64_t seconds = month.seconds;
+        double sum = month.balanceSeconds;
+        if (whole.count() != 0 && int64_t(now) > last)
+        {
+            int64_t until = int64_t(now);
+            if (&month != &whole)
+            {
+                DateCache &dates = DateCache::local();
+                int latest = dates.monthOf(time_t(last));
+                until = month.month == latest ? min(until, int64_t(dates.monthStart(latest + 1))) : last;
+            }
+            seconds += until - last;
+            sum += double(balance) * double(until - last);
+        }
+        return Money::fromCents(seconds > 0 ? llround(sum / double(seconds)) : balance);
+    }
+
+    size_t bytes() const { return sizeof(*this) + months.capacity() * sizeof(Month); }
+
+    // "deposits 3 150.00 withdrawals 2 -40.00 interest 0 0.00 smallest -30.00 largest 100.00 average 512.33"
+    void describe(string &out, const Month &month, time_t now) const
+    {
+        static const char *const names[3] = {"deposits ", " withdrawals ", " interest "};
+        char amount[24];
+        for (int type = 0; type < 3; type++)
+        {
+            out += names[type];
+            out += to_string(month.counts[type]);
+            out += ' ';
+            out.append(amount, Money::fromCents(month.sums[type]).format(amount));
+        }
+        out += " smallest ";
+        if (month.count())
+            out.append(amount, Money::fromCents(month.smallest).format(amount));
+        else
+            out += '-';
+        out += " largest ";
+        if (month.count())
+            out.append(amount, Money::fromCents(month.largest).format(amount));
+        else
+            out += '-';
+        out += " average ";
+        out.append(amount, averageBalance(month, now).format(amount));
+    }
+
+    // "2026-10"
+    static string monthName(int month)
+    {
+        char name[32];
+        int year = month >= 0 ? month / 12 : (month - 11) / 12;
+        snprintf(name, sizeof(name), "%04d-%02d", year, month - year * 12 + 1);
+        return name;
+    }
+};
+
+// Transaction List
+class TransactionList
+{
+private:
+    // Records loaded from a snapshot are read in place, the snapshot mapping owns them
+    const TransactionRecord *mapped;
+    size_t mappedCount;
+    // Everything appended since then
+    ChunkArena<TransactionRecord> records;
+    // Column copy of the history for fast aggregation, only kept when asked for
+    unique_ptr<TransactionColumns> columns;
+    // Appends normally arrive in time order, which lets range queries binary search by date
+    // If the clock ever steps backwards we fall back to filtering every record
+    bool ordered;
+    // Running balance every CHECKPOINT_EVERY records, checkpoints[k] is the sum of the first (k + 1) * CHECKPOINT_EVERY amounts
+    // Appends keep them current, a history attached from a snapshot is caught up by its first balance query,
+    // which is why they can change under a const method (readers hold the account's guard like for every other read)
+    static const size_t CHECKPOINT_EVERY = 64;
+    mutable vector<int64_t> checkpoints;
+    mutable int64_t countedTotal;
+    mutable size_t counted;
+    // Built from the history the first time it is asked for, from then on kept current by every append
+    mutable unique_ptr<TransactionAnalytics> analytics;
+    // Descriptions of the records flagged MEMO, by record index
+    vector<pair<size_t, string>> memos;
+
+    const TransactionRecord &record(size_t index) const
+    {
+        return index < mappedCount ? mapped[index] : records[index - mappedCount];
+    }
+
+    // The memo of the record at index, empty when its description is in the shared table
+    string_view memoOf(size_t index, const TransactionRecord &record) const
+    {
+        if (!(record.flags & TransactionRecord::MEMO))
+        {
+            return string_view();
+        }
+        auto it = lower_bound(memos.begin(), memos.end(), index, [](const pair<size_t, string> &memo, size_t at)
+                              { return memo.first < at; });
+        return it != memos.end() && it->first == index ? string_view(it->second) : string_view();
+    }
+
+    Transaction at(size_t index) const
+    {
+        const TransactionRecord &stored = record(index);
+        string_view memo = memoOf(index, stored);
+        return memo.empty() ? Transaction(stored) : Transaction(stored, memo);
+    }
+
+    // First index whose date is not before the given date
+    size_t lowerBound(time_t date) const
+    {
+        size_t lo = 0, hi = size();
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            if (record(mid).date < date)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    // First index whose date is after the given date
+    size_t upperBound(time_t date) const
+    {
+        size_t lo = 0, hi = size();
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            if (record(mid).date <= date)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    // Adds the next record to the running balance
+    void count(const TransactionRecord &record) const
+    {
+        countedTotal += record.amount;
+        if (++counted % CHECKPOINT_EVERY == 0)
+        {
+            checkpoints.push_back(countedTotal);
+        }
+    }
+
+    // Brings the checkpoints up to the end of the history
+    void checkpoint() const
+    {
+        forEachRecord(counted, size(), [&](const TransactionRecord &record)
+                      { count(record); });
+    }
+
+    // Sum of the first count amounts: the checkpoint below count plus fewer than CHECKPOINT_EVERY records
+    int64_t sumOfFirst(size_t count) const
+    {
+        checkpoint();
+        size_t below = count / CHECKPOINT_EVERY;
+        int64_t sum = below ? checkpoints[below - 1] : 0;
+        forEachRecord(below * CHECKPOINT_EVERY, count, [&](const TransactionRecord &record)
+                      { sum += record.amount; });
+        return sum;
+    }
+
+public:
+    // Forward iterator over a slice of the list, skipping out of range records only when the list is unordered
+    // Dereferencing builds the Transaction from its stored record
+    class const_iterator
+    {
+    private:
+        const TransactionList *list;
+        size_t index, last;
+        time_t startDate, endDate;
+        bool filter;
+
+        void skip()
+        {
+            while (filter && index < last && (list->record(index).date < startDate || list->record(index).date > endDate))
+            {
+                index++;
+            }
+        }
+
+    public:
+        using iterator_category = input_iterator_tag;
+        using value_type = Transaction;
+        using difference_type = ptrdiff_t;
+        using pointer = void;
+        using reference = Transaction;
+
+        const_iterator(const TransactionList *l, size_t i, size_t e, time_t start, time_t end, bool f)
+            : list(l), index(i), last(e), startDate(start), endDate(end), filter(f) { skip(); }
+
+        Transaction operator*() const { return list->at(index); }
+        size_t position() const { return index; }
+        const_iterator &operator++()
+        {
+            index++;
+            skip();
+            return *this;
+        }
+        const_iterator operator++(int)
+        {
+            const_iterator old = *this;
+            ++*this;
+            return old;
+        }
+        bool operator==(const const_iterator &other) const { return index == other.index; }
+        bool operator!=(const const_iterator &other) const { return index != other.index; }
+    };
+
+    // Pair of iterators returned by range queries
+    class Range
+    {
+    private:
+        const_iterator first, last;
+
+    public:
+        Range(const_iterator b, const_iterator e) : first(b), last(e) {}
+        const_iterator begin() const { return first; }
+        const_iterator end() const { return last; }
+        bool empty() const { return first == last; }
+    };
+
+    // Whether new lists keep a column copy of their history from the start
+    inline static bool columnsByDefault = false;
+
+    TransactionList() : mapped(nullptr), mappedCount(0), ordered(true), countedTotal(0), counted(0)
+    {
+        if (columnsByDefault)
+        {
+            columns.reset(new TransactionColumns());
+        }
+    }
+
+    // Starts keeping a column copy of the history, filled in from what is already there
+    void enableColumns()
+    {
+        if (columns)
+        {
+            return;
+        }
+        columns.reset(new TransactionColumns());
+        forEachRecord(0, size(), [&](const TransactionRecord &record)
+                      { columns->append(record); });
+    }
+
+    const TransactionColumns *getColumns() const { return columns.get(); }
+
+    // Uses records that live somewhere else (a snapshot mapping) as the start of the history
+    void attach(const TransactionRecord *base, size_t count, bool inOrder)
+    {
+        if (size() != 0)
+        {
+            throw logic_error("Snapshot records can only be attached to an empty transaction list.");
+        }
+        mapped = base;
+        mappedCount = count;
+        ordered = inOrder;
+        analytics.reset();
+        memos.clear();
+        if (columns)
+        {
+            columns.reset();
+            enableColumns();
+        }
+    }
+
+    void addTransaction(Transaction trans)
+    {
+        if (size() != 0 && trans.getDate() < record(size() - 1).date)
+        {
+            ordered = false;
+        }
+        bool current = counted == size();
+        const TransactionRecord &added = records.push_back(trans.toRecord());
+        if (added.flags & TransactionRecord::MEMO)
+        {
+            memos.emplace_back(size() - 1, trans.getDescription());
+        }
+        if (columns)
+        {
+            columns->append(added);
+        }
+        if (current)
+        {
+            count(added);
+        }
+        if (analytics)
+        {
+            analytics->add(added);
+        }
+    }
+
+    // Appends records that are already in stored form, e.g. from a bulk import
+    void addRecords(const TransactionRecord *added, size_t count)
+    {
+        int64_t last = size() != 0 ? record(size() - 1).date : INT64_MIN;
+        for (size_t i = 0; i < count && ordered; i++)
+        {
+            ordered = added[i].date >= last;
+            last = added[i].date;
+        }
+        bool current = counted == size();
+        records.append(added, count);
+        if (columns)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                columns->append(added[i]);
+            }
+        }
+        if (current)
+        {
+            checkpoint();
+        }
+        if (analytics)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                analytics->add(added[i]);
+            }
+        }
+    }
+
+    size_t size() const { return mappedCount + records.size(); }
+    bool isOrdered() const { return ordered; }
+    Transaction operator[](size_t index) const { return at(index); }
+
+    // Memos saved in a snapshot, given back after attach in index order
+    void restoreMemo(size_t index, string text)
+    {
+        memos.emplace_back(index, move(text));
+    }
+    const vector<pair<size_t, string>> &getMemos() const { return memos; }
+
+    size_t capacityBytes() const
+    {
+        size_t bytes = records.capacityBytes() + checkpoints.capacity() * sizeof(int64_t) + (analytics ? analytics->bytes() : 0) +
+                       memos.capacity() * sizeof(memos[0]);
+        for (const pair<size_t, string> &memo : memos)
+        {
+            bytes += memo.second.size() > 15 ? memo.second.capacity() + 1 : 0;
+        }
+        return bytes;
+    }
+
+    // Walks the stored records in [from, to), mapped ones first and then the arena chunk by chunk
+    template <typename Func>
+    void forEachRecord(size_t from, size_t to, Func func) const
+    {
+        for (; from < min(to, mappedCount); from++)
+        {
+            func(mapped[from]);
+        }
+        if (to > mappedCount)
+        {
+            records.forEach(from - mappedCount, to - mappedCount, func);
+        }
+    }
+
+    const_iterator begin() const { return const_iterator(this, 0, size(), 0, 0, false); }
+    const_iterator end() const { return const_iterator(this, size(), size(), 0, 0, false); }
+
+    // Transactions dated within [startDate, endDate], found in O(log n) while the list is in time order
+    Range range(time_t startDate, time_t endDate) const
+    {
+        if (!ordered)
+        {
+            return Range(const_iterator(this, 0, size(), startDate, endDate, true),
+                         const_iterator(this, size(), size(), startDate, endDate, true));
+        }
+        size_t first = lowerBound(startDate);
+        size_t last = max(first, upperBound(endDate));
+        return Range(const_iterator(this, first, last, startDate, endDate, false),
+                     const_iterator(this, last, last, startDate, endDate, false));
+    }
+
+    // Sum of every amount in the history
+    Money total() const
+    {
+        if (columns)
+        {
+            return Money::fromCents(Kernels::total(columns->amounts.data(), columns->size()));
+        }
+        int64_t sum = 0;
+        forEachRecord(0, size(), [&](const TransactionRecord &record)
+                      { sum += record.amount; });
+        return Money::fromCents(sum);
+    }
+
+    // Sum of every amount of one type, e.g. all deposits
+    Money totalOfType(TransactionType type) const
+    {
+        if (columns)
+        {
+            return Money::fromCents(Kernels::totalOfType(columns->amounts.data(), columns->types.data(), columns->size(), uint8_t(type)));
+        }
+        int64_t sum = 0;
+        forEachRecord(0, size(), [&](const TransactionRecord &record)
+                      { sum += record.type == uint8_t(type) ? record.amount : 0; });
+        return Money::fromCents(sum);
+    }
+
+    // Sum of the amounts dated within [startDate, endDate]
+    Money totalInRange(time_t startDate, time_t endDate) const
+    {
+        if (!ordered)
+        {
+            if (columns)
+            {
+                return Money::fromCents(Kernels::totalInWindow(columns->amounts.data(), columns->dates.data(), columns->size(), startDate, endDate));
+            }
+            int64_t sum = 0;
+            forEachRecord(0, size(), [&](const TransactionRecord &record)
+                          { sum += (record.date >= startDate && record.date <= endDate) ? record.amount : 0; });
+            return Money::fromCents(sum);
+        }
+        size_t first = lowerBound(startDate);
+        size_t last = max(first, upperBound(endDate));
+        if (columns)
+        {
+            return Money::fromCents(Kernels::total(columns->amounts.data() + first, last - first));
+        }
+        int64_t sum = 0;
+        forEachRecord(first, last, [&](const TransactionRecord &record)
+                      { sum += record.amount; });
+        return Money::fromCents(sum);
+    }
+
+    // Monthly and lifetime aggregates of the history, one pass the first time and O(1) after that
+    const TransactionAnalytics &analyze() const
+    {
+        if (!analytics)
+        {
+            analytics.reset(new TransactionAnalytics());
+            forEachRecord(0, size(), [&](const TransactionRecord &record)
+                          { analytics->add(record); });
+        }
+        return *analytics;
+    }
+
+    // What the history adds up to at the end of date, i.e. the balance then
+    // O(log n) plus a short tail while the list is in time order, a full pass otherwise
+    Money balanceAsOf(time_t date) const
+    {
+        if (!ordered)
+        {
+            int64_t sum = 0;
+            forEachRecord(0, size(), [&](const TransactionRecord &record)
+                          { sum += record.date <= date ? record.amount : 0; });
+            return Money::fromCents(sum);
+        }
+        return Money::fromCents(sumOfFirst(upperBound(date)));
+    }
+
+    // Calls func on every record dated within [startDate, endDate], in history order
+    template <typename Func>
+    void forEachRecordInRange(time_t startDate, time_t endDate, Func func) const
+    {
+        if (!ordered)
+        {
+            forEachRecord(0, size(), [&](const TransactionRecord &record)
+                          { if (record.date >= startDate && record.date <= endDate) func(record); });
+            return;
+        }
+        size_t first = lowerBound(startDate);
+        forEachRecord(first, max(first, upperBound(endDate)), func);
+    }
+
+    // Feeds the whole history to a statement renderer
+    void render(StatementRenderer &renderer) const
+    {
+        ZBANK_PROBE(Metrics::STATEMENT);
+        size_t index = 0;
+        forEachRecord(0, size(), [&](const TransactionRecord &record)
+                      { renderer.row(record, memoOf(index++, record)); });
+    }
+
+    void renderRange(StatementRenderer &renderer, time_t startDate, time_t endDate) const
+    {
+        ZBANK_PROBE(Metrics::STATEMENT);
+        size_t first = ordered ? lowerBound(startDate) : 0;
+        size_t last = ordered ? max(first, upperBound(endDate)) : size();
+        size_t index = first;
+        forEachRecord(first, last, [&](const TransactionRecord &record)
+                      {
+            if (record.date >= startDate && record.date <= endDate)
+                renderer.row(record, memoOf(index, record));
+            index++; });
+    }
+
+    void displayTransactions() const
+    {
+        StatementRenderer renderer(StatementRenderer::scratch(), &cout, StatementRenderer::Format::TEXT, true);
+        render(renderer);
+    }
+
+    // Method to filter transactions within a date range
+    void displayTransactionsInRange(time_t startDate, time_t endDate) const
+    {
+        StatementRenderer renderer(StatementRenderer::scratch(), &cout, StatementRenderer::Format::TEXT, true);
+        renderRange(renderer, startDate, endDate);
+    }
+};
+
+// Enum for account type
+enum class AccountType
+{
+    CHECKING,
+    SAVINGS
+};
+
+// A recurring payment into, out of, or from one account to another, monthly on a day or every so many days
+// The same 32 bytes in snapshots and journal records
+struct StandingOrder
+{
+    enum Kind : uint8_t
+    {
+        DEPOSIT = 1,
+        WITHDRAW = 2,
+        TRANSFER = 3
+    };
+
+    uint64_t id;
+    int32_t account;
+    int32_t target;     // the account a transfer pays, 0 otherwise
+    int64_t amount;     // cents
+    uint32_t nextDue;   // day (days since 1970-01-01 UTC) of the next payment
+    uint16_t every;     // days between payments, 0 for monthly ones
+    uint8_t kind;
+    uint8_t dayOfMonth; // monthly payments fall on this day, or the last day of shorter months
+
+    // The day a monthly payment falls on in a month
+    static uint32_t dayIn(int year, unsigned month, unsigned dayOfMonth)
+    {
+        int64_t first = daysFromCivil(year, month, 1);
+        int64_t next = month == 12 ? daysFromCivil(year + 1, 1, 1) : daysFromCivil(year, month + 1, 1);
+        return uint32_t(first + min<int64_t>(dayOfMonth, next - first) - 1);
+    }
+
+    // The first payment day after day
+    uint32_t after(uint32_t day) const
+    {
+        if (every > 0)
+        {
+            return day + every;
+        }
+        int year;
+        unsigned month, mday;
+        civilFromDays(day, year, month, mday);
+        uint32_t due = dayIn(year, month, dayOfMonth);
+        if (due > day)
+        {
+            return due;
+        }
+        return month == 12 ? dayIn(year + 1, 1, dayOfMonth) : dayIn(year, month + 1, dayOfMonth);
+    }
+
+    static const char *kindName(uint8_t kind) { return kind == DEPOSIT ? "deposit" : kind == WITHDRAW ? "withdraw" : "transfer"; }
+
+    // "deposit 100.00 monthly 1 next 2026-11-01", transfers name the account they pay
+    string describe() const
+    {
+        char text[96], money[24];
+        money[Money::fromCents(amount).format(money)] = '\0';
+        int year;
+        unsigned month, day;
+        civilFromDays(nextDue, year, month, day);
+        string target = kind == TRANSFER ? to_string(this->target) + " " : "";
+        snprintf(text, sizeof(text), "%s %s%s %s %u next %04d-%02u-%02u", kindName(kind), target.c_str(), money, every ? "every" : "monthly",
+                 every ? unsigned(every) : unsigned(dayOfMonth), year, month, day);
+        return text;
+    }
+};
+static_assert(sizeof(StandingOrder) == 32, "snapshots and the journal depend on the standing order layout");
+
+class Account;
+
+// Gets told about every change to the ledger, e.g. so it can be journaled
+class LedgerObserver
+{
+public:
+    virtual void accountOpened(const Account &acc) = 0;
+    virtual void transactionPosted(const Account &acc, const Transaction &trans) = 0;
+    virtual void accountClosed(const Account &acc) = 0;
+    // A transfer is two postings that belong together, by default they are reported one at a time
+    virtual void transferPosted(const Account &from, const Account &to, const Transaction &out, const Transaction &in)
+    {
+        transactionPosted(from, out);
+        transactionPosted(to, in);
+    }
+    // Bulk imported history, by default reported one transaction at a time
+    virtual void historyImported(const Account &acc, const TransactionRecord *records, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            transactionPosted(acc, Transaction(records[i]));
+        }
+    }
+    // Standing orders placed, cancelled (by ID) and moved on to their next payment (ID and day), the move is
+    // reported before the payment is posted, so a crash in between can miss a payment but never make it twice
+    virtual void orderPlaced(const StandingOrder &) {}
+    virtual void orderCancelled(uint64_t) {}
+    virtual void orderAdvanced(uint64_t, uint32_t) {}
+    virtual ~LedgerObserver() {}
+};
+
+// Where postings get their date from: the system clock, unless something else has been installed
+// A replay installs a clock that follows the recording, so the same replay always produces the same history
+class LedgerClock
+{
+private:
+    inline static atomic<const LedgerClock *> installed{nullptr};
+
+public:
+    virtual time_t read() const = 0;
+    virtual ~LedgerClock() {}
+
+    static time_t now()
+    {
+        const LedgerClock *clock = installed.load(memory_order_acquire);
+        return clock ? clock->read() : time(nullptr);
+    }
+
+    // nullptr goes back to the system clock
+    static void install(const LedgerClock *clock) { installed.store(clock, memory_order_release); }
+};
+
+// A clock that only moves when told to, and never backwards
+class ManualClock : public LedgerClock
+{
+private:
+    atomic<int64_t> seconds;
+
+public:
+    explicit ManualClock(time_t start = 0) : seconds(int64_t(start)) {}
+
+    time_t read() const override { return time_t(seconds.load(memory_order_relaxed)); }
+
+    void advanceTo(time_t date)
+    {
+        int64_t current = seconds.load(memory_order_relaxed);
+        while (current < int64_t(date) && !seconds.compare_exchange_weak(current, int64_t(date), memory_order_relaxed))
+        {
+        }
+    }
+};
+
+// Salted, memory-hard password hashes: scrypt (RFC 7914) over PBKDF2-HMAC-SHA256, with r = 8 and p = 1
+// Stored as $scrypt$<log2 N>$<salt>$<key>, salt and key in hex. Checking one takes N KB of memory and at
+// the default N = 2^14 tens of milliseconds, so the server checks logins off the command path (see LoginPool)
+// Accounts opened before passwords were hashed keep their plain password, which is still accepted
+class PasswordHash
+{
+private:
+    static constexpr const char *PREFIX = "$scrypt$";
+    static const size_t SALT = 16, KEY = 32;
+
+    struct Sha256
+    {
+        uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        uint8_t block[64];
+        size_t used = 0;
+        uint64_t total = 0;
+
+        static uint32_t rotate(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+        void compress(const uint8_t *data)
+        {
+            static const uint32_t K[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be,
+                0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa,
+                0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85,
+                0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+                0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f,
+                0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+            uint32_t w[64];
+            for (int i = 0; i < 16; i++)
+            {
+                w[i] = uint32_t(data[4 * i]) << 24 | uint32_t(data[4 * i + 1]) << 16 | uint32_t(data[4 * i + 2]) << 8 | data[4 * i + 3];
+            }
+            for (int i = 16; i < 64; i++)
+            {
+                uint32_t s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                uint32_t s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+            }
+            uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+            for (int i = 0; i < 64; i++)
+            {
+                uint32_t t1 = h + (rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+                uint32_t t2 = (rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+            state[4] += e;
+            state[5] += f;
+            state[6] += g;
+            state[7] += h;
+        }
+
+        void update(const uint8_t *data, size_t size)
+        {
+            total += size;
+            while (size > 0)
+            {
+                size_t take = min(size, sizeof(block) - used);
+                memcpy(block + used, data, take);
+                used += take;
+                data += take;
+                size -= take;
+                if (used == sizeof(block))
+                {
+                    compress(block);
+                    used = 0;
+                }
+            }
+        }
+
+        void finish(uint8_t out[32])
+        {
+            uint64_t bits = total * 8;
+            uint8_t pad[72] = {0x80};
+            size_t padding = (used < 56 ? 56 : 120) - used;
+            for (int i = 0; i < 8; i++)
+            {
+                pad[padding + i] = uint8_t(bits >> (56 - 8 * i));
+            }
+            update(pad, padding + 8);
+            for (int i = 0; i < 8; i++)
+            {
+                out[4 * i] = uint8_t(state[i] >> 24);
+                out[4 * i + 1] = uint8_t(state[i] >> 16);
+                out[4 * i + 2] = uint8_t(state[i] >> 8);
+                out[4 * i + 3] = uint8_t(state[i]);
+            }
+        }
+    };
+
+    // PBKDF2-HMAC-SHA256 with a single iteration, which is all scrypt asks of it
+    static void pbkdf2(string_view password, const uint8_t *salt, size_t saltSize, uint8_t *out, size_t length)
+    {
+        uint8_t key[64] = {};
+        if (password.size() > sizeof(key))
+        {
+            Sha256 digest;
+            digest.update(reinterpret_cast<const uint8_t *>(password.data()), password.size());
+            digest.finish(key);
+        }
+        else
+        {
+            memcpy(key, password.data(), password.size());
+        }
+        uint8_t innerPad[64], outerPad[64];
+        for (int i = 0; i < 64; i++)
+        {
+            innerPad[i] = key[i] ^ 0x36;
+            outerPad[i] = key[i] ^ 0x5c;
+        }
+        Sha256 inner, outer;
+        inner.update(innerPad, 64);
+        outer.update(outerPad, 64);
+
+        for (uint32_t index = 1; length > 0; index++)
+        {
+            uint8_t counter[4] = {uint8_t(index >> 24), uint8_t(index >> 16), uint8_t(index >> 8), uint8_t(index)};
+            uint8_t digest[32];
+            Sha256 first = inner;
+            first.update(salt, saltSize);
+            first.update(counter, 4);
+            first.finish(digest);
+            Sha256 second = outer;
+            second.update(digest, 32);
+            second.finish(digest);
+            size_t take = min<size_t>(length, 32);
+            memcpy(out, digest, take);
+            out += take;
+            length -= take;
+        }
+    }
+
+    static void salsa8(uint32_t block[16])
+    {
+        uint32_t x[16];
+        memcpy(x, block, sizeof(x));
+        auto rotate = [](uint32_t v, int n)
+        { return (v << n) | (v >> (32 - n)); };
+        for (int round = 0; round < 8; round += 2)
+        {
+            x[4] ^= rotate(x[0] + x[12], 7), x[8] ^= rotate(x[4] + x[0], 9), x[12] ^= rotate(x[8] + x[4], 13), x[0] ^= rotate(x[12] + x[8], 18);
+            x[9] ^= rotate(x[5] + x[1], 7), x[13] ^= rotate(x[9] + x[5], 9), x[1] ^= rotate(x[13] + x[9], 13), x[5] ^= rotate(x[1] + x[13], 18);
+            x[14] ^= rotate(x[10] + x[6], 7), x[2] ^= rotate(x[14] + x[10], 9), x[6] ^= rotate(x[2] + x[14], 13), x[10] ^= rotate(x[6] + x[2], 18);
+            x[3] ^= rotate(x[15] + x[11], 7), x[7] ^= rotate(x[3] + x[15], 9), x[11] ^= rotate(x[7] + x[3], 13), x[15] ^= rotate(x[11] + x[7], 18);
+            x[1] ^= rotate(x[0] + x[3], 7), x[2] ^= rotate(x[1] + x[0], 9), x[3] ^= rotate(x[2] + x[1], 13), x[0] ^= rotate(x[3] + x[2], 18);
+            x[6] ^= rotate(x[5] + x[4], 7), x[7] ^= rotate(x[6] + x[5], 9), x[4] ^= rotate(x[7] + x[6], 13), x[5] ^= rotate(x[4] + x[7], 18);
+            x[11] ^= rotate(x[10] + x[9], 7), x[8] ^= rotate(x[11] + x[10], 9), x[9] ^= rotate(x[8] + x[11], 13), x[10] ^= rotate(x[9] + x[8], 18);
+            x[12] ^= rotate(x[15] + x[14], 7), x[13] ^= rotate(x[12] + x[15], 9), x[14] ^= rotate(x[13] + x[12], 13), x[15] ^= rotate(x[14] + x[13], 18);
+        }
+        for (int i = 0; i < 16; i++)
+        {
+            block[i] += x[i];
+        }
+    }
+
+    // BlockMix: 2r 64 byte blocks in, shuffled evens first then odds out
+    static void blockMix(const uint32_t *in, uint32_t *out, uint32_t r)
+    {
+        uint32_t x[16];
+        memcpy(x, in + (2 * r - 1) * 16, sizeof(x));
+        for (uint32_t i = 0; i < 2 * r; i++)
+        {
+            for (int k = 0; k < 16; k++)
+            {
+                x[k] ^= in[i * 16 + k];
+            }
+            salsa8(x);
+            memcpy(out + ((i & 1) * r + i / 2) * 16, x, sizeof(x));
+        }
+    }
+
+    static string hex(const uint8_t *data, size_t size)
+    {
+        static const char digits[] = "0123456789abcdef";
+        string text(size * 2, '0');
+        for (size_t i = 0; i < size; i++)
+        {
+            text[2 * i] = digits[data[i] >> 4];
+            text[2 * i + 1] = digits[data[i] & 15];
+        }
+        return text;
+    }
+
+    static bool unhex(string_view text, uint8_t *out, size_t size)
+    {
+        if (text.size() != size * 2)
+            return false;
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            char c = text[i];
+            int value = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+            if (value < 0)
+                return false;
+            out[i / 2] = uint8_t(i % 2 ? out[i / 2] | value : value << 4);
+        }
+        return true;
+    }
+
+    // Compares in time that only depends on the lengths
+    static bool same(const uint8_t *a, const uint8_t *b, size_t size)
+    {
+        uint8_t difference = 0;
+        for (size_t i = 0; i < size; i++)
+        {
+            difference |= a[i] ^ b[i];
+        }
+        return difference == 0;
+    }
+
+public:
+    // log2 of N for new hashes, checking uses whatever the stored hash says
+    inline static int cost = 14;
+
+    // scrypt(password, salt, N, r, p) into out
+    static void derive(string_view password, const uint8_t *salt, size_t saltSize, uint64_t n, uint32_t r, uint32_t p, uint8_t *out, size_t length)
+    {
+        const size_t words = 32 * size_t(r);
+        vector<uint8_t> bytes(4 * words * p);
+        pbkdf2(password, salt, saltSize, bytes.data(), bytes.size());
+        vector<uint32_t> table(words * n), x(words), y(words);
+        for (uint32_t part = 0; part < p; part++)
+        {
+            uint8_t *chunk = bytes.data() + 4 * words * part;
+            for (size_t i = 0; i < words; i++)
+            {
+                x[i] = uint32_t(chunk[4 * i]) | uint32_t(chunk[4 * i + 1]) << 8 | uint32_t(chunk[4 * i + 2]) << 16 | uint32_t(chunk[4 * i + 3]) << 24;
+            }
+            for (uint64_t i = 0; i < n; i++)
+            {
+                memcpy(&table[i * words], x.data(), 4 * words);
+                blockMix(x.data(), y.data(), r);
+                x.swap(y);
+            }
+            for (uint64_t i = 0; i < n; i++)
+            {
+                const uint32_t *row = &table[(x[words - 16] & (n - 1)) * words];
+                for (size_t k = 0; k < words; k++)
+                {
+                    x[k] ^= row[k];
+                }
+                blockMix(x.data(), y.data(), r);
+                x.swap(y);
+            }
+            for (size_t i = 0; i < words; i++)
+            {
+                chunk[4 * i] = uint8_t(x[i]);
+                chunk[4 * i + 1] = uint8_t(x[i] >> 8);
+                chunk[4 * i + 2] = uint8_t(x[i] >> 16);
+                chunk[4 * i + 3] = uint8_t(x[i] >> 24);
+            }
+        }
+        pbkdf2(password, bytes.data(), bytes.size(), out, length);
+    }
+
+    // A new hash of password with a fresh random salt
+    static string make(string_view password)
+    {
+        thread_local random_device entropy;
+        uint8_t salt[SALT], key[KEY];
+        for (size_t i = 0; i < SALT; i += 4)
+        {
+            uint32_t bits = entropy();
+            memcpy(salt + i, &bits, 4);
+        }
+        derive(password, salt, SALT, uint64_t(1) << cost, 8, 1, key, KEY);
+        return PREFIX + to_string(cost) + "$" + hex(salt, SALT) + "$" + hex(key, KEY);
+    }
+
+    static bool hashed(const string &stored) { return stored.compare(0, strlen(PREFIX), PREFIX) == 0; }
+
+    // Whether password matches what an account stored, a hash or a password from before hashing
+    static bool verify(const string &stored, string_view password)
+    {
+        if (!hashed(stored))
+        {
+            return stored.size() == password.size() && same(reinterpret_cast<const uint8_t *>(stored.data()), reinterpret_cast<const uint8_t *>(password.data()), stored.size());
+        }
+        string_view fields = string_view(stored).substr(strlen(PREFIX));
+        int storedCost = 0;
+        auto [end, error] = from_chars(fields.data(), fields.data() + fields.size(), storedCost);
+        size_t costLength = size_t(end - fields.data());
+        uint8_t salt[SALT], key[KEY], candidate[KEY];
+        if (error != errc() || storedCost < 1 || storedCost > 20 || fields.size() != costLength + 2 + 2 * SALT + 2 * KEY ||
+            fields[costLength] != '$' || fields[costLength + 1 + 2 * SALT] != '$' ||
+            !unhex(fields.substr(costLength + 1, 2 * SALT), salt, SALT) || !unhex(fields.substr(costLength + 2 + 2 * SALT), key, KEY))
+        {
+            return false;
+        }
+        derive(password, salt, SALT, uint64_t(1) << storedCost, 8, 1, candidate, KEY);
+        return same(key, candidate, KEY);
+    }
+};
+
+// Base Account class
+class Account
+{
+public:
+    // C++17 | Inline static member
+    inline static vector<LedgerObserver *> observers;
+
+    // Guards the transaction history, the balance itself is atomic
+    // Never held while taking another account's guard except by transfer, which takes both in ID order
+    mutable mutex guard;
+
+    string username;
+    // A PasswordHash, or the plain password of an account opened before passwords were hashed
+    string password;
+    int ID;
+    AtomicMoney balance;
+    TransactionList transactions;
+    // Last day (days since 1970-01-01 UTC) interest was accrued through, 0 before the first accrual
+    int64_t accruedThrough;
+    // Fraction of a cent of interest not posted yet
+    double interestCarry;
+
+    Account(string accUsername, string accPassword) : username(accUsername), password(accPassword), ID(0), balance(), accruedThrough(0), interestCarry(0) {}
+
+    Money getBalance() const { return balance; }
+    TransactionList::Range transactionsInRange(time_t startDate, time_t endDate) const { return transactions.range(startDate, endDate); }
+
+private:
+    // Adds to the history and tells the observers, guard has to be held
+    void record(const Transaction &trans)
+    {
+        transactions.addTransaction(trans);
+        for (LedgerObserver *observer : observers)
+        {
+            observer->transactionPosted(*this, trans);
+        }
+    }
+
+    // Takes amount out of the balance if the account's rules allow it at the moment the update lands
+    bool reserve(Money amount)
+    {
+        return balance.takeIf(amount, [&](Money current)
+                              { return canWithdrawFrom(current, amount); });
+    }
+
+public:
+    // Applies a transaction to the balance and history, and tells the observers about it
+    void post(const Transaction &trans)
+    {
+        if (trans.getType() == TransactionType::INTEREST)
+        {
+            accruedThrough = max<int64_t>(accruedThrough, int64_t(trans.getDate()) / 86400);
+        }
+        balance.add(trans.getAmount());
+        lock_guard<mutex> held(guard);
+        record(trans);
+    }
+
+    // Appends history that happened somewhere else (a migration) in one step
+    // The balance moves by the sum of the amounts, nothing is checked against the overdraft limit
+    void import(const TransactionRecord *records, size_t count)
+    {
+        int64_t sum = 0;
+        int64_t interestDay = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            sum += records[i].amount;
+            if (records[i].type == uint8_t(TransactionType::INTEREST))
+            {
+                interestDay = max<int64_t>(interestDay, records[i].date / 86400);
+            }
+        }
+        lock_guard<mutex> held(guard);
+        transactions.addRecords(records, count);
+        balance.add(Money::fromCents(sum));
+        accruedThrough = max(accruedThrough, interestDay);
+        for (LedgerObserver *observer : observers)
+        {
+            observer->historyImported(*this, records, count);
+        }
+    }
+
+    // Balance at the end of date, worked out from the history
+    Money balanceAsOf(time_t date) const
+    {
+        lock_guard<mutex> held(guard);
+        return transactions.balanceAsOf(date);
+    }
+
+    // Checks that the transaction history adds up to the balance
+    // Only exact while nothing is being posted to the account
+    bool verifyBalance() const
+    {
+        lock_guard<mutex> held(guard);
+        return transactions.total() == getBalance();
+    }
+
+    // Non-interactive deposit and withdrawal, these throw instead of printing anything
+    // Both are safe to call from several threads at once, standing orders give the day they were due as the date
+    void credit(Money amount, time_t date = LedgerClock::now())
+    {
+        ZBANK_PROBE(Metrics::CREDIT);
+        if (amount <= Money())
+        {
+            throw runtime_error("Invalid amount entered.");
+        }
+        balance.add(amount);
+        lock_guard<mutex> held(guard);
+        record(Transaction("Deposit", amount, TransactionType::DEPOSIT, date));
+    }
+
+    void debit(Money amount, time_t date = LedgerClock::now())
+    {
+        ZBANK_PROBE(Metrics::DEBIT);
+        if (amount <= Money())
+        {
+            throw runtime_error("Invalid amount entered.");
+        }
+        if (!reserve(amount))
+        {
+            throw runtime_error("Insufficient funds.");
+        }
+        lock_guard<mutex> held(guard);
+        record(Transaction("Withdrawal", -amount, TransactionType::WITHDRAW, date));
+    }
+
+    // Moves amount from one account to another as a single step, nobody sees one posting without the other
+    // The guards are always taken lower ID first, so two opposite transfers can't deadlock
+    static void transfer(Account &from, Account &to, Money amount, time_t date = LedgerClock::now())
+    {
+        ZBANK_PROBE(Metrics::MOVE);
+        if (&from == &to)
+        {
+            throw runtime_error("Cannot transfer to the same account.");
+        }
+        if (amount <= Money())
+        {
+            throw runtime_error("Invalid amount entered.");
+        }
+        Account &first = from.ID < to.ID ? from : to;
+        Account &second = from.ID < to.ID ? to : from;
+        lock_guard<mutex> firstHeld(first.guard);
+        lock_guard<mutex> secondHeld(second.guard);
+        if (!from.reserve(amount))
+        {
+            throw runtime_error("Insufficient funds.");
+        }
+        to.balance.add(amount);
+
+        Transaction out("Transfer to account " + to_string(to.ID), -amount, TransactionType::WITHDRAW, date);
+        Transaction in("Transfer from account " + to_string(from.ID), amount, TransactionType::DEPOSIT, date);
+        from.transactions.addTransaction(out);
+        to.transactions.addTransaction(in);
+        for (LedgerObserver *observer : observers)
+        {
+            observer->transferPosted(from, to, out, in);
+        }
+    }
+
+    bool canWithdraw(Money amount) const { return canWithdrawFrom(getBalance(), amount); }
+
+    virtual bool canWithdrawFrom(Money currentBalance, Money amount) const = 0;
+    virtual AccountType getType() const = 0;
+    virtual Money getOverdraftLimit() const { return Money(); }
+    virtual double getInterestRate() const { return 0; }
+    virtual void deposit(Money amount) = 0;
+    virtual void withdraw(Money amount) = 0;
+    virtual void displayTransactionHistory() const = 0;
+    virtual void displayTransactionHistoryInRange(time_t startDate, time_t endDate) const = 0;
+    virtual void displaySummary() const = 0;
+    virtual bool authenticate(string accUsername, string accPassword) const = 0;
+    virtual ~Account() {}
+};
+
+// Interest calculator class
+class InterestCalculator
+{
+public:
+    static Money calculateInterest(Money balance, double interestRate)
+    {
+        return balance.times(interestRate);
+    }
+
+    // Interest in (fractional) cents a balance earns over a number of days compounded daily
+    static double dailyInterest(Money balance, double interestRate, int64_t days)
+    {
+        return double(balance.getCents()) * expm1(double(days) * log1p(interestRate / 365));
+    }
+};
+
+// Overdraft protection class
+class OverdraftProtection
+{
+public:
+    static bool checkOverdraft(Money balance, Money amount, Money overdraftLimit)
+    {
+        return balance + overdraftLimit >= amount;
+    }
+};
+
+// Account rules, combined at compile time into the account types below
+// Overdraft rules: how far below zero a withdrawal may take the balance, the limit a new account gets is a template parameter
+template <int64_t DefaultLimitCents>
+struct OverdraftUpTo
+{
+    Money limit = Money::fromCents(DefaultLimitCents);
+    bool allows(Money balance, Money amount) const { return OverdraftProtection::checkOverdraft(balance, amount, limit); }
+};
+
+struct NoOverdraft
+{
+    Money limit;
+    bool allows(Money balance, Money amount) const { return balance >= amount; }
+};
+
+// Interest rules, default rates are in basis points so they can be template parameters
+struct NoInterest
+{
+    double rate() const { return 0; }
+};
+
+template <int DefaultBasisPoints>
+struct DailyInterest
+{
+    double annualRate = DefaultBasisPoints / 10000.0;
+    double rate() const { return annualRate; }
+};
+
+// One account type per combination of rules, written once instead of per subclass
+// Everything is final, so code that knows the concrete type calls the rules directly instead of through the vtable
+// Accounts are only made by CustomerList::create, which keeps each type in its own contiguous pool
+template <AccountType Type, typename OverdraftRule, typename InterestRule>
+class PolicyAccount : public Account
+{
+private:
+    OverdraftRule overdraft;
+    InterestRule interest;
+
+    static constexpr const char *typeName() { return Type == AccountType::CHECKING ? "Checking" : "Savings"; }
+
+public:
+    PolicyAccount(string accUsername, string accPassword, OverdraftRule overdraftRule, InterestRule interestRule)
+        : Account(accUsername, accPassword), overdraft(overdraftRule), interest(interestRule) {}
+
+    static void *operator new(size_t) = delete;
+
+    AccountType getType() const final { return Type; }
+    Money getOverdraftLimit() const final { return overdraft.limit; }
+    double getInterestRate() const final { return interest.rate(); }
+    bool canWithdrawFrom(Money currentBalance, Money amount) const final { return overdraft.allows(currentBalance, amount); }
+
+    void deposit(Money amount) final
+    {
+        try
+        {
+            credit(amount);
+            cout << "Deposit of $" << amount << " successful.\nCurrent balance: $" << getBalance() << endl;
+        }
+        catch (const exception &ex)
+        {
+            cerr << "Error: " << ex.what() << endl;
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+    }
+
+    void withdraw(Money amount) final
+    {
+        try
+        {
+            debit(amount);
+            cout << "Withdrawal of $" << amount << " successful.\nRemaining balance: $" << getBalance() << endl;
+        }
+        catch (const exception &ex)
+        {
+            cerr << "Error: " << ex.what() << endl;
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+    }
+
+    void displayTransactionHistory() const final
+    {
+        cout << "Transaction History for " << typeName() << " Account " << username << ":" << endl;
+        transactions.displayTransactions();
+        cout << "Current Balance: $" << getBalance() << endl;
+    }
+
+    void displayTransactionHistoryInRange(time_t startDate, time_t endDate) const final
+    {
+        cout << "Transaction History for " << typeName() << " Account " << username << " within date range:" << endl;
+        cout << "Opening Balance: $" << balanceAsOf(startDate - 1) << endl;
+        transactions.displayTransactionsInRange(startDate, endDate);
+        cout << "Closing Balance: $" << balanceAsOf(endDate) << endl;
+        cout << "Current Balance: $" << getBalance() << endl;
+    }
+
+    void displaySummary() const final
+    {
+        string text;
+        {
+            lock_guard<mutex> held(guard);
+            const TransactionAnalytics &analytics = transactions.analyze();
+            time_t now = LedgerClock::now();
+            for (const TransactionAnalytics::Month &month : analytics.byMonth())
+            {
+                text += TransactionAnalytics::monthName(month.month) + ": ";
+                analytics.describe(text, month, now);
+                text += '\n';
+            }
+            text += "Lifetime: ";
+            analytics.describe(text, analytics.lifetime(), now);
+            text += "\nLargest Transactions:\n";
+            StatementRenderer renderer(text, nullptr);
+            for (size_t i = 0; i < analytics.topSize(); i++)
+            {
+                renderer.row(analytics.topRecords()[i]);
+            }
+        }
+        cout << "Summary for " << typeName() << " Account " << username << ":" << endl
+             << text;
+    }
+
+    bool authenticate(string accUsername, string accPassword) const final
+    {
+        return accUsername == username && PasswordHash::verify(password, accPassword);
+    }
+};
+
+// Checking: may go overdraftLimit_V below zero, earns no interest
+class CheckingAccount final : public PolicyAccount<AccountType::CHECKING, OverdraftUpTo<overdraftLimit_V<Money>.getCents()>, NoInterest>
+{
+public:
+    CheckingAccount(string accUsername, string accPassword, Money overdraftLimit) : PolicyAccount(accUsername, accPassword, {overdraftLimit}, {}) {}
+};
+
+// Savings: never below zero, earns daily compounded interest (5% unless given another rate)
+class SavingsAccount final : public PolicyAccount<AccountType::SAVINGS, NoOverdraft, DailyInterest<500>>
+{
+public:
+    SavingsAccount(string accUsername, string accPassword, double interestRate) : PolicyAccount(accUsername, accPassword, {}, {interestRate}) {}
+};
+
+// Contiguous storage for one account type: slots sit in fixed size blocks that never move,
+// closed slots are reused, and walking the pool visits accounts in memory order with their static type
+template <typename T>
+class AccountPool
+{
+private:
+    static const size_t BLOCK = 1024;
+
+    struct Slot
+    {
+        alignas(T) unsigned char storage[sizeof(T)];
+        uint32_t nextFree;
+        bool live;
+    };
+
+    vector<unique_ptr<Slot[]>> blocks;
+    size_t used;
+    uint32_t freeList;
+    size_t liveCount;
+
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    Slot &slot(size_t index) const { return blocks[index / BLOCK][index % BLOCK]; }
+
+public:
+    AccountPool() : used(0), freeList(NONE), liveCount(0) {}
+    AccountPool(const AccountPool &) = delete;
+    AccountPool &operator=(const AccountPool &) = delete;
+
+    template <typename... Args>
+    T *create(Args &&...args)
+    {
+        size_t index;
+        if (freeList != NONE)
+        {
+            index = freeList;
+            freeList = slot(index).nextFree;
+        }
+        else
+        {
+            if (used == blocks.size() * BLOCK)
+            {
+                blocks.push_back(make_unique<Slot[]>(BLOCK));
+            }
+            index = used++;
+        }
+        Slot &s = slot(index);
+        T *acc = ::new (s.storage) T(forward<Args>(args)...);
+        s.live = true;
+        s.nextFree = uint32_t(index);
+        liveCount++;
+        return acc;
+    }
+
+    void destroy(T *acc)
+    {
+        // storage is the first member, so the account's address is its slot's
+        Slot *s = reinterpret_cast<Slot *>(acc);
+        uint32_t index = s->nextFree;
+        acc->~T();
+        s->live = false;
+        s->nextFree = freeList;
+        freeList = index;
+        liveCount--;
+    }
+
+    // Slots handed out so far, some may be closed, for splitting a walk across threads
+    size_t slots() const { return used; }
+    size_t size() const { return liveCount; }
+
+    // The account in a slot, or nullptr if the slot is closed
+    T *at(size_t index) const
+    {
+        Slot &s = slot(index);
+        return s.live ? reinterpret_cast<T *>(s.storage) : nullptr;
+    }
+
+    template <typename Func>
+    void forEach(Func func) const
+    {
+        for (size_t index = 0; index < used; index++)
+        {
+            Slot &s = slot(index);
+            if (s.live)
+                func(*reinterpret_cast<T *>(s.storage));
+        }
+    }
+
+    ~AccountPool()
+    {
+        forEach([](T &acc)
+                { acc.~T(); });
+    }
+};
+
+// Open addressing hash table (linear probing) from username to every account that username owns
+class UsernameIndex
+{
+private:
+    enum class SlotState : unsigned char
+    {
+        EMPTY,
+        USED,
+        DELETED
+    };
+
+    struct Slot
+    {
+        size_t hash = 0;
+        SlotState state = SlotState::EMPTY;
+        string username;
+        vector<Account *> accounts;
+    };
+
+    vector<Slot> slots;
+    size_t used;
+    size_t tombstones;
+
+    // Index of the slot holding username, or of the slot it should be inserted into
+    size_t probe(const string &username, size_t hash) const
+    {
+        size_t mask = slots.size() - 1;
+        size_t firstFree = slots.size();
+        for (size_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            const Slot &slot = slots[i];
+            if (slot.state == SlotState::EMPTY)
+            {
+                return firstFree != slots.size() ? firstFree : i;
+            }
+            if (slot.state == SlotState::DELETED)
+            {
+                if (firstFree == slots.size())
+                    firstFree = i;
+            }
+            else if (slot.hash == hash && slot.username == username)
+            {
+                return i;
+            }
+        }
+    }
+
+    void rehash(size_t capacity)
+    {
+        vector<Slot> old(capacity);
+        old.swap(slots);
+        tombstones = 0;
+        size_t mask = slots.size() - 1;
+        for (Slot &slot : old)
+        {
+            if (slot.state != SlotState::USED)
+                continue;
+            size_t i = slot.hash & mask;
+            while (slots[i].state != SlotState::EMPTY)
+            {
+                i = (i + 1) & mask;
+            }
+            slots[i] = move(slot);
+        }
+    }
+
+public:
+    UsernameIndex() : slots(16), used(0), tombstones(0) {}
+
+    void add(Account *acc)
+    {
+        // keep the load factor (tombstones included) under 3/4
+        if ((used + tombstones + 1) * 4 > slots.size() * 3)
+        {
+            rehash(used * 2 + 2 > slots.size() / 2 ? slots.size() * 2 : slots.size());
+        }
+        size_t hash = std::hash<string>{}(acc->username);
+        Slot &slot = slots[probe(acc->username, hash)];
+        if (slot.state != SlotState::USED)
+        {
+            if (slot.state == SlotState::DELETED)
+                tombstones--;
+            slot.state = SlotState::USED;
+            slot.hash = hash;
+            slot.username = acc->username;
+            used++;
+        }
+        slot.accounts.push_back(acc);
+    }
+
+    void remove(Account *acc)
+    {
+        size_t hash = std::hash<string>{}(acc->username);
+        Slot &slot = slots[probe(acc->username, hash)];
+        if (slot.state != SlotState::USED)
+            return;
+        slot.accounts.erase(std::remove(slot.accounts.begin(), slot.accounts.end(), acc), slot.accounts.end());
+        if (slot.accounts.empty())
+        {
+            slot.state = SlotState::DELETED;
+            slot.username.clear();
+            slot.accounts.shrink_to_fit();
+            used--;
+            tombstones++;
+        }
+    }
+
+    // Accounts owned by username, or nullptr if there are none
+    const vector<Account *> *find(const string &username) const
+    {
+        const Slot &slot = slots[probe(username, std::hash<string>{}(username))];
+        return slot.state == SlotState::USED ? &slot.accounts : nullptr;
+    }
+
+    size_t size() const { return used; }
+};
+
+// Generational slot map: O(1) insert, lookup and erase, with freed slots reused
+// A Ref is a slot plus the generation the slot had when the value went in, erasing bumps the generation,
+// so a Ref kept after its value is gone can never reach whatever reuses the slot
+// Live values sit packed in one array (erase moves the last one into the hole), which is what iteration walks
+template <typename T>
+class SlotMap
+{
+public:
+    struct Ref
+    {
+        uint32_t slot = 0;
+        uint32_t generation = 0; // slots start at generation 1, so a default Ref is never valid
+
+        bool operator==(const Ref &other) const { return slot == other.slot && generation == other.generation; }
+        bool operator!=(const Ref &other) const { return !(*this == other); }
+    };
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Slot
+    {
+        uint32_t generation;
+        uint32_t index; // into values while live, next free slot while free
+    };
+
+    vector<Slot> slots;
+    vector<T> values;
+    vector<uint32_t> owners; // slot of every value
+    uint32_t freeSlots;
+
+    const Slot *live(Ref ref) const
+    {
+        if (ref.slot >= slots.size() || slots[ref.slot].generation != ref.generation)
+            return nullptr;
+        return &slots[ref.slot];
+    }
+
+public:
+    SlotMap() : freeSlots(NONE) {}
+
+    Ref insert(T value)
+    {
+        uint32_t slot = freeSlots;
+        if (slot == NONE)
+        {
+            slot = uint32_t(slots.size());
+            slots.push_back({1, 0});
+        }
+        else
+        {
+            freeSlots = slots[slot].index;
+        }
+        slots[slot].index = uint32_t(values.size());
+        values.push_back(move(value));
+        owners.push_back(slot);
+        return {slot, slots[slot].generation};
+    }
+
+    // Returns false if ref is stale
+    bool erase(Ref ref)
+    {
+        if (!live(ref))
+            return false;
+        Slot &slot = slots[ref.slot];
+        uint32_t hole = slot.index;
+        values[hole] = move(values.back());
+        owners[hole] = owners.back();
+        slots[owners[hole]].index = hole;
+        values.pop_back();
+        owners.pop_back();
+        slot.generation++;
+        slot.index = freeSlots;
+        freeSlots = ref.slot;
+        return true;
+    }
+
+    // The value ref points at, or nullptr if it is stale
+    T *get(Ref ref)
+    {
+        const Slot *slot = live(ref);
+        return slot ? &values[slot->index] : nullptr;
+    }
+    const T *get(Ref ref) const
+    {
+        const Slot *slot = live(ref);
+        return slot ? &values[slot->index] : nullptr;
+    }
+
+    size_t size() const { return values.size(); }
+    const vector<T> &dense() const { return values; }
+};
+
+// Hierarchical timer wheel over day numbers: three levels of 64 slots, every slot of a level spanning a whole turn of
+// the level below, so anything due in the next 64^3 days (700 years) goes in with one list insert and comes out
+// with one unlink. Entries live in a slab and are referred to by index. Whenever a level comes round to the start
+// of a turn, the matching slot of the level above is spread over the levels below
+template <typename T>
+class TimerWheel
+{
+public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+private:
+    static const int BITS = 6, LEVELS = 3;
+    static const int64_t SLOTS = 1 << BITS;
+    // entries due by now, handed out first by the next advance
+    static const uint32_t LATE = LEVELS * SLOTS;
+
+    struct Node
+    {
+        T value;
+        uint32_t due;
+        uint32_t list; // NONE while handed out or free
+        uint32_t prev, next;
+    };
+
+    vector<Node> nodes;
+    uint32_t heads[LATE + 1];
+    uint32_t freeNodes;
+    int64_t now;
+    size_t count;
+
+    uint32_t listFor(uint32_t due) const
+    {
+        if (int64_t(due) <= now)
+        {
+            return LATE;
+        }
+        // further out than the top level reaches: park it in the top slot visited last, it moves on from there
+        int64_t reach = min<int64_t>(due, now + SLOTS * SLOTS * SLOTS - 1);
+        int64_t ahead = reach - now;
+        int level = ahead < SLOTS ? 0 : ahead < SLOTS * SLOTS ? 1 : 2;
+        return uint32_t(level * SLOTS + ((reach >> (level * BITS)) & (SLOTS - 1)));
+    }
+
+    void link(uint32_t index, uint32_t list)
+    {
+        Node &node = nodes[index];
+        node.list = list;
+        node.prev = NONE;
+        node.next = heads[list];
+        if (node.next != NONE)
+        {
+            nodes[node.next].prev = index;
+        }
+        heads[list] = index;
+    }
+
+    void unlink(uint32_t index)
+    {
+        Node &node = nodes[index];
+        if (node.prev != NONE)
+            nodes[node.prev].next = node.next;
+        else
+            heads[node.list] = node.next;
+        if (node.next != NONE)
+        {
+            nodes[node.next].prev = node.prev;
+        }
+        node.list = NONE;
+    }
+
+    // Empties a list, into out when given, or back into the wheel where each entry now belongs
+    void detach(uint32_t list, vector<uint32_t> *out)
+    {
+        uint32_t index = heads[list];
+        heads[list] = NONE;
+        while (index != NONE)
+        {
+            uint32_t next = nodes[index].next;
+            nodes[index].list = NONE;
+            if (out)
+                out->push_back(index);
+            else
+                link(index, listFor(nodes[index].due));
+            index = next;
+        }
+    }
+
+public:
+    explicit TimerWheel(int64_t start = 0) : freeNodes(NONE), now(start), count(0)
+    {
+        fill(begin(heads), end(heads), NONE);
+    }
+
+    // Adds value due on day due and returns its index
+    uint32_t insert(uint32_t due, const T &value)
+    {
+        if (count == 0)
+        {
+            // nothing to keep in step with: an entry already due moves the wheel back to the day before it, so the
+            // next advance hands it out on its own day. The wheel never moves forward here, or entries due between
+            // now and due would land in LATE and be handed out early
+            now = min<int64_t>(now, int64_t(due) - 1);
+        }
+        uint32_t index;
+        if (freeNodes != NONE)
+        {
+            index = freeNodes;
+            freeNodes = nodes[index].next;
+            nodes[index].value = value;
+        }
+        else
+        {
+            index = uint32_t(nodes.size());
+            nodes.push_back({value, 0, NONE, NONE, NONE});
+        }
+        count++;
+        schedule(index, due);
+        return index;
+    }
+
+    // Puts an entry that was handed out back in, or moves one that is still waiting to a new day
+    void schedule(uint32_t index, uint32_t due)
+    {
+        if (nodes[index].list != NONE)
+        {
+            unlink(index);
+        }
+        nodes[index].due = due;
+        link(index, listFor(due));
+    }
+
+    // Takes an entry out for good, whether it is waiting or has been handed out
+    void remove(uint32_t index)
+    {
+        if (nodes[index].list != NONE)
+        {
+            unlink(index);
+        }
+        nodes[index].next = freeNodes;
+        nodes[index].due = NONE;
+        freeNodes = index;
+        count--;
+    }
+
+    T &at(uint32_t index) { return nodes[index].value; }
+    uint32_t dueOf(uint32_t index) const { return nodes[index].due; }
+    size_t size() const { return count; }
+    size_t bytes() const { return nodes.capacity() * sizeof(Node); }
+
+    template <typename Func>
+    void forEach(Func func) const
+    {
+        for (const Node &node : nodes)
+        {
+            if (node.due != NONE)
+                func(node.value);
+        }
+    }
+
+    // Moves the wheel on to day, handing fire(indices, day) the entries due each day as it goes
+    // Entries are out of the wheel while fire has them, it has to schedule or remove every one
+    // Anything scheduled for a day already passed comes round again before advance returns
+    template <typename Func>
+    void advance(int64_t day, Func fire)
+    {
+        vector<uint32_t> due;
+        while (true)
+        {
+            if (count == 0)
+            {
+                now = max(now, day);
+                return;
+            }
+            if (now < day)
+            {
+                now++;
+                for (int level = LEVELS - 1; level > 0; level--)
+                {
+                    if ((now & ((int64_t(1) << (level * BITS)) - 1)) == 0)
+                    {
+                        detach(uint32_t(level * SLOTS + ((now >> (level * BITS)) & (SLOTS - 1))), nullptr);
+                    }
+                }
+                detach(uint32_t(now & (SLOTS - 1)), &due);
+            }
+            detach(LATE, &due);
+            if (!due.empty())
+            {
+                fire(due, now);
+                due.clear();
+            }
+            else if (now >= day)
+            {
+                return;
+            }
+        }
+    }
+};
+
+// Every standing order, on a timer wheel by due day, with an index from order ID to wheel entry
+// Placing and cancelling are O(1). The lock is for callers, pay runs hold it throughout
+class StandingOrders
+{
+private:
+    TimerWheel<StandingOrder> wheel;
+    unordered_map<uint64_t, uint32_t> byID;
+    uint64_t lastID;
+
+public:
+    mutex lock;
+
+    // The wheel starts at today, the first pay run would otherwise walk every day since 1970
+    StandingOrders() : wheel(int64_t(LedgerClock::now()) / 86400), lastID(0) {}
+    StandingOrders(const StandingOrders &) = delete;
+    StandingOrders &operator=(const StandingOrders &) = delete;
+
+    // An order paying every so many days, or monthly on dayOfMonth when every is 0. Without a first day
+    // (first < 0) the first payment is the next one after today
+    static StandingOrder make(StandingOrder::Kind kind, int32_t account, int32_t target, Money amount, long every, long dayOfMonth, int64_t first = -1)
+    {
+        if (amount <= Money())
+            throw runtime_error("A standing order has to pay a positive amount.");
+        if (every < 0 || every > 65535 || (every == 0 && (dayOfMonth < 1 || dayOfMonth > 31)))
+            throw runtime_error("Pay monthly on a day from 1 to 31, or every 1 to 65535 days.");
+        if (kind == StandingOrder::TRANSFER && target == account)
+            throw runtime_error("A standing order cannot transfer to the account it pays from.");
+        StandingOrder order = {};
+        order.account = account;
+        order.target = kind == StandingOrder::TRANSFER ? target : 0;
+        order.amount = amount.getCents();
+        order.every = uint16_t(every);
+        order.kind = kind;
+        order.dayOfMonth = uint8_t(every ? 0 : dayOfMonth);
+        order.nextDue = uint32_t(first >= 0 ? first : order.after(uint32_t(LedgerClock::now() / 86400)));
+        return order;
+    }
+
+    // Adds an order, orders coming in without an ID (anything not being restored) get the next one
+    uint64_t place(StandingOrder order)
+    {
+        if (order.id == 0)
+        {
+            order.id = ++lastID;
+        }
+        lastID = max(lastID, order.id);
+        byID[order.id] = wheel.insert(order.nextDue, order);
+        for (LedgerObserver *observer : Account::observers)
+        {
+            observer->orderPlaced(order);
+        }
+        return order.id;
+    }
+
+    // False if there is no such order
+    bool cancel(uint64_t id)
+    {
+        auto found = byID.find(id);
+        if (found == byID.end())
+        {
+            return false;
+        }
+        wheel.remove(found->second);
+        byID.erase(found);
+        for (LedgerObserver *observer : Account::observers)
+        {
+            observer->orderCancelled(id);
+        }
+        return true;
+    }
+
+    // Moves an order on to its next payment, false if there is no such order
+    bool reschedule(uint64_t id, uint32_t due)
+    {
+        auto found = byID.find(id);
+        if (found == byID.end())
+        {
+            return false;
+        }
+        wheel.at(found->second).nextDue = due;
+        wheel.schedule(found->second, due);
+        return true;
+    }
+
+    const StandingOrder *find(uint64_t id)
+    {
+        auto found = byID.find(id);
+        return found == byID.end() ? nullptr : &wheel.at(found->second);
+    }
+
+    template <typename Func>
+    void forEach(Func func) const { wheel.forEach(func); }
+
+    // Hands fire the indices of every order due through day, a day at a time. Each one has to go back
+    // to schedule once its nextDue has moved on, or to drop
+    template <typename Func>
+    void advance(int64_t day, Func fire)
+    {
+        wheel.advance(day, [&](vector<uint32_t> &due, int64_t)
+                      { fire(due); });
+    }
+
+    StandingOrder &at(uint32_t index) { return wheel.at(index); }
+    void schedule(uint32_t index) { wheel.schedule(index, wheel.at(index).nextDue); }
+
+    void drop(uint32_t index)
+    {
+        byID.erase(wheel.at(index).id);
+        wheel.remove(index);
+    }
+
+    size_t size() const { return wheel.size(); }
+    size_t bytes() const { return wheel.bytes() + byID.size() * (sizeof(pair<uint64_t, uint32_t>) + 2 * sizeof(void *)); }
+    uint64_t getLastID() const { return lastID; }
+    void reserveIDs(uint64_t id) { lastID = max(lastID, id); }
+};
+
+using AccountRef = SlotMap<Account *>::Ref;
+
+// Customer List
+// Every account lives in a slot map, account IDs map to their slot through a table indexed by ID,
+// so looking an account up, adding it and closing it are all O(1)
+// IDs are never handed out twice (the journal and snapshots refer to accounts by ID), slots are
+class CustomerList
+{
+private:
+    UsernameIndex byUsername;
+    SlotMap<Account *> registry;
+    vector<AccountRef> byID;
+    int lastID;
+    AccountPool<CheckingAccount> checking;
+    AccountPool<SavingsAccount> savings;
+
+    // Hands an account back to the pool it came from
+    void destroy(Account *acc)
+    {
+        if (acc->getType() == AccountType::CHECKING)
+            checking.destroy(static_cast<CheckingAccount *>(acc));
+        else
+            savings.destroy(static_cast<SavingsAccount *>(acc));
+    }
+
+public:
+    // Only needed when several threads share the list: held shared for lookups and account commands,
+    // exclusively to add or remove accounts
+    mutable shared_mutex guard;
+
+    // Standing orders of every account, orders of a closed account are dropped when they next come due
+    StandingOrders orders;
+
+    CustomerList() : lastID(0) {}
+    CustomerList(const CustomerList &) = delete;
+    CustomerList &operator=(const CustomerList &) = delete;
+
+    // Makes an account in this list's pool for its type, it still has to be added with addCustomer
+    template <typename T, typename... Args>
+    T *create(Args &&...args)
+    {
+        return pool<T>().create(forward<Args>(args)...);
+    }
+
+    // Every account of one type, in storage order
+    template <typename T>
+    AccountPool<T> &pool()
+    {
+        if constexpr (is_same_v<T, CheckingAccount>)
+            return checking;
+        else
+            return savings;
+    }
+
+    template <typename T, typename Func>
+    void forEachOfType(Func func) const
+    {
+        const_cast<CustomerList *>(this)->pool<T>().forEach(func);
+    }
+
+    // Accounts that come in without an ID (anything not being restored) get the next free one
+    // The account has to come from create
+    void addCustomer(Account *acc)
+    {
+        if (acc->ID == 0)
+        {
+            acc->ID = ++lastID;
+        }
+        lastID = max(lastID, acc->ID);
+        if (size_t(acc->ID) >= byID.size())
+        {
+            byID.resize(size_t(acc->ID) + 1);
+        }
+        byID[size_t(acc->ID)] = registry.insert(acc);
+        byUsername.add(acc);
+        for (LedgerObserver *observer : Account::observers)
+        {
+            observer->accountOpened(*acc);
+        }
+    }
+
+    // Removes and deletes an account
+    void removeCustomer(Account *acc)
+    {
+        if (!registry.erase(refOf(acc->ID)))
+        {
+            return;
+        }
+        byID[size_t(acc->ID)] = AccountRef();
+        byUsername.remove(acc);
+        for (LedgerObserver *observer : Account::observers)
+        {
+            observer->accountClosed(*acc);
+        }
+        destroy(acc);
+    }
+
+    int getLastID() const { return lastID; }
+    // Makes sure IDs up to id are never handed out again, e.g. ones that belonged to closed accounts
+    void reserveIDs(int id) { lastID = max(lastID, id); }
+
+    // Compact reference to the account with the given ID, a default (never valid) one if there is none
+    // Unlike an Account pointer it can be kept around safely, resolve tells when the account has been closed since
+    AccountRef refOf(int id) const
+    {
+        return id > 0 && size_t(id) < byID.size() ? byID[size_t(id)] : AccountRef();
+    }
+
+    // The account ref points at, or nullptr if it has been closed
+    Account *resolve(AccountRef ref) const
+    {
+        Account *const *acc = registry.get(ref);
+        return acc ? *acc : nullptr;
+    }
+
+    // Account with the given ID, or nullptr if there is none
+    Account *findAccount(int id) const { return resolve(refOf(id)); }
+
+    // Every open account, packed together but in no particular order
+    const vector<Account *> &accounts() const { return registry.dense(); }
+    size_t size() const { return registry.size(); }
+
+    // Every account owned by username, in the order they were added
+    vector<Account *> findAccounts(const string &username) const
+    {
+        const vector<Account *> *accounts = byUsername.find(username);
+        return accounts ? *accounts : vector<Account *>();
+    }
+
+    void displayCustomers() const
+    {
+        for (Account *acc : accounts())
+        {
+            cout << "Username: " << acc->username << endl;
+        }
+    }
+
+    ~CustomerList()
+    {
+        for (Account *acc : accounts())
+        {
+            destroy(acc);
+        }
+    }
+};
+
+// End-of-day interest: posts what every savings account made since its last accrual
+// The savings pool is handed out to the threads in chunks of slots off a shared counter, so a slow chunk doesn't
+// hold up the rest, and every account is reached with its static type rather than through the customer list
+class InterestAccrual
+{
+private:
+    static const size_t CHUNK = 1024;
+
+public:
+    struct Result
+    {
+        size_t accounts = 0;
+        Money total;
+    };
+
+    static int64_t today() { return int64_t(LedgerClock::now()) / 86400; }
+
+    // Accrues one account through day and returns what was posted
+    // A missed day is caught up from the current balance instead of going back over the history,
+    // an account that has never accrued only starts counting from day, money it just got has earned nothing yet
+    template <typename T>
+    static Money accrue(T &acc, int64_t day)
+    {
+        double rate = acc.getInterestRate();
+        if (rate <= 0 || day <= acc.accruedThrough)
+        {
+            return Money();
+        }
+        int64_t days = day - acc.accruedThrough;
+        bool first = acc.accruedThrough == 0;
+        acc.accruedThrough = day;
+        if (first)
+        {
+            return Money();
+        }
+        Money balance = acc.getBalance();
+        if (balance <= Money())
+        {
+            acc.interestCarry = 0;
+            return Money();
+        }
+        double exact = InterestCalculator::dailyInterest(balance, rate, days) + acc.interestCarry;
+        int64_t cents = int64_t(floor(exact));
+        acc.interestCarry = exact - double(cents);
+        if (cents == 0)
+        {
+            return Money();
+        }
+        // dated at the end of the day, or now when accruing through today
+        time_t date = min<time_t>(LedgerClock::now(), time_t(day * 86400 + 86399));
+        Money interest = Money::fromCents(cents);
+        acc.post(Transaction("Interest", interest, TransactionType::INTEREST, date));
+        return interest;
+    }
+
+    // Accrues every account through day on threadCount threads
+    static Result run(CustomerList &customers, int64_t day, size_t threadCount)
+    {
+        const AccountPool<SavingsAccount> &accounts = customers.pool<SavingsAccount>();
+        const size_t slots = accounts.slots();
+        threadCount = max<size_t>(1, min(threadCount, (slots + CHUNK - 1) / CHUNK));
+
+        atomic<size_t> next(0);
+        vector<Result> partial(threadCount);
+        auto work = [&](size_t t)
+        {
+            size_t begin;
+            while ((begin = next.fetch_add(CHUNK)) < slots)
+            {
+                size_t end = min(slots, begin + CHUNK);
+                for (size_t i = begin; i < end; i++)
+                {
+                    if (SavingsAccount *acc = accounts.at(i))
+                    {
+                        partial[t].total += accrue(*acc, day);
+                        partial[t].accounts++;
+                    }
+                }
+            }
+        };
+        vector<thread> threads;
+        for (size_t t = 1; t < threadCount; t++)
+        {
+            threads.emplace_back(work, t);
+        }
+        work(0);
+        for (thread &worker : threads)
+        {
+            worker.join();
+        }
+
+        Result result;
+        for (const Result &part : partial)
+        {
+            result.accounts += part.accounts;
+            result.total += part.total;
+        }
+        return result;
+    }
+};
+
+// Bounded lock-free queue for many producers and one consumer (Vyukov's ring): a producer claims a cell with one
+// compare-and-swap on the tail, every cell carries a sequence number saying whose turn it is, so nobody ever waits on a lock
+template <typename T>
+class MpscRing
+{
+private:
+    struct Cell
+    {
+        atomic<size_t> sequence;
+        T value;
+    };
+
+    unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) atomic<size_t> tail;
+    alignas(64) size_t head; // only the consumer touches it
+
+public:
+    // capacity is rounded up to a power of two
+    explicit MpscRing(size_t capacity) : tail(0), head(0)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++)
+        {
+            cells[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+    MpscRing(const MpscRing &) = delete;
+    MpscRing &operator=(const MpscRing &) = delete;
+
+    // false when the ring is full
+    bool tryPush(const T &value)
+    {
+        size_t pos = tail.load(memory_order_relaxed);
+        while (true)
+        {
+            Cell &cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(memory_order_acquire);
+            intptr_t lag = intptr_t(sequence) - intptr_t(pos);
+            if (lag == 0)
+            {
+                if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            }
+            else if (lag < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = tail.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer only, false when there is nothing (finished) to take
+    bool tryPop(T &value)
+    {
+        Cell &cell = cells[head & mask];
+        if (cell.sequence.load(memory_order_acquire) != head + 1)
+        {
+            return false;
+        }
+        value = cell.value;
+        cell.sequence.store(head + mask + 1, memory_order_release);
+        head++;
+        return true;
+    }
+
+    size_t capacity() const { return mask + 1; }
+};
+
+// One audit record, the same 32 bytes in the ring and in the audit files
+struct AuditEvent
+{
+    int64_t at;      // nanoseconds since 1970-01-01 UTC
+    int64_t amount;  // cents, the total for an import
+    int32_t account;
+    int32_t related; // the other account of a transfer, the row count of an import
+    uint8_t kind;
+    uint8_t reserved[7];
+};
+static_assert(sizeof(AuditEvent) == 32, "audit files depend on the event layout");
+
+// Audit trail of every change to the ledger, written off the hot path
+// Mutations push fixed size events into a lock-free ring and return; a writer thread drains the ring in batches
+// into the audit file. Once that reaches its size limit it is renamed to <path>.1, <path>.2, ... and a new one is started,
+// old files are never deleted. What happens when the ring is full is up to the policy: wait for room,
+// drop the event and count it, or spill it into an unbounded side queue (spilled events can be written out of order)
+//
+// File layout: AuditHeader, then AuditEvent records, the first one numbered header.firstSequence
+class AuditLog : public LedgerObserver
+{
+public:
+    enum class Policy
+    {
+        BLOCK,
+        DROP,
+        SPILL
+    };
+
+    enum Kind : uint8_t
+    {
+        OPEN = 1,
+        DEPOSIT = 2,
+        WITHDRAW = 3,
+        INTEREST = 4,
+        TRANSFER = 5,
+        CLOSE = 6,
+        IMPORT = 7
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t firstSequence;
+    };
+
+    struct Counters
+    {
+        uint64_t published, written, dropped, spilled, files;
+    };
+
+    // The log the stats report shows, if any
+    inline static atomic<AuditLog *> running{nullptr};
+
+    static bool parsePolicy(string_view name, Policy &policy)
+    {
+        if (name == "block")
+            policy = Policy::BLOCK;
+        else if (name == "drop")
+            policy = Policy::DROP;
+        else if (name == "spill")
+            policy = Policy::SPILL;
+        else
+            return false;
+        return true;
+    }
+
+private:
+    static constexpr uint32_t VERSION = 1;
+    static const size_t BATCH = 4096;
+
+    string path;
+    Policy policy;
+    uint64_t rotateBytes;
+    MpscRing<AuditEvent> ring;
+
+    mutex spillLock;
+    vector<AuditEvent> spill;
+    atomic<bool> spilling;
+
+    atomic<uint64_t> published, dropped, spilled;
+    // the writer's own, read by counters() while it runs
+    atomic<uint64_t> written, files;
+
+    FILE *file;
+    uint64_t fileBytes;
+    uint64_t segment;
+    thread writer;
+    atomic<bool> stopping;
+
+    static int64_t now()
+    {
+        return int64_t(chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count());
+    }
+
+    void publish(uint8_t kind, int32_t account, int32_t related, int64_t amount)
+    {
+        ZBANK_PROBE(Metrics::PUBLISH);
+        AuditEvent event = {};
+        event.at = now();
+        event.amount = amount;
+        event.account = account;
+        event.related = related;
+        event.kind = kind;
+        published.fetch_add(1, memory_order_relaxed);
+        if (ring.tryPush(event))
+        {
+            return;
+        }
+        if (policy == Policy::DROP)
+        {
+            dropped.fetch_add(1, memory_order_relaxed);
+        }
+        else if (policy == Policy::SPILL)
+        {
+            lock_guard<mutex> held(spillLock);
+            spill.push_back(event);
+            spilling.store(true, memory_order_release);
+            spilled.fetch_add(1, memory_order_relaxed);
+        }
+        else
+        {
+            while (!ring.tryPush(event))
+            {
+                this_thread::yield();
+            }
+        }
+    }
+
+    string segmentPath(uint64_t number) const { return path + "." + to_string(number); }
+
+    void openFile()
+    {
+        file = fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            throw runtime_error("Could not create audit file '" + path + "'.");
+        }
+        Header header = {};
+        memcpy(header.magic, "ZBAUDIT", 8);
+        header.version = VERSION;
+        header.firstSequence = written.load(memory_order_relaxed);
+        if (fwrite(&header, 1, sizeof(header), file) != sizeof(header))
+        {
+            throw runtime_error("Could not write audit file '" + path + "'.");
+        }
+        fileBytes = sizeof(header);
+        files.fetch_add(1, memory_order_relaxed);
+    }
+
+    // Closes the current file for good and starts the next one
+    void rotate()
+    {
+        bool ok = fflush(file) == 0;
+#ifndef _WIN32
+        ok = fsync(fileno(file)) == 0 && ok;
+#endif
+        fclose(file);
+        file = nullptr;
+        error_code failed;
+        filesystem::rename(path, segmentPath(segment++), failed);
+        if (!ok || failed)
+        {
+            throw runtime_error("Could not rotate audit file '" + path + "'.");
+        }
+        openFile();
+    }
+
+    void write(const AuditEvent *events, size_t count)
+    {
+        while (count)
+        {
+            if (fileBytes + sizeof(AuditEvent) > rotateBytes && fileBytes > sizeof(Header))
+            {
+                rotate();
+            }
+            size_t room = size_t(max<uint64_t>(1, (rotateBytes - min(rotateBytes, fileBytes)) / sizeof(AuditEvent)));
+            size_t n = min(count, room);
+            if (fwrite(events, sizeof(AuditEvent), n, file) != n)
+            {
+                throw runtime_error("Could not write audit file '" + path + "'.");
+            }
+            fileBytes += n * sizeof(AuditEvent);
+            written.fetch_add(n, memory_order_relaxed);
+            events += n;
+            count -= n;
+        }
+    }
+
+    // The writer thread: takes whatever is there in batches, naps a little longer every time it finds nothing
+    void drain()
+    {
+        vector<AuditEvent> batch;
+        batch.reserve(BATCH);
+        unsigned idle = 0;
+        bool failed = false;
+        while (true)
+        {
+            bool last = stopping.load(memory_order_acquire);
+            AuditEvent event;
+            while (batch.size() < BATCH && ring.tryPop(event))
+            {
+                batch.push_back(event);
+            }
+            if (batch.size() < BATCH && spilling.load(memory_order_acquire))
+            {
+                lock_guard<mutex> held(spillLock);
+                batch.insert(batch.end(), spill.begin(), spill.end());
+                spill.clear();
+                spilling.store(false, memory_order_relaxed);
+            }
+            if (!batch.empty())
+            {
+                try
+                {
+                    if (!failed)
+                    {
+                        write(batch.data(), batch.size());
+                        fflush(file);
+                    }
+                }
+                catch (const exception &ex)
+                {
+                    cerr << "Error: " << ex.what() << " Audit events are being dropped." << endl;
+                    failed = true;
+                }
+                if (failed)
+                {
+                    dropped.fetch_add(batch.size(), memory_order_relaxed);
+                }
+                batch.clear();
+                idle = 0;
+                continue;
+            }
+            if (last)
+            {
+                break;
+            }
+            this_thread::sleep_for(chrono::microseconds(min(1000u, 20u << min(idle++, 6u))));
+        }
+        if (file)
+        {
+            fflush(file);
+#ifndef _WIN32
+            fsync(fileno(file));
+#endif
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+public:
+    // rotateBytes is the size an audit file may grow to, capacity the number of events the ring holds
+    AuditLog(string auditPath, Policy backpressure = Policy::BLOCK, uint64_t rotateAt = uint64_t(64) << 20, size_t capacity = size_t(1) << 16)
+        : path(auditPath), policy(backpressure), rotateBytes(max<uint64_t>(rotateAt, sizeof(Header) + sizeof(AuditEvent))), ring(capacity),
+          spilling(false), published(0), dropped(0), spilled(0), written(0), files(0), file(nullptr), fileBytes(0), segment(1), stopping(false) {}
+    AuditLog(const AuditLog &) = delete;
+    AuditLog &operator=(const AuditLog &) = delete;
+
+    // Opens the audit file and starts the writer
+    // A file left by an earlier run is rotated out first, numbering carries on from where it stopped
+    void start()
+    {
+        while (filesystem::exists(segmentPath(segment)))
+        {
+            segment++;
+        }
+        error_code ignored;
+        if (filesystem::exists(path) && filesystem::file_size(path, ignored) > 0)
+        {
+            Header header = {};
+            uint64_t size = filesystem::file_size(path);
+            FILE *old = fopen(path.c_str(), "rb");
+            bool valid = old && fread(&header, 1, sizeof(header), old) == sizeof(header) && memcmp(header.magic, "ZBAUDIT", 8) == 0;
+            if (old)
+            {
+                fclose(old);
+            }
+            if (valid)
+            {
+                written = header.firstSequence + (size - sizeof(header)) / sizeof(AuditEvent);
+            }
+            filesystem::rename(path, segmentPath(segment++));
+        }
+        openFile();
+        writer = thread(&AuditLog::drain, this);
+        running = this;
+    }
+
+    // Writes out everything published so far and stops the writer, take the log off the observers first
+    void stop()
+    {
+        if (writer.joinable())
+        {
+            stopping.store(true, memory_order_release);
+            writer.join();
+        }
+    }
+
+    Counters counters() const
+    {
+        return {published.load(memory_order_relaxed), written.load(memory_order_relaxed), dropped.load(memory_order_relaxed),
+                spilled.load(memory_order_relaxed), files.load(memory_order_relaxed)};
+    }
+
+    void accountOpened(const Account &acc) override { publish(OPEN, acc.ID, 0, 0); }
+
+    void transactionPosted(const Account &acc, const Transaction &trans) override
+    {
+        uint8_t kind = trans.getType() == TransactionType::DEPOSIT ? DEPOSIT : trans.getType() == TransactionType::INTEREST ? INTEREST : WITHDRAW;
+        publish(kind, acc.ID, 0, trans.getAmount().getCents());
+    }
+
+    void transferPosted(const Account &from, const Account &to, const Transaction &, const Transaction &in) override
+    {
+        publish(TRANSFER, from.ID, to.ID, in.getAmount().getCents());
+    }
+
+    void historyImported(const Account &acc, const TransactionRecord *records, size_t count) override
+    {
+        int64_t sum = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            sum += records[i].amount;
+        }
+        publish(IMPORT, acc.ID, int32_t(min<size_t>(count, INT32_MAX)), sum);
+    }
+
+    void accountClosed(const Account &acc) override { publish(CLOSE, acc.ID, 0, 0); }
+
+    ~AuditLog()
+    {
+        stop();
+        AuditLog *self = this;
+        running.compare_exchange_strong(self, nullptr);
+    }
+};
+
+namespace Metrics
+{
+    // Counters and latencies of every probe plus the size of the ledger, as text or as JSON
+    // Callers sharing the customer list with other threads hold its lock shared
+    void report(ostream &out, const CustomerList &customers, bool json)
+    {
+        struct Totals
+        {
+            uint64_t counts[BUCKETS] = {};
+            uint64_t count = 0, errors = 0, nanos = 0;
+        };
+        vector<Totals> totals(PROBE_COUNT);
+        registry().forEach([&](Shard &shard)
+                           {
+            for (int probe = 0; probe < PROBE_COUNT; probe++)
+            {
+                Totals &total = totals[probe];
+                for (int bucket = 0; bucket < BUCKETS; bucket++)
+                {
+                    uint64_t count = shard.counts[probe][bucket].load(memory_order_relaxed);
+                    total.counts[bucket] += count;
+                    total.count += count;
+                }
+                total.errors += shard.errors[probe].load(memory_order_relaxed);
+                total.nanos += shard.nanos[probe].load(memory_order_relaxed);
+            } });
+        // microseconds at quantile q
+        auto quantile = [](const Totals &total, double q)
+        {
+            uint64_t rank = uint64_t(ceil(q * double(total.count))), seen = 0;
+            for (int bucket = 0; bucket < BUCKETS; bucket++)
+            {
+                seen += total.counts[bucket];
+                if (seen >= max<uint64_t>(rank, 1))
+                    return bucketValue(bucket) / 1000;
+            }
+            return 0.0;
+        };
+
+        size_t accounts = 0, transactions = 0, largest = 0, bytes = 0, historyBytes = 0;
+        for (const Account *acc : customers.accounts())
+        {
+            const TransactionList &list = acc->transactions;
+            accounts++;
+            transactions += list.size();
+            largest = max(largest, list.size());
+            bytes += sizeof(Account) + list.capacityBytes() + acc->username.capacity() + acc->password.capacity();
+            historyBytes += list.capacityBytes();
+        }
+        // what the histories take, records plus the descriptions they share, per transaction
+        size_t descriptions = Descriptions::shared().size() - 1;
+        bytes += Descriptions::shared().bytes();
+        historyBytes += Descriptions::shared().bytes();
+        double perTransaction = transactions ? double(historyBytes) / double(transactions) : 0.0;
+        size_t orders = customers.orders.size(), orderBytes = customers.orders.bytes();
+        double uptime = chrono::duration<double>(chrono::steady_clock::now() - registry().started).count();
+        const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+        const char *const quantileNames[] = {"p50", "p90", "p99", "p999"};
+        AuditLog *audit = AuditLog::running.load();
+        AuditLog::Counters events = audit ? audit->counters() : AuditLog::Counters{};
+
+        ostringstream text;
+        text << fixed << setprecision(2);
+        if (json)
+        {
+            text << "{\"uptime_seconds\":" << uptime << ",\"probes\":{";
+            bool first = true;
+            for (int probe = 0; probe < PROBE_COUNT; probe++)
+            {
+                const Totals &total = totals[probe];
+                if (total.count == 0)
+                    continue;
+                text << (first ? "" : ",") << "\"" << PROBE_NAMES[probe] << "\":{\"count\":" << total.count << ",\"errors\":" << total.errors
+                     << ",\"mean_us\":" << double(total.nanos) / double(total.count) / 1000;
+                for (int q = 0; q < 4; q++)
+                    text << ",\"" << quantileNames[q] << "_us\":" << quantile(total, quantiles[q]);
+                text << ",\"max_us\":" << quantile(total, 1) << "}";
+                first = false;
+            }
+            text << "},\"gauges\":{\"accounts\":" << accounts << ",\"transactions\":" << transactions
+                 << ",\"transactions_per_account\":" << (accounts ? double(transactions) / double(accounts) : 0.0)
+                 << ",\"largest_history\":" << largest << ",\"ledger_bytes\":" << bytes << ",\"bytes_per_transaction\":" << perTransaction
+                 << ",\"record_bytes\":" << sizeof(TransactionRecord) << ",\"descriptions\":" << descriptions << ",\"standing_orders\":" << orders
+                 << ",\"standing_order_bytes\":" << orderBytes << "}";
+            if (audit)
+                text << ",\"audit\":{\"published\":" << events.published << ",\"written\":" << events.written << ",\"dropped\":" << events.dropped
+                     << ",\"spilled\":" << events.spilled << ",\"files\":" << events.files << "}";
+            text << "}\n";
+        }
+        else
+        {
+            text << "uptime " << uptime << " s" << endl
+                 << left << setw(20) << "probe" << right << setw(10) << "count" << setw(8) << "errors" << setw(10) << "mean us";
+            for (const char *name : quantileNames)
+                text << setw(10) << name;
+            text << setw(10) << "max" << endl;
+            for (int probe = 0; probe < PROBE_COUNT; probe++)
+            {
+                const Totals &total = totals[probe];
+                if (total.count == 0)
+                    continue;
+                text << left << setw(20) << PROBE_NAMES[probe] << right << setw(10) << total.count << setw(8) << total.errors
+                     << setw(10) << double(total.nanos) / double(total.count) / 1000;
+                for (double q : quantiles)
+                    text << setw(10) << quantile(total, q);
+                text << setw(10) << quantile(total, 1) << endl;
+            }
+            text << "accounts " << accounts << ", transactions " << transactions << " (" << (accounts ? double(transactions) / double(accounts) : 0.0)
+                 << " per account, largest " << largest << "), ledger bytes " << bytes << endl
+                 << "history bytes per transaction " << perTransaction << " (" << sizeof(TransactionRecord) << " byte records), " << descriptions << " shared descriptions" << endl;
+            if (orders)
+                text << "standing orders " << orders << ", " << orderBytes << " bytes (" << double(orderBytes) / double(orders) << " per order)" << endl;
+            if (audit)
+                text << "audit events " << events.published << " published, " << events.written << " written, " << events.dropped << " dropped, "
+                     << events.spilled << " spilled, " << events.files << " files" << endl;
+#ifdef ZBANK_NO_METRICS
+            text << "probes are compiled out of this build" << endl;
+#endif
+        }
+        out << text.str();
+    }
+}
+
+// CRC-32 (IEEE), used to spot torn or corrupted journal records
+uint32_t crc32(const char *data, size_t length)
+{
+    // table is built once, on first use
+    static const vector<uint32_t> table = []
+    {
+        vector<uint32_t> table(256);
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+            {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return table;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Helpers for reading and writing fixed size fields in native byte order
+template <typename T>
+void putField(string &out, T value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+bool getField(const char *&pos, const char *end, T &value)
+{
+    if (size_t(end - pos) < sizeof(T))
+        return false;
+    memcpy(&value, pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+void putString(string &out, const string &value)
+{
+    putField<uint16_t>(out, static_cast<uint16_t>(value.size()));
+    out.append(value, 0, uint16_t(value.size()));
+}
+
+bool getString(const char *&pos, const char *end, string &value)
+{
+    uint16_t length;
+    if (!getField(pos, end, length) || size_t(end - pos) < length)
+        return false;
+    value.assign(pos, length);
+    pos += length;
+    return true;
+}
+
+// Append-only binary journal of account openings, transactions and closures
+// Records are buffered and fsynced in groups, so durable throughput isn't one fsync per operation
+//
+// File layout: "ZBJ", a version byte and the uint64 epoch, then records of
+//   uint32 payload length | uint32 CRC-32 of payload | payload
+// Every payload starts with a one byte op code and the int32 account ID
+class Journal : public LedgerObserver
+{
+public:
+    enum Op : uint8_t
+    {
+        OPEN = 1,
+        DEPOSIT = 2,
+        WITHDRAW = 3,
+        CLOSE = 4,
+        TRANSFER = 5,
+        INTEREST = 6,
+        IMPORT = 7,
+        ORDER = 8,
+        CANCEL_ORDER = 9,
+        ORDER_DUE = 10
+    };
+
+private:
+    static constexpr char VERSION = 8;
+    static constexpr size_t HEADER_SIZE = 12;
+    // Most transaction records one IMPORT record carries
+    static constexpr size_t IMPORT_RECORDS = 4096;
+
+    string path;
+    FILE *file;
+    size_t groupSize;
+
+    mutex lock;
+    condition_variable flushed;
+    string pending;
+    size_t pendingCount;
+    bool flushing;
+    uint64_t appended;
+    uint64_t durable;
+    // Bumped every time the journal is truncated, so a snapshot can say which journal it already includes
+    uint64_t epoch;
+
+    void append(const string &payload)
+    {
+        unique_lock<mutex> held(lock);
+        if (!file)
+        {
+            throw runtime_error("Journal is not open.");
+        }
+        putField<uint32_t>(pending, static_cast<uint32_t>(payload.size()));
+        putField<uint32_t>(pending, crc32(payload.data(), payload.size()));
+        pending += payload;
+        pendingCount++;
+        appended++;
+        if (pendingCount >= groupSize)
+        {
+            flushLocked(held);
+        }
+    }
+
+    // Writes out everything buffered so far with a single fsync
+    // Other threads keep appending into a fresh buffer while the fsync is in flight
+    void flushLocked(unique_lock<mutex> &held)
+    {
+        while (flushing)
+        {
+            flushed.wait(held);
+        }
+        if (pending.empty())
+        {
+            return;
+        }
+        string batch;
+        batch.swap(pending);
+        pendingCount = 0;
+        uint64_t upTo = appended;
+        flushing = true;
+        held.unlock();
+
+        bool ok = fwrite(batch.data(), 1, batch.size(), file) == batch.size() && fflush(file) == 0 && syncFile();
+
+        held.lock();
+        flushing = false;
+        if (ok)
+        {
+            durable = upTo;
+        }
+        flushed.notify_all();
+        if (!ok)
+        {
+            throw runtime_error("Could not write to the journal.");
+        }
+    }
+
+    void writeHeader()
+    {
+        string header = "ZBJ";
+        header += VERSION;
+        putField<uint64_t>(header, epoch);
+        if (fwrite(header.data(), 1, header.size(), file) != header.size() || fflush(file) != 0 || !syncFile())
+        {
+            throw runtime_error("Could not write to the journal.");
+        }
+    }
+
+    bool syncFile()
+    {
+#ifdef _WIN32
+        return _commit(_fileno(file)) == 0;
+#else
+        return fsync(fileno(file)) == 0;
+#endif
+    }
+
+    // Re-applies one record, returns false if the record makes no sense
+    bool apply(const string &payload, CustomerList &customers)
+    {
+        const char *pos = payload.data();
+        const char *end = pos + payload.size();
+        uint8_t op;
+        int32_t id;
+        if (!getField(pos, end, op) || !getField(pos, end, id))
+            return false;
+
+        if (op == OPEN)
+        {
+            uint8_t type;
+            int64_t overdraftLimit;
+            double interestRate;
+            string username, password;
+            if (!getField(pos, end, type) || !getField(pos, end, overdraftLimit) || !getField(pos, end, interestRate) ||
+                !getString(pos, end, username) || !getString(pos, end, password))
+                return false;
+            Account *acc;
+            if (type == uint8_t(AccountType::CHECKING))
+                acc = customers.create<CheckingAccount>(username, password, Money::fromCents(overdraftLimit));
+            else
+                acc = customers.create<SavingsAccount>(username, password, interestRate);
+            acc->ID = id;
+            customers.addCustomer(acc);
+            return true;
+        }
+        if (op == ORDER)
+        {
+            StandingOrder order;
+            if (!getField(pos, end, order))
+                return false;
+            customers.orders.place(order);
+            return true;
+        }
+        if (op == CANCEL_ORDER || op == ORDER_DUE)
+        {
+            uint64_t order;
+            uint32_t due = 0;
+            if (!getField(pos, end, order) || (op == ORDER_DUE && !getField(pos, end, due)))
+                return false;
+            // an order that is already gone has nothing left to undo, that is no reason to stop the replay
+            if (op == CANCEL_ORDER)
+                customers.orders.cancel(order);
+            else
+                customers.orders.reschedule(order, due);
+            return true;
+        }
+
+        Account *acc = customers.findAccount(id);
+        if (!acc)
+            return false;
+        if (op == CLOSE)
+        {
+            customers.removeCustomer(acc);
+            return true;
+        }
+        if (op == IMPORT)
+        {
+            uint32_t count;
+            if (!getField(pos, end, count) || size_t(end - pos) != size_t(count) * sizeof(TransactionRecord))
+                return false;
+            vector<TransactionRecord> records(count);
+            memcpy(records.data(), pos, size_t(count) * sizeof(TransactionRecord));
+            acc->import(records.data(), count);
+            return true;
+        }
+        if (op == TRANSFER)
+        {
+            int32_t toID;
+            int64_t amount;
+            int64_t date;
+            if (!getField(pos, end, toID) || !getField(pos, end, amount) || !getField(pos, end, date))
+                return false;
+            Account *to = customers.findAccount(toID);
+            if (!to)
+                return false;
+            acc->post(Transaction("Transfer to account " + to_string(toID), Money::fromCents(-amount), TransactionType::WITHDRAW, time_t(date)));
+            to->post(Transaction("Transfer from account " + to_string(id), Money::fromCents(amount), TransactionType::DEPOSIT, time_t(date)));
+            return true;
+        }
+
+        int64_t amount;
+        int64_t date;
+        if (!getField(pos, end, amount) || !getField(pos, end, date))
+            return false;
+        if (op == DEPOSIT)
+            acc->post(Transaction("Deposit", Money::fromCents(amount), TransactionType::DEPOSIT, time_t(date)));
+        else if (op == INTEREST)
+            acc->post(Transaction("Interest", Money::fromCents(amount), TransactionType::INTEREST, time_t(date)));
+        else
+            acc->post(Transaction("Withdrawal", Money::fromCents(amount), TransactionType::WITHDRAW, time_t(date)));
+        return true;
+    }
+
+public:
+    // groupSize is how many records may be buffered before they are forced to disk
+    Journal(string journalPath, size_t group = 1)
+        : path(journalPath), file(nullptr), groupSize(max<size_t>(group, 1)), pendingCount(0), flushing(false), appended(0), durable(0), epoch(1) {}
+    Journal(const Journal &) = delete;
+    Journal &operator=(const Journal &) = delete;
+
+    // Replays the journal into customers, cuts off a torn or corrupt tail, and opens it for appending
+    // coveredEpoch is the last journal epoch already folded into a loaded snapshot (0 without one),
+    // a journal from that epoch or earlier is skipped and started over
+    // Call this before registering the journal as an observer, returns how many records were replayed
+    size_t recover(CustomerList &customers, uint64_t coveredEpoch = 0)
+    {
+        string data;
+        {
+            ifstream in(path, ios::binary);
+            data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        }
+        if (data.size() >= 4 && (data.compare(0, 3, "ZBJ") != 0 || data[3] != VERSION))
+        {
+            throw runtime_error("'" + path + "' is not a ZBanking journal this version can read.");
+        }
+
+        size_t offset = 0;
+        epoch = 1;
+        if (data.size() >= HEADER_SIZE)
+        {
+            offset = HEADER_SIZE;
+            memcpy(&epoch, data.data() + 4, sizeof(epoch));
+        }
+
+        size_t replayed = 0;
+        if (offset == 0 || epoch <= coveredEpoch)
+        {
+            // nothing usable, or nothing the snapshot doesn't already have
+            epoch = max(epoch, coveredEpoch + 1);
+            file = fopen(path.c_str(), "wb");
+            if (!file)
+            {
+                throw runtime_error("Could not open journal '" + path + "'.");
+            }
+            writeHeader();
+            return 0;
+        }
+
+        while (data.size() - offset >= 8)
+        {
+            uint32_t length, checksum;
+            memcpy(&length, data.data() + offset, 4);
+            memcpy(&checksum, data.data() + offset + 4, 4);
+            if (data.size() - offset - 8 < length || crc32(data.data() + offset + 8, length) != checksum)
+                break;
+            if (!apply(data.substr(offset + 8, length), customers))
+                break;
+            offset += 8 + length;
+            replayed++;
+        }
+
+        if (offset < data.size())
+        {
+            filesystem::resize_file(path, offset);
+        }
+        file = fopen(path.c_str(), "ab");
+        if (!file)
+        {
+            throw runtime_error("Could not open journal '" + path + "'.");
+        }
+        return replayed;
+    }
+
+    // Forces everything appended so far to disk
+    void sync()
+    {
+        unique_lock<mutex> held(lock);
+        flushLocked(held);
+    }
+
+    // Waits until the first lsn records are on disk, joining a flush already in flight when there is one
+    // This is what lets concurrent sessions share fsyncs
+    void syncUpTo(uint64_t lsn)
+    {
+        unique_lock<mutex> held(lock);
+        while (durable < lsn)
+        {
+            if (flushing)
+                flushed.wait(held);
+            else
+                flushLocked(held);
+        }
+    }
+
+    // Number of records appended so far, usable as an lsn for syncUpTo
+    uint64_t lastAppended()
+    {
+        lock_guard<mutex> held(lock);
+        return appended;
+    }
+
+    // Drops every record and moves on to the next epoch, used once a snapshot holds the same state
+    void truncate()
+    {
+        unique_lock<mutex> held(lock);
+        flushLocked(held);
+        if (file)
+        {
+            fclose(file);
+        }
+        file = fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            throw runtime_error("Could not open journal '" + path + "'.");
+        }
+        epoch++;
+        writeHeader();
+    }
+
+    uint64_t getEpoch() const { return epoch; }
+    void setGroupSize(size_t group) { groupSize = max<size_t>(group, 1); }
+
+    void accountOpened(const Account &acc) override
+    {
+        string payload;
+        putField<uint8_t>(payload, OPEN);
+        putField<int32_t>(payload, acc.ID);
+        putField<uint8_t>(payload, uint8_t(acc.getType()));
+        putField<int64_t>(payload, acc.getOverdraftLimit().getCents());
+        putField<double>(payload, acc.getInterestRate());
+        putString(payload, acc.username);
+        putString(payload, acc.password);
+        append(payload);
+    }
+
+    void transactionPosted(const Account &acc, const Transaction &trans) override
+    {
+        string payload;
+        Op op = WITHDRAW;
+        if (trans.getType() == TransactionType::DEPOSIT)
+            op = DEPOSIT;
+        else if (trans.getType() == TransactionType::INTEREST)
+            op = INTEREST;
+        putField<uint8_t>(payload, op);
+        putField<int32_t>(payload, acc.ID);
+        putField<int64_t>(payload, trans.getAmount().getCents());
+        putField<int64_t>(payload, int64_t(trans.getDate()));
+        append(payload);
+    }
+
+    // Both sides of a transfer go into one record, so a torn tail can never keep just one of them
+    void transferPosted(const Account &from, const Account &to, const Transaction &, const Transaction &in) override
+    {
+        string payload;
+        putField<uint8_t>(payload, TRANSFER);
+        putField<int32_t>(payload, from.ID);
+        putField<int32_t>(payload, to.ID);
+        putField<int64_t>(payload, in.getAmount().getCents());
+        putField<int64_t>(payload, int64_t(in.getDate()));
+        append(payload);
+    }
+
+    // Imported history goes in as raw records, a few thousand to a journal record
+    void historyImported(const Account &acc, const TransactionRecord *records, size_t count) override
+    {
+        for (size_t done = 0; done < count; done += IMPORT_RECORDS)
+        {
+            uint32_t n = uint32_t(min(IMPORT_RECORDS, count - done));
+            string payload;
+            putField<uint8_t>(payload, IMPORT);
+            putField<int32_t>(payload, acc.ID);
+            putField<uint32_t>(payload, n);
+            payload.append(reinterpret_cast<const char *>(records + done), n * sizeof(TransactionRecord));
+            append(payload);
+        }
+    }
+
+    void accountClosed(const Account &acc) override
+    {
+        string payload;
+        putField<uint8_t>(payload, CLOSE);
+        putField<int32_t>(payload, acc.ID);
+        append(payload);
+    }
+
+    void orderPlaced(const StandingOrder &order) override
+    {
+        string payload;
+        putField<uint8_t>(payload, ORDER);
+        putField<int32_t>(payload, order.account);
+        putField<StandingOrder>(payload, order);
+        append(payload);
+    }
+
+    void orderCancelled(uint64_t id) override
+    {
+        string payload;
+        putField<uint8_t>(payload, CANCEL_ORDER);
+        putField<int32_t>(payload, 0);
+        putField<uint64_t>(payload, id);
+        append(payload);
+    }
+
+    void orderAdvanced(uint64_t id, uint32_t due) override
+    {
+        string payload;
+        putField<uint8_t>(payload, ORDER_DUE);
+        putField<int32_t>(payload, 0);
+        putField<uint64_t>(payload, id);
+        putField<uint32_t>(payload, due);
+        append(payload);
+    }
+
+    ~Journal()
+    {
+        if (file)
+        {
+            try
+            {
+                sync();
+            }
+            catch (const exception &ex)
+            {
+                cerr << "Error: " << ex.what() << endl;
+            }
+            fclose(file);
+        }
+    }
+};
+
+// Read only view of a whole file, memory mapped where we can, read into memory otherwise
+class MappedFile
+{
+private:
+    const char *bytes;
+    size_t length;
+#ifdef _WIN32
+    vector<char> buffer;
+#endif
+
+public:
+    MappedFile() : bytes(nullptr), length(0) {}
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // what names the file in error messages, e.g. "snapshot"
+    void open(const string &path, const string &what)
+    {
+        close();
+#ifdef _WIN32
+        ifstream in(path, ios::binary);
+        if (!in)
+        {
+            throw runtime_error("Could not open " + what + " '" + path + "'.");
+        }
+        buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        bytes = buffer.data();
+        length = buffer.size();
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw runtime_error("Could not open " + what + " '" + path + "'.");
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            ::close(fd);
+            return;
+        }
+        void *mapping = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            throw runtime_error("Could not map " + what + " '" + path + "'.");
+        }
+        bytes = static_cast<const char *>(mapping);
+        length = size_t(info.st_size);
+#endif
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        buffer.clear();
+#else
+        if (bytes)
+        {
+            munmap(const_cast<char *>(bytes), length);
+        }
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const char *data() const { return bytes; }
+    size_t size() const { return length; }
+
+    ~MappedFile() { close(); }
+};
+
+// Versioned on disk snapshot of every account and its transactions
+// Loading maps the file and points each TransactionList at its slice of the record array,
+// so transactions are read in place instead of being parsed or copied
+//
+// Layout (native byte order, sections 8 byte aligned):
+//   SnapshotHeader | SnapshotAccount[accountCount] | usernames and passwords | TransactionRecord[recordCount]
+//   | descriptions | memos | StandingOrder[orderCount]
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t lastID;
+    uint64_t accountCount;
+    uint64_t recordCount;
+    uint64_t stringsOffset;
+    uint64_t recordsOffset;
+    // Last journal epoch whose records are included
+    uint64_t journalEpoch;
+    // After the records: the shared descriptions (uint16 length, text) from ID 1 on,
+    // then the memos (uint64 record number across the file, uint32 length, text)
+    uint64_t descriptionsOffset;
+    uint32_t descriptionCount;
+    uint32_t reserved;
+    uint64_t memosOffset;
+    uint64_t memoCount;
+    // Then, from the next 8 byte boundary, the standing orders
+    uint64_t ordersOffset;
+    uint64_t orderCount;
+    uint64_t lastOrderID;
+};
+static_assert(sizeof(SnapshotHeader) == 112, "snapshot header layout changed");
+
+struct SnapshotAccount
+{
+    int32_t id;
+    uint8_t type;
+    uint8_t ordered;
+    uint16_t usernameLength;
+    uint32_t stringOffset;
+    uint16_t passwordLength;
+    uint16_t reserved;
+    uint32_t accruedThrough; // day number, 0 in snapshots from before interest accrual
+    int64_t overdraftLimit; // cents
+    double interestRate;
+    int64_t balance; // cents
+    uint64_t firstRecord;
+    uint64_t recordCount;
+};
+static_assert(sizeof(SnapshotAccount) == 64, "snapshot account layout changed");
+
+class Snapshot
+{
+private:
+    static constexpr uint32_t VERSION = 4;
+
+    MappedFile file;
+    uint64_t epoch;
+
+    static uint64_t align8(uint64_t offset) { return (offset + 7) & ~uint64_t(7); }
+
+    static void writeOrThrow(FILE *out, const void *bytes, size_t size)
+    {
+        if (fwrite(bytes, 1, size, out) != size)
+        {
+            fclose(out);
+            throw runtime_error("Could not write the snapshot.");
+        }
+    }
+
+public:
+    Snapshot() : epoch(0) {}
+    Snapshot(const Snapshot &) = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+
+    // Writes every account to path, going through a temporary file so a crash never leaves half a snapshot
+    static void write(const string &path, const CustomerList &customers, uint64_t journalEpoch)
+    {
+        vector<SnapshotAccount> accounts;
+        string strings;
+        uint64_t recordCount = 0;
+        for (const Account *account : customers.accounts())
+        {
+            const Account &acc = *account;
+            SnapshotAccount entry = {};
+            entry.id = acc.ID;
+            entry.type = uint8_t(acc.getType());
+            entry.ordered = acc.transactions.isOrdered();
+            entry.usernameLength = uint16_t(acc.username.size());
+            entry.passwordLength = uint16_t(acc.password.size());
+            entry.stringOffset = uint32_t(strings.size());
+            entry.overdraftLimit = acc.getOverdraftLimit().getCents();
+            entry.interestRate = acc.getInterestRate();
+            entry.balance = acc.getBalance().getCents();
+            entry.accruedThrough = uint32_t(acc.accruedThrough);
+            entry.firstRecord = recordCount;
+            entry.recordCount = acc.transactions.size();
+            strings.append(acc.username, 0, entry.usernameLength);
+            strings.append(acc.password, 0, entry.passwordLength);
+            recordCount += entry.recordCount;
+            accounts.push_back(entry);
+        }
+
+        SnapshotHeader header = {};
+        memcpy(header.magic, "ZBSNAP\0", 8);
+        header.version = VERSION;
+        header.lastID = customers.getLastID();
+        header.accountCount = accounts.size();
+        header.recordCount = recordCount;
+        header.stringsOffset = sizeof(SnapshotHeader) + accounts.size() * sizeof(SnapshotAccount);
+        header.recordsOffset = align8(header.stringsOffset + strings.size());
+        header.journalEpoch = journalEpoch;
+
+        string extra;
+        vector<string> descriptions = Descriptions::shared().all();
+        for (const string &text : descriptions)
+        {
+            putField<uint16_t>(extra, uint16_t(text.size()));
+            extra += text;
+        }
+        size_t descriptionsLength = extra.size();
+        uint64_t memoCount = 0, firstRecord = 0;
+        for (const Account *acc : customers.accounts())
+        {
+            for (const pair<size_t, string> &memo : acc->transactions.getMemos())
+            {
+                putField<uint64_t>(extra, firstRecord + memo.first);
+                putField<uint32_t>(extra, uint32_t(memo.second.size()));
+                extra += memo.second;
+                memoCount++;
+            }
+            firstRecord += acc->transactions.size();
+        }
+        header.descriptionsOffset = header.recordsOffset + recordCount * sizeof(TransactionRecord);
+        header.descriptionCount = uint32_t(descriptions.size());
+        header.memosOffset = header.descriptionsOffset + descriptionsLength;
+        header.memoCount = memoCount;
+
+        extra.resize(align8(header.descriptionsOffset + extra.size()) - header.descriptionsOffset, '\0');
+        header.ordersOffset = header.descriptionsOffset + extra.size();
+        customers.orders.forEach([&](const StandingOrder &order)
+                                 { putField<StandingOrder>(extra, order); });
+        header.orderCount = (header.descriptionsOffset + extra.size() - header.ordersOffset) / sizeof(StandingOrder);
+        header.lastOrderID = customers.orders.getLastID();
+
+        string temporary = path + ".tmp";
+        FILE *out = fopen(temporary.c_str(), "wb");
+        if (!out)
+        {
+            throw runtime_error("Could not create snapshot '" + temporary + "'.");
+        }
+        setvbuf(out, nullptr, _IOFBF, 1 << 20);
+        writeOrThrow(out, &header, sizeof(header));
+        writeOrThrow(out, accounts.data(), accounts.size() * sizeof(SnapshotAccount));
+        strings.resize(header.recordsOffset - header.stringsOffset, '\0');
+        writeOrThrow(out, strings.data(), strings.size());
+        for (const Account *acc : customers.accounts())
+        {
+            const TransactionList &list = acc->transactions;
+            list.forEachRecord(0, list.size(), [&](const TransactionRecord &record)
+                               { writeOrThrow(out, &record, sizeof(record)); });
+        }
+        writeOrThrow(out, extra.data(), extra.size());
+#ifdef _WIN32
+        bool synced = fflush(out) == 0 && _commit(_fileno(out)) == 0;
+#else
+        bool synced = fflush(out) == 0 && fsync(fileno(out)) == 0;
+#endif
+        fclose(out);
+        if (!synced)
+        {
+            throw runtime_error("Could not write the snapshot.");
+        }
+        filesystem::rename(temporary, path);
+    }
+
+    // Loads the snapshot at path into customers, returns false if there is no snapshot yet
+    // The mapping stays alive until this object is destroyed, so it has to outlive the accounts
+    bool load(const string &path, CustomerList &customers)
+    {
+        if (!filesystem::exists(path))
+        {
+            return false;
+        }
+        file.open(path, "snapshot");
+        const char *data = file.data();
+        size_t length = file.size();
+        if (length == 0)
+        {
+            throw runtime_error("Snapshot '" + path + "' is empty.");
+        }
+
+        SnapshotHeader header;
+        if (length < sizeof(header))
+        {
+            throw runtime_error("Snapshot '" + path + "' is truncated.");
+        }
+        memcpy(&header, data, sizeof(header));
+        if (memcmp(header.magic, "ZBSNAP\0", 8) != 0 || header.version != VERSION)
+        {
+            throw runtime_error("'" + path + "' is not a ZBanking snapshot this version can read.");
+        }
+        if (header.stringsOffset != sizeof(SnapshotHeader) + header.accountCount * sizeof(SnapshotAccount) ||
+            header.recordsOffset < header.stringsOffset || header.recordsOffset % 8 != 0 ||
+            header.recordCount > (length - min<uint64_t>(length, header.recordsOffset)) / sizeof(TransactionRecord) ||
+            header.descriptionsOffset != header.recordsOffset + header.recordCount * sizeof(TransactionRecord) ||
+            header.memosOffset < header.descriptionsOffset || header.ordersOffset < header.memosOffset ||
+            header.ordersOffset > length || header.orderCount > (length - header.ordersOffset) / sizeof(StandingOrder))
+        {
+            throw runtime_error("Snapshot '" + path + "' is truncated or corrupt.");
+        }
+
+        // descriptions go back in first, the records refer to them by ID
+        const char *pos = data + header.descriptionsOffset;
+        const char *end = data + header.memosOffset;
+        vector<string_view> descriptions;
+        for (uint32_t i = 0; i < header.descriptionCount; i++)
+        {
+            uint16_t size;
+            if (!getField(pos, end, size) || size_t(end - pos) < size)
+            {
+                throw runtime_error("Snapshot '" + path + "' is truncated or corrupt.");
+            }
+            descriptions.emplace_back(pos, size);
+            pos += size;
+        }
+        Descriptions::shared().restore(descriptions);
+        pos = end;
+        end = data + header.ordersOffset;
+
+        const SnapshotAccount *accounts = reinterpret_cast<const SnapshotAccount *>(data + sizeof(SnapshotHeader));
+        const char *strings = data + header.stringsOffset;
+        const TransactionRecord *records = reinterpret_cast<const TransactionRecord *>(data + header.recordsOffset);
+        uint64_t stringsLength = header.recordsOffset - header.stringsOffset;
+        uint64_t memosLeft = header.memoCount;
+        for (uint64_t i = 0; i < header.accountCount; i++)
+        {
+            const SnapshotAccount &entry = accounts[i];
+            if (uint64_t(entry.stringOffset) + entry.usernameLength + entry.passwordLength > stringsLength ||
+                entry.firstRecord > header.recordCount || entry.recordCount > header.recordCount - entry.firstRecord)
+            {
+                throw runtime_error("Snapshot '" + path + "' is truncated or corrupt.");
+            }
+            string username(strings + entry.stringOffset, entry.usernameLength);
+            string password(strings + entry.stringOffset + entry.usernameLength, entry.passwordLength);
+            Account *acc;
+            if (entry.type == uint8_t(AccountType::CHECKING))
+                acc = customers.create<CheckingAccount>(username, password, Money::fromCents(entry.overdraftLimit));
+            else
+                acc = customers.create<SavingsAccount>(username, password, entry.interestRate);
+            acc->ID = entry.id;
+            acc->balance = Money::fromCents(entry.balance);
+            acc->accruedThrough = entry.accruedThrough;
+            acc->transactions.attach(records + entry.firstRecord, entry.recordCount, entry.ordered != 0);
+            // memos are stored in record order, so the ones for this account come next
+            while (memosLeft > 0)
+            {
+                const char *next = pos;
+                uint64_t record;
+                uint32_t size;
+                if (!getField(next, end, record) || !getField(next, end, size) || size_t(end - next) < size)
+                {
+                    throw runtime_error("Snapshot '" + path + "' is truncated or corrupt.");
+                }
+                if (record >= entry.firstRecord + entry.recordCount)
+                {
+                    break;
+                }
+                if (record < entry.firstRecord)
+                {
+                    throw runtime_error("Snapshot '" + path + "' is truncated or corrupt.");
+                }
+                acc->transactions.restoreMemo(size_t(record - entry.firstRecord), string(next, size));
+                pos = next + size;
+                memosLeft--;
+            }
+            customers.addCustomer(acc);
+        }
+        if (memosLeft > 0)
+        {
+            throw runtime_error("Snapshot '" + path + "' is truncated or corrupt.");
+        }
+        customers.reserveIDs(header.lastID);
+        for (uint64_t i = 0; i < header.orderCount; i++)
+        {
+            StandingOrder order;
+            memcpy(&order, data + header.ordersOffset + i * sizeof(StandingOrder), sizeof(order));
+            customers.orders.place(order);
+        }
+        customers.orders.reserveIDs(header.lastOrderID);
+        epoch = header.journalEpoch;
+        return true;
+    }
+
+    // Last journal epoch the loaded snapshot already includes, 0 if nothing was loaded
+    uint64_t coveredEpoch() const { return epoch; }
+
+};
+
+// Bulk history files, for moving transactions in and out in bulk (e.g. migrating from another system)
+//   CSV:    account,date,type,amount   e.g. 42,2024-03-01T09:30:00Z,Withdrawal,-20.00
+//           the header line is optional, dates without a trailing Z are local time, the amount's sign comes from the type
+//   binary: "ZBHIST\0\0", uint32 version, uint32 reserved, uint64 row count, then HistoryRow[row count] (native byte order)
+//           descriptions are not carried over, they come back as the type names
+struct HistoryRow
+{
+    int32_t account;
+    uint32_t reserved;
+    TransactionRecord record;
+};
+static_assert(sizeof(HistoryRow) == 24, "history files depend on the row layout");
+
+struct HistoryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t rowCount;
+};
+static_assert(sizeof(HistoryHeader) == 24, "history file header layout changed");
+
+// Starts func(0) .. func(threadCount - 1) on their own threads, func(0) runs on the caller's, and waits for all of them
+template <typename Func>
+void runOnThreads(size_t threadCount, Func func)
+{
+    vector<thread> threads;
+    for (size_t t = 1; t < threadCount; t++)
+    {
+        threads.emplace_back(func, t);
+    }
+    func(0);
+    for (thread &worker : threads)
+    {
+        worker.join();
+    }
+}
+
+// Pays the standing orders that have come due. The timer wheel hands out a day's orders at a time and the
+// day is paid on threadCount threads through the same credit, debit and transfer every other front end uses,
+// so overdraft limits and savings balances are checked the usual way. A payment that is refused counts as
+// failed and the order moves on to its next day. Orders of closed accounts are dropped
+//
+// After downtime every missed payment is made, each dated on its own day, unless catchUp is off:
+// then only the latest missed payment of each order is made and the older ones are skipped
+class StandingOrderRun
+{
+private:
+    static const size_t CHUNK = 1024;
+
+public:
+    struct Result
+    {
+        size_t paid = 0;
+        size_t failed = 0;
+        size_t skipped = 0;
+        size_t dropped = 0;
+        Money total;
+    };
+
+    // Makes one payment of order, or tells why not
+    enum Outcome : uint8_t
+    {
+        PAID,
+        FAILED,
+        SKIPPED,
+        DROPPED
+    };
+
+    static Outcome pay(CustomerList &customers, StandingOrder &order, int64_t day, bool catchUp)
+    {
+        Account *from = customers.findAccount(order.account);
+        Account *to = order.kind == StandingOrder::TRANSFER ? customers.findAccount(order.target) : nullptr;
+        if (!from || (order.kind == StandingOrder::TRANSFER && !to))
+        {
+            return DROPPED;
+        }
+        uint32_t due = order.nextDue;
+        order.nextDue = order.after(due);
+        for (LedgerObserver *observer : Account::observers)
+        {
+            observer->orderAdvanced(order.id, order.nextDue);
+        }
+        if (!catchUp && order.nextDue <= day)
+        {
+            return SKIPPED;
+        }
+        // dated at the end of the day it was due, or now when that is today
+        time_t date = min<time_t>(LedgerClock::now(), time_t(int64_t(due) * 86400 + 86399));
+        Money amount = Money::fromCents(order.amount);
+        try
+        {
+            if (order.kind == StandingOrder::DEPOSIT)
+                from->credit(amount, date);
+            else if (order.kind == StandingOrder::WITHDRAW)
+                from->debit(amount, date);
+            else
+                Account::transfer(*from, *to, amount, date);
+        }
+        catch (const exception &)
+        {
+            return FAILED;
+        }
+        return PAID;
+    }
+
+    // Pays everything due through day, which can't be after today: the wheel would hand out payments that are not due yet
+    static Result run(CustomerList &customers, int64_t day, size_t threadCount, bool catchUp = true)
+    {
+        if (day > InterestAccrual::today())
+        {
+            throw runtime_error("Standing orders can only be paid up to today.");
+        }
+        StandingOrders &book = customers.orders;
+        lock_guard<mutex> held(book.lock);
+        vector<Outcome> outcomes;
+        Result result;
+        book.advance(day, [&](vector<uint32_t> &due)
+                     {
+            outcomes.resize(due.size());
+            size_t threads = max<size_t>(1, min(threadCount, (due.size() + CHUNK - 1) / CHUNK));
+            atomic<size_t> next(0);
+            runOnThreads(threads, [&](size_t)
+                         {
+                size_t begin;
+                while ((begin = next.fetch_add(CHUNK)) < due.size())
+                {
+                    for (size_t i = begin; i < min(due.size(), begin + CHUNK); i++)
+                    {
+                        outcomes[i] = pay(customers, book.at(due[i]), day, catchUp);
+                    }
+                } });
+
+            for (size_t i = 0; i < due.size(); i++)
+            {
+                const StandingOrder &order = book.at(due[i]);
+                switch (outcomes[i])
+                {
+                case PAID:
+                    result.paid++;
+                    result.total += Money::fromCents(order.amount);
+                    break;
+                case FAILED:
+                    result.failed++;
+                    break;
+                case SKIPPED:
+                    result.skipped++;
+                    break;
+                case DROPPED:
+                    result.dropped++;
+                    book.cancel(order.id);
+                    continue;
+                }
+                book.schedule(due[i]);
+            } });
+        return result;
+    }
+};
+
+// Loads a history file into existing accounts
+// The file is mapped and cut into one slice per thread, every thread parses its slice and sorts the rows by the thread
+// that owns their account, then every thread appends its own accounts' rows in file order, so no account is shared.
+// Every row is checked before anything is appended, a bad row stops the whole import
+class HistoryImport
+{
+public:
+    static constexpr uint32_t VERSION = 2;
+
+    struct Result
+    {
+        size_t rows = 0;
+        size_t accounts = 0;
+        Money total;
+    };
+
+private:
+    // What one thread parsed
+    struct Part
+    {
+        vector<vector<HistoryRow>> owned; // by owning thread
+        size_t failedAt = SIZE_MAX;       // offset of the first bad row
+        string error;
+
+        void fail(size_t at, string message)
+        {
+            failedAt = at;
+            error = move(message);
+        }
+    };
+
+    static bool parseType(string_view name, TransactionType &type)
+    {
+        if (name == "Deposit" || name == "deposit")
+            type = TransactionType::DEPOSIT;
+        else if (name == "Withdrawal" || name == "withdrawal" || name == "withdraw")
+            type = TransactionType::WITHDRAW;
+        else if (name == "Interest" || name == "interest")
+            type = TransactionType::INTEREST;
+        else
+            return false;
+        return true;
+    }
+
+    static bool known(const vector<Account *> &byID, int64_t id)
+    {
+        return id > 0 && uint64_t(id) < byID.size() && byID[size_t(id)];
+    }
+
+    // Parses the CSV lines in [begin, end)
+    static void parseCsv(const char *data, size_t begin, size_t end, const vector<Account *> &byID, Part &part)
+    {
+        DateCache &dates = DateCache::local();
+        const size_t owners = part.owned.size();
+        size_t pos = begin;
+        while (pos < end)
+        {
+            size_t at = pos;
+            const char *newline = static_cast<const char *>(memchr(data + pos, '\n', end - pos));
+            size_t lineEnd = newline ? size_t(newline - data) : end;
+            string_view line(data + pos, lineEnd - pos);
+            pos = lineEnd + 1;
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            if (line.empty() || line[0] == '#' || line.compare(0, 7, "account") == 0)
+                continue;
+
+            string_view fields[4];
+            size_t count = 0, start = 0;
+            while (count < 4 && start != string_view::npos)
+            {
+                size_t comma = line.find(',', start);
+                fields[count++] = line.substr(start, comma == string_view::npos ? comma : comma - start);
+                start = comma == string_view::npos ? comma : comma + 1;
+            }
+            if (count != 4 || start != string_view::npos)
+            {
+                return part.fail(at, "Expected account,date,type,amount.");
+            }
+
+            int64_t id = 0;
+            auto parsed = from_chars(fields[0].data(), fields[0].data() + fields[0].size(), id);
+            if (parsed.ec != errc() || parsed.ptr != fields[0].data() + fields[0].size() || !known(byID, id))
+            {
+                return part.fail(at, "No account with ID " + string(fields[0]) + ".");
+            }
+            int64_t day;
+            int seconds;
+            bool utc;
+            if (!DateParser::parse(fields[1], day, seconds, utc))
+            {
+                return part.fail(at, "Invalid date '" + string(fields[1]) + "'.");
+            }
+            TransactionType type;
+            if (!parseType(fields[2], type))
+            {
+                return part.fail(at, "Unknown transaction type '" + string(fields[2]) + "'.");
+            }
+            Money amount;
+            if (!Money::parse(fields[3], amount) || amount == Money())
+            {
+                return part.fail(at, "Invalid amount '" + string(fields[3]) + "'.");
+            }
+
+            int64_t moment = day * 86400 + seconds;
+            moment = utc ? moment : int64_t(dates.fromLocal(moment));
+            if (!TransactionRecord::validDate(moment))
+            {
+                return part.fail(at, "Date '" + string(fields[1]) + "' is outside 1970 to 2106.");
+            }
+            HistoryRow row = {};
+            row.account = int32_t(id);
+            row.record.date = uint32_t(moment);
+            row.record.type = uint8_t(type);
+            row.record.amount = llabs(amount.getCents()) * (type == TransactionType::WITHDRAW ? -1 : 1);
+            part.owned[size_t(id) % owners].push_back(row);
+        }
+    }
+
+    // Checks the binary rows [begin, end)
+    static void parseBinary(const HistoryRow *rows, size_t begin, size_t end, const vector<Account *> &byID, Part &part)
+    {
+        const size_t owners = part.owned.size();
+        for (size_t i = begin; i < end; i++)
+        {
+            HistoryRow row;
+            memcpy(&row, rows + i, sizeof(row));
+            row.record.flags = 0;
+            row.record.description = 0;
+            const TransactionRecord &record = row.record;
+            size_t at = sizeof(HistoryHeader) + i * sizeof(HistoryRow);
+            if (!known(byID, row.account))
+            {
+                return part.fail(at, "No account with ID " + to_string(row.account) + ".");
+            }
+            bool withdrawal = record.type == uint8_t(TransactionType::WITHDRAW);
+            if (record.type > uint8_t(TransactionType::INTEREST) || record.amount == 0 || (record.amount < 0) != withdrawal)
+            {
+                return part.fail(at, "Invalid transaction.");
+            }
+            part.owned[size_t(row.account) % owners].push_back(row);
+        }
+    }
+
+public:
+    static Result run(const string &path, CustomerList &customers, size_t threadCount)
+    {
+        MappedFile file;
+        file.open(path, "history file");
+        const char *data = file.data();
+        const size_t length = file.size();
+
+        vector<Account *> byID(size_t(customers.getLastID()) + 1);
+        for (Account *acc : customers.accounts())
+        {
+            byID[size_t(acc->ID)] = acc;
+        }
+
+        HistoryHeader header = {};
+        bool binary = length >= sizeof(header) && memcmp(data, "ZBHIST\0", 8) == 0;
+        size_t units = length;
+        if (binary)
+        {
+            memcpy(&header, data, sizeof(header));
+            if (header.version != VERSION || (length - sizeof(header)) / sizeof(HistoryRow) != header.rowCount ||
+                (length - sizeof(header)) % sizeof(HistoryRow) != 0)
+            {
+                throw runtime_error("'" + path + "' is not a history file this version can read.");
+            }
+            units = size_t(header.rowCount);
+        }
+        threadCount = max<size_t>(1, min(threadCount, units / 4096 + 1));
+
+        // slice boundaries, CSV slices start right after a newline
+        vector<size_t> bounds(threadCount + 1, units);
+        bounds[0] = 0;
+        for (size_t t = 1; t < threadCount; t++)
+        {
+            size_t at = max(bounds[t - 1], units / threadCount * t);
+            if (!binary && at > 0)
+            {
+                const char *newline = static_cast<const char *>(memchr(data + at - 1, '\n', length - (at - 1)));
+                at = newline ? size_t(newline - data) + 1 : length;
+            }
+            bounds[t] = at;
+        }
+
+        vector<Part> parts(threadCount);
+        runOnThreads(threadCount, [&](size_t t)
+                     {
+            parts[t].owned.resize(threadCount);
+            if (binary)
+                parseBinary(reinterpret_cast<const HistoryRow *>(data + sizeof(header)), bounds[t], bounds[t + 1], byID, parts[t]);
+            else
+                parseCsv(data, bounds[t], bounds[t + 1], byID, parts[t]); });
+
+        for (const Part &part : parts)
+        {
+            if (part.failedAt != SIZE_MAX)
+            {
+                string where = binary ? "row " + to_string((part.failedAt - sizeof(header)) / sizeof(HistoryRow) + 1)
+                                      : "line " + to_string(count(data, data + part.failedAt, '\n') + 1);
+                throw runtime_error("'" + path + "' " + where + ": " + part.error);
+            }
+        }
+
+        vector<Result> partial(threadCount);
+        runOnThreads(threadCount, [&](size_t owner)
+                     {
+            vector<HistoryRow> rows;
+            for (Part &part : parts)
+            {
+                rows.insert(rows.end(), part.owned[owner].begin(), part.owned[owner].end());
+                vector<HistoryRow>().swap(part.owned[owner]);
+            }
+            auto byAccount = [](const HistoryRow &a, const HistoryRow &b)
+            { return a.account < b.account; };
+            if (!is_sorted(rows.begin(), rows.end(), byAccount))
+                stable_sort(rows.begin(), rows.end(), byAccount);
+
+            vector<TransactionRecord> history;
+            for (size_t i = 0; i < rows.size();)
+            {
+                int32_t id = rows[i].account;
+                history.clear();
+                int64_t sum = 0;
+                for (; i < rows.size() && rows[i].account == id; i++)
+                {
+                    history.push_back(rows[i].record);
+                    sum += rows[i].record.amount;
+                }
+                byID[size_t(id)]->import(history.data(), history.size());
+                partial[owner].rows += history.size();
+                partial[owner].accounts++;
+                partial[owner].total += Money::fromCents(sum);
+            } });
+
+        Result result;
+        for (const Result &part : partial)
+        {
+            result.rows += part.rows;
+            result.accounts += part.accounts;
+            result.total += part.total;
+        }
+        return result;
+    }
+};
+
+// Writes every account's history to a history file, accounts in ID order and each history in stored order
+// Threads format batches of accounts into their own buffers and the calling thread writes the buffers out in order,
+// at most two per thread are held at once so memory stays flat however large the ledger is
+class HistoryExport
+{
+public:
+    enum class Format
+    {
+        CSV,
+        BINARY
+    };
+
+    static bool parseFormat(string_view name, Format &format)
+    {
+        if (name == "csv")
+            format = Format::CSV;
+        else if (name == "binary")
+            format = Format::BINARY;
+        else
+            return false;
+        return true;
+    }
+
+private:
+    static const size_t BATCH_ROWS = 1 << 16;
+
+    struct Batch
+    {
+        size_t first, last; // accounts
+    };
+
+    static void render(Format format, const Account &acc, size_t rows, string &out)
+    {
+        lock_guard<mutex> held(acc.guard);
+        if (format == Format::BINARY)
+        {
+            HistoryRow row = {};
+            row.account = acc.ID;
+            acc.transactions.forEachRecord(0, rows, [&](const TransactionRecord &record)
+                                           {
+                row.record = record;
+                row.record.flags = 0;
+                row.record.description = 0;
+                out.append(reinterpret_cast<const char *>(&row), sizeof(row)); });
+            return;
+        }
+        char id[16], date[32], amount[24];
+        size_t idLength = size_t(to_chars(id, id + sizeof(id), acc.ID).ptr - id);
+        acc.transactions.forEachRecord(0, rows, [&](const TransactionRecord &record)
+                                       {
+            out.append(id, idLength);
+            out += ',';
+            out.append(date, DateCache::formatUtc(time_t(record.date), date));
+            out += ',';
+            out += transactionTypeName(TransactionType(record.type));
+            out += ',';
+            out.append(amount, Money::fromCents(record.amount).format(amount));
+            out += '\n'; });
+    }
+
+public:
+    // Returns how many rows were written
+    static size_t run(const string &path, const CustomerList &customers, Format format, size_t threadCount)
+    {
+        // the row counts are taken up front, anything posted while exporting is left out
+        vector<const Account *> accounts(customers.accounts().begin(), customers.accounts().end());
+        sort(accounts.begin(), accounts.end(), [](const Account *a, const Account *b)
+             { return a->ID < b->ID; });
+        vector<size_t> sizes;
+        vector<Batch> batches;
+        size_t total = 0, batchRows = 0;
+        for (size_t a = 0; a < accounts.size(); a++)
+        {
+            {
+                lock_guard<mutex> held(accounts[a]->guard);
+                sizes.push_back(accounts[a]->transactions.size());
+            }
+            if (batches.empty() || batchRows >= BATCH_ROWS)
+            {
+                batches.push_back({a, a});
+                batchRows = 0;
+            }
+            batches.back().last = a + 1;
+            batchRows += sizes.back();
+            total += sizes.back();
+        }
+
+        FILE *out = fopen(path.c_str(), "wb");
+        if (!out)
+        {
+            throw runtime_error("Could not create '" + path + "'.");
+        }
+        bool written = true;
+        if (format == Format::BINARY)
+        {
+            HistoryHeader header = {};
+            memcpy(header.magic, "ZBHIST\0", 8);
+            header.version = HistoryImport::VERSION;
+            header.rowCount = total;
+            written = fwrite(&header, 1, sizeof(header), out) == sizeof(header);
+        }
+        else
+        {
+            written = fputs("account,date,type,amount\n", out) >= 0;
+        }
+
+        threadCount = max<size_t>(1, min(threadCount, batches.size()));
+        const size_t window = 2 * threadCount;
+        vector<string> buffers(window);
+        vector<char> ready(window, 0);
+        mutex lock;
+        condition_variable changed;
+        size_t done = 0;
+        atomic<size_t> next(0);
+        auto work = [&](size_t)
+        {
+            size_t b;
+            while ((b = next.fetch_add(1)) < batches.size())
+            {
+                {
+                    unique_lock<mutex> held(lock);
+                    changed.wait(held, [&]
+                                 { return b < done + window; });
+                }
+                string &buffer = buffers[b % window];
+                buffer.clear();
+                for (size_t a = batches[b].first; a < batches[b].last; a++)
+                {
+                    render(format, *accounts[a], sizes[a], buffer);
+                }
+                {
+                    lock_guard<mutex> held(lock);
+                    ready[b % window] = 1;
+                }
+                changed.notify_all();
+            }
+        };
+        vector<thread> threads;
+        for (size_t t = 0; t < threadCount; t++)
+        {
+            threads.emplace_back(work, t);
+        }
+        for (size_t b = 0; b < batches.size(); b++)
+        {
+            {
+                unique_lock<mutex> held(lock);
+                changed.wait(held, [&]
+                             { return ready[b % window] != 0; });
+            }
+            const string &buffer = buffers[b % window];
+            written = written && fwrite(buffer.data(), 1, buffer.size(), out) == buffer.size();
+            {
+                lock_guard<mutex> held(lock);
+                ready[b % window] = 0;
+                done++;
+            }
+            changed.notify_all();
+        }
+        for (thread &worker : threads)
+        {
+            worker.join();
+        }
+        if (fclose(out) != 0 || !written)
+        {
+            throw runtime_error("Could not write '" + path + "'.");
+        }
+        return total;
+    }
+};
+
+// Writes every command the bank is given to a file, with the session it came from and when, so the same load can be
+// replayed later (see Replay). Session 0 is batch mode, every login at the prompt and every server connection gets its own:
+//   # zbank recording 1 start <seconds since 1970>
+//   <microseconds since the start> <session> <command line>
+// No secret reaches the file: passwords in open and login become *, and so do resume tokens. A login is written once it
+// has been checked, as "login <username> * <account ID>" (0 when it failed), stamped with the time it came in
+// Recordings are still created readable by their owner only, they show who did what with which account
+class SessionRecorder
+{
+private:
+    mutex lock;
+    FILE *file;
+    chrono::steady_clock::time_point started;
+    atomic<uint64_t> sessions;
+
+    // Creates or empties path with owner only permissions, a file left over from an earlier run included
+    static FILE *create(const string &path)
+    {
+#ifdef _WIN32
+        return fopen(path.c_str(), "w");
+#else
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0)
+            return nullptr;
+        FILE *file = fchmod(fd, 0600) == 0 ? fdopen(fd, "w") : nullptr;
+        if (!file)
+            ::close(fd);
+        return file;
+#endif
+    }
+
+public:
+    // The recorder commands typed at the prompt go to, if any
+    inline static SessionRecorder *active = nullptr;
+
+    explicit SessionRecorder(const string &path) : file(create(path)), started(chrono::steady_clock::now()), sessions(0)
+    {
+        if (!file)
+        {
+            throw runtime_error("Could not create recording '" + path + "'.");
+        }
+        setvbuf(file, nullptr, _IOFBF, 1 << 16);
+        fprintf(file, "# zbank recording 1 start %lld\n", static_cast<long long>(time(nullptr)));
+    }
+    SessionRecorder(const SessionRecorder &) = delete;
+    SessionRecorder &operator=(const SessionRecorder &) = delete;
+
+    uint64_t nextSession() { return ++sessions; }
+
+    // Microseconds since the recording started
+    int64_t elapsed() const { return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - started).count(); }
+
+    // The line with its secret word, if the command has one, replaced by *
+    static string redact(string_view line)
+    {
+        size_t from = line.find_first_not_of(" \t");
+        size_t end = from == string_view::npos ? line.size() : line.find_first_of(" \t", from);
+        string_view command = line.substr(min(from, line.size()), end - min(from, line.size()));
+        int secret = command == "open" ? 3 : command == "login" ? 2 : command == "resume" ? 1 : 0;
+        for (int word = 1; word <= secret && end < line.size(); word++)
+        {
+            from = line.find_first_not_of(" \t", end);
+            if (from == string_view::npos)
+                break;
+            end = min(line.find_first_of(" \t", from), line.size());
+            if (word == secret)
+                return string(line.substr(0, from)) + "*" + string(line.substr(end));
+        }
+        return string(line);
+    }
+
+    // Writes a line for session, stamped with micros (now when it is negative)
+    void record(uint64_t session, string_view line, int64_t micros = -1)
+    {
+        while (!line.empty() && (line.back() == '\r' || line.back() == '\n'))
+        {
+            line.remove_suffix(1);
+        }
+        string safe = redact(line);
+        long long at = static_cast<long long>(micros < 0 ? elapsed() : micros);
+        lock_guard<mutex> held(lock);
+        fprintf(file, "%lld %llu %s\n", at, static_cast<unsigned long long>(session), safe.c_str());
+    }
+
+    // Writes a checked login, which account it reached stands in for the password
+    void recordLogin(uint64_t session, const string &username, int accountID, int64_t micros = -1)
+    {
+        record(session, "login " + username + " * " + to_string(accountID), micros);
+    }
+
+    // Records a line for a prompt session when a recording is running
+    static void note(uint64_t session, const string &line)
+    {
+        if (active)
+        {
+            active->record(session, line);
+        }
+    }
+
+    ~SessionRecorder()
+    {
+        if (active == this)
+        {
+            active = nullptr;
+        }
+        fclose(file);
+    }
+};
+
+// Runs scripted commands without prompts, screen clears or per-line flushes, one command per line:
+//   open <checking|savings> <username> <password> [overdraft limit or interest rate]
+//   deposit <account ID> <amount>
+//   withdraw <account ID> <amount>
+//   balance <account ID> [<YYYY-MM-DD>]
+//   transactions <account ID> [<YYYY-MM-DD> <YYYY-MM-DD>]
+//   statement <account ID> [text|csv|fixed] [<page> [<page size>]]
+//   close <account ID>
+//   totals <account ID> [<YYYY-MM-DD> <YYYY-MM-DD>]
+//   verify <account ID>
+//   transfer <from account ID> <to account ID> <amount>
+//   accrue [<YYYY-MM-DD>]
+//   order <account ID> deposit|withdraw <amount> | transfer <account ID> <amount>, then monthly <day> | every <days> [<YYYY-MM-DD>]
+//   orders <account ID>
+//   cancel <account ID> <order ID>
+//   pay [<YYYY-MM-DD>] [skip]
+//   import <file>
+//   export <file> [csv|binary]
+//   stats [json]
+// Blank lines and lines starting with # are skipped. Every command answers with one "ok" or "error" line,
+// transactions lists its rows first, orders one line per standing order
+class BatchEngine
+{
+private:
+    static const size_t FLUSH_BYTES = 1 << 16;
+    static const size_t MAX_ARGS = 8;
+
+    CustomerList &customers;
+    ostream *out;
+    Journal *journal;
+    string buffer;
+    SessionRecorder *recorder;
+    size_t lineNumber;
+    size_t executed;
+    size_t failed;
+
+    // Real numbers, like interest rates
+    static bool parseNumber(string_view text, double &value)
+    {
+        char copy[64];
+        if (text.empty() || text.size() >= sizeof(copy))
+            return false;
+        memcpy(copy, text.data(), text.size());
+        copy[text.size()] = '\0';
+        char *end = nullptr;
+        value = strtod(copy, &end);
+        return *end == '\0';
+    }
+
+    // Whole numbers only (IDs, counts, days), the entire word has to be one
+    template <typename T>
+    static bool parseInteger(string_view text, T &value)
+    {
+        const char *end = text.data() + text.size();
+        from_chars_result result = from_chars(text.data(), end, value);
+        return result.ec == errc() && result.ptr == end;
+    }
+
+    Account &lookup(string_view text)
+    {
+        int id;
+        Account *acc = parseInteger(text, id) ? customers.findAccount(id) : nullptr;
+        if (!acc)
+        {
+            throw runtime_error("No account with ID " + string(text) + ".");
+        }
+        return *acc;
+    }
+
+    void reply(const Account &acc)
+    {
+        buffer += "ok ";
+        buffer += to_string(acc.ID);
+        buffer += " balance ";
+        char amount[24];
+        buffer.append(amount, acc.getBalance().format(amount));
+        buffer += '\n';
+    }
+
+    void dispatch(const string_view *args, size_t count)
+    {
+        const string_view command = args[0];
+        if ((command == "deposit" || command == "withdraw") && count == 3)
+        {
+            Account &acc = lookup(args[1]);
+            Money amount;
+            if (!Money::parse(args[2], amount))
+            {
+                throw runtime_error("Invalid amount entered.");
+            }
+            if (command == "deposit")
+                acc.credit(amount);
+            else
+                acc.debit(amount);
+            reply(acc);
+        }
+        else if (command == "balance" && count == 3)
+        {
+            Account &acc = lookup(args[1]);
+            Money balance = acc.balanceAsOf(DateParser::parseTime(args[2], true));
+            char amount[24];
+            buffer += "ok " + to_string(acc.ID) + " balance ";
+            buffer.append(amount, balance.format(amount));
+            buffer += " as of ";
+            buffer.append(args[2].data(), args[2].size());
+            buffer += '\n';
+        }
+        else if (command == "balance" && count == 2)
+        {
+            reply(lookup(args[1]));
+        }
+        else if (command == "transfer" && count == 4)
+        {
+            Account &from = lookup(args[1]);
+            Account &to = lookup(args[2]);
+            Money amount;
+            if (!Money::parse(args[3], amount))
+            {
+                throw runtime_error("Invalid amount entered.");
+            }
+            Account::transfer(from, to, amount);
+            reply(from);
+        }
+        else if (command == "transactions" && (count == 2 || count == 4))
+        {
+            Account &acc = lookup(args[1]);
+            lock_guard<mutex> held(acc.guard);
+            StatementRenderer renderer(buffer, nullptr);
+            if (count == 4)
+            {
+                time_t startDate = DateParser::parseTime(args[2]);
+                time_t endDate = DateParser::parseTime(args[3]);
+                acc.transactions.renderRange(renderer, startDate, endDate);
+                char amount[24];
+                buffer += "ok " + to_string(acc.ID) + " opening ";
+                buffer.append(amount, acc.transactions.balanceAsOf(startDate - 1).format(amount));
+                buffer += " closing ";
+                buffer.append(amount, acc.transactions.balanceAsOf(endDate).format(amount));
+                buffer += " balance ";
+                buffer.append(amount, acc.getBalance().format(amount));
+                buffer += '\n';
+            }
+            else
+            {
+                acc.transactions.render(renderer);
+                reply(acc);
+            }
+        }
+        else if (command == "statement" && count >= 2 && count <= 5)
+        {
+            Account &acc = lookup(args[1]);
+            StatementRenderer::Format format = StatementRenderer::Format::TEXT;
+            size_t page = 0, pageSize = 50;
+            if ((count >= 3 && !StatementRenderer::parseFormat(args[2], format)) || (count >= 4 && (!parseInteger(args[3], page) || page < 1)) ||
+                (count == 5 && (!parseInteger(args[4], pageSize) || pageSize < 1)))
+            {
+                throw runtime_error("Usage: statement <account ID> [text|csv|fixed] [<page> [<page size>]]");
+            }
+            lock_guard<mutex> held(acc.guard);
+            StatementRenderer renderer(buffer, nullptr, format);
+            if (page >= 1)
+            {
+                renderer.page(page, pageSize);
+            }
+            renderer.header();
+            acc.transactions.render(renderer);
+            buffer += "ok " + to_string(acc.ID) + " rows " + to_string(renderer.rows());
+            if (page >= 1)
+            {
+                buffer += " page " + to_string(page) + " of " + to_string((renderer.rows() + pageSize - 1) / pageSize);
+            }
+            buffer += '\n';
+        }
+        else if (command == "totals" && (count == 2 || count == 4))
+        {
+            Account &acc = lookup(args[1]);
+            lock_guard<mutex> held(acc.guard);
+            char amount[24];
+            buffer += "ok " + to_string(acc.ID);
+            if (count == 4)
+            {
+                time_t startDate = DateParser::parseTime(args[2]);
+                time_t endDate = DateParser::parseTime(args[3]);
+                buffer += " net ";
+                buffer.append(amount, acc.transactions.totalInRange(startDate, endDate).format(amount));
+            }
+            else
+            {
+                buffer += " deposits ";
+                buffer.append(amount, acc.transactions.totalOfType(TransactionType::DEPOSIT).format(amount));
+                buffer += " withdrawals ";
+                buffer.append(amount, acc.transactions.totalOfType(TransactionType::WITHDRAW).format(amount));
+                buffer += " interest ";
+                buffer.append(amount, acc.transactions.totalOfType(TransactionType::INTEREST).format(amount));
+            }
+            buffer += '\n';
+        }
+        else if (command == "summary" && count == 2)
+        {
+            Account &acc = lookup(args[1]);
+            lock_guard<mutex> held(acc.guard);
+            const TransactionAnalytics &analytics = acc.transactions.analyze();
+            buffer += "ok " + to_string(acc.ID) + " transactions " + to_string(analytics.lifetime().count()) + ' ';
+            analytics.describe(buffer, analytics.lifetime(), LedgerClock::now());
+            buffer += '\n';
+        }
+        else if (command == "monthly" && (count == 2 || count == 3))
+        {
+            Account &acc = lookup(args[1]);
+            int only = count == 3 ? DateParser::parseMonth(args[2]) : 0;
+            lock_guard<mutex> held(acc.guard);
+            const TransactionAnalytics &analytics = acc.transactions.analyze();
+            time_t now = LedgerClock::now();
+            size_t shown = 0;
+            for (const TransactionAnalytics::Month &month : analytics.byMonth())
+            {
+                if (count == 3 && month.month != only)
+                    continue;
+                buffer += TransactionAnalytics::monthName(month.month);
+                buffer += ' ';
+                analytics.describe(buffer, month, now);
+                buffer += '\n';
+                shown++;
+            }
+            buffer += "ok " + to_string(acc.ID) + " months " + to_string(shown) + '\n';
+        }
+        else if (command == "top" && (count == 2 || count == 3))
+        {
+            Account &acc = lookup(args[1]);
+            size_t wanted = TransactionAnalytics::TOP;
+            if (count == 3 && (!parseInteger(args[2], wanted) || wanted < 1 || wanted > TransactionAnalytics::TOP))
+            {
+                throw runtime_error("Usage: top <account ID> [1-" + to_string(TransactionAnalytics::TOP) + "]");
+            }
+            lock_guard<mutex> held(acc.guard);
+            const TransactionAnalytics &analytics = acc.transactions.analyze();
+            StatementRenderer renderer(buffer, nullptr);
+            size_t shown = min(wanted, analytics.topSize());
+            for (size_t i = 0; i < shown; i++)
+            {
+                renderer.row(analytics.topRecords()[i]);
+            }
+            buffer += "ok " + to_string(acc.ID) + " top " + to_string(shown) + '\n';
+        }
+        else if (command == "verify" && count == 2)
+        {
+            Account &acc = lookup(args[1]);
+            if (!acc.verifyBalance())
+            {
+                throw runtime_error("History adds up to " + acc.transactions.total().toString() + " but the balance is " + acc.getBalance().toString() + ".");
+            }
+            reply(acc);
+        }
+        else if (command == "stats" && (count == 1 || (count == 2 && args[1] == "json")))
+        {
+            ostringstream report;
+            Metrics::report(report, customers, count == 2);
+            buffer += report.str();
+            buffer += "ok\n";
+        }
+        else if (command == "accrue" && (count == 1 || count == 2))
+        {
+            int64_t day = InterestAccrual::today();
+            if (count == 2)
+            {
+                day = DateParser::parseDay(args[1]);
+            }
+            if (day > InterestAccrual::today())
+            {
+                throw runtime_error("Interest can only be accrued up to today.");
+            }
+            InterestAccrual::Result result = InterestAccrual::run(customers, day, thread::hardware_concurrency());
+            char amount[24];
+            buffer += "ok accrued " + to_string(result.accounts) + " accounts interest ";
+            buffer.append(amount, result.total.format(amount));
+            buffer += '\n';
+        }
+        else if (command == "import" && count == 2)
+        {
+            HistoryImport::Result result = HistoryImport::run(string(args[1]), customers, thread::hardware_concurrency());
+            buffer += "ok imported " + to_string(result.rows) + " rows into " + to_string(result.accounts) + " accounts\n";
+        }
+        else if (command == "export" && (count == 2 || count == 3))
+        {
+            HistoryExport::Format format = HistoryExport::Format::CSV;
+            if (count == 3 && !HistoryExport::parseFormat(args[2], format))
+            {
+                throw runtime_error("Usage: export <file> [csv|binary]");
+            }
+            size_t rows = HistoryExport::run(string(args[1]), customers, format, thread::hardware_concurrency());
+            buffer += "ok exported " + to_string(rows) + " rows\n";
+        }
+        else if (command == "order" && count >= 6 && count <= 8)
+        {
+            Account &acc = lookup(args[1]);
+            StandingOrder::Kind kind = args[2] == "deposit" ? StandingOrder::DEPOSIT : args[2] == "withdraw" ? StandingOrder::WITHDRAW : StandingOrder::TRANSFER;
+            size_t at = kind == StandingOrder::TRANSFER ? 4 : 3;
+            Money amount;
+            long n;
+            if ((kind == StandingOrder::TRANSFER && args[2] != "transfer") || count < at + 3 || count > at + 4 || !Money::parse(args[at], amount) ||
+                (args[at + 1] != "monthly" && args[at + 1] != "every") || !parseInteger(args[at + 2], n))
+            {
+                throw runtime_error("Usage: order <account ID> deposit|withdraw <amount> | transfer <account ID> <amount>, "
+                                    "then monthly <day> | every <days>, then optionally the first <YYYY-MM-DD>");
+            }
+            int32_t target = kind == StandingOrder::TRANSFER ? lookup(args[3]).ID : 0;
+            bool monthly = args[at + 1] == "monthly";
+            int64_t first = count == at + 4 ? DateParser::parseDay(args[at + 3]) : -1;
+            StandingOrder order = StandingOrders::make(kind, acc.ID, target, amount, monthly ? 0 : n, monthly ? n : 0, first);
+            lock_guard<mutex> held(customers.orders.lock);
+            order.id = customers.orders.place(order);
+            buffer += "ok order " + to_string(order.id) + " " + order.describe() + "\n";
+        }
+        else if (command == "orders" && count == 2)
+        {
+            Account &acc = lookup(args[1]);
+            lock_guard<mutex> held(customers.orders.lock);
+            vector<StandingOrder> mine;
+            customers.orders.forEach([&](const StandingOrder &order)
+                                     { if (order.account == acc.ID) mine.push_back(order); });
+            sort(mine.begin(), mine.end(), [](const StandingOrder &a, const StandingOrder &b)
+                 { return a.id < b.id; });
+            for (const StandingOrder &order : mine)
+            {
+                buffer += "order " + to_string(order.id) + " " + order.describe() + "\n";
+            }
+            buffer += "ok " + to_string(acc.ID) + " orders " + to_string(mine.size()) + "\n";
+        }
+        else if (command == "cancel" && count == 3)
+        {
+            Account &acc = lookup(args[1]);
+            uint64_t id;
+            lock_guard<mutex> held(customers.orders.lock);
+            const StandingOrder *order = parseInteger(args[2], id) ? customers.orders.find(id) : nullptr;
+            if (!order || order->account != acc.ID)
+            {
+                throw runtime_error("Account " + to_string(acc.ID) + " has no standing order " + string(args[2]) + ".");
+            }
+            customers.orders.cancel(order->id);
+            buffer += "ok order " + string(args[2]) + " cancelled\n";
+        }
+        else if (command == "pay" && count <= 3)
+        {
+            int64_t day = InterestAccrual::today();
+            bool catchUp = true;
+            for (size_t i = 1; i < count; i++)
+            {
+                if (args[i] == "skip")
+                    catchUp = false;
+                else
+                    day = DateParser::parseDay(args[i]);
+            }
+            if (day > InterestAccrual::today())
+            {
+                throw runtime_error("Standing orders can only be paid up to today.");
+            }
+            StandingOrderRun::Result result = StandingOrderRun::run(customers, day, thread::hardware_concurrency(), catchUp);
+            char amount[24];
+            buffer += "ok paid " + to_string(result.paid) + " failed " + to_string(result.failed) + " skipped " + to_string(result.skipped) +
+                      " dropped " + to_string(result.dropped) + " total ";
+            buffer.append(amount, result.total.format(amount));
+            buffer += '\n';
+        }
+        else if (command == "open" && (count == 4 || count == 5))
+        {
+            Money overdraftLimit = overdraftLimit_V<Money>;
+            double interestRate = 0.05;
+            bool checking = args[1] == "checking";
+            if (!checking && args[1] != "savings")
+                throw runtime_error("Account type must be checking or savings.");
+            if (count == 5 && !(checking ? Money::parse(args[4], overdraftLimit) : parseNumber(args[4], interestRate)))
+                throw runtime_error("Invalid account terms.");
+            Account *acc;
+            if (checking)
+                acc = customers.create<CheckingAccount>(string(args[2]), PasswordHash::make(args[3]), overdraftLimit);
+            else
+                acc = customers.create<SavingsAccount>(string(args[2]), PasswordHash::make(args[3]), interestRate);
+            customers.addCustomer(acc);
+            reply(*acc);
+        }
+        else if (command == "close" && count == 2)
+        {
+            Account &acc = lookup(args[1]);
+            if (acc.getBalance() > Money())
+                throw runtime_error("Cannot close an account that still holds money.");
+            if (acc.getBalance() < Money())
+                throw runtime_error("Cannot close an account with outstanding debts.");
+            buffer += "ok " + to_string(acc.ID) + " closed\n";
+            customers.removeCustomer(&acc);
+        }
+        else
+        {
+            throw runtime_error("Unknown command or wrong number of arguments.");
+        }
+    }
+
+public:
+    // When a journal is given, answers are only written out once the journal has their records on disk
+    // Without an output stream answers just collect until takeOutput is called
+    BatchEngine(CustomerList &customerList, ostream *output, Journal *commitJournal = nullptr)
+        : customers(customerList), out(output), journal(commitJournal), recorder(nullptr), lineNumber(0), executed(0), failed(0) {}
+
+    // Every command run from now on is written to the recorder as session 0
+    void recordTo(SessionRecorder *sessionRecorder) { recorder = sessionRecorder; }
+
+    // Runs a single command line, returns false if it failed
+    bool execute(const string &line)
+    {
+        lineNumber++;
+        string_view args[MAX_ARGS];
+        size_t count = 0;
+        size_t pos = 0;
+        while (count < MAX_ARGS)
+        {
+            pos = line.find_first_not_of(" \t\r", pos);
+            if (pos == string::npos)
+                break;
+            size_t end = line.find_first_of(" \t\r", pos);
+            if (end == string::npos)
+                end = line.size();
+            args[count++] = string_view(line).substr(pos, end - pos);
+            pos = end;
+        }
+        if (count == 0 || args[0][0] == '#')
+        {
+            return true;
+        }
+        if (recorder)
+        {
+            recorder->record(0, line);
+        }
+
+        executed++;
+        bool ok = true;
+        try
+        {
+            ZBANK_PROBE(Metrics::probeFor(args[0]));
+            dispatch(args, count);
+        }
+        catch (const exception &ex)
+        {
+            failed++;
+            ok = false;
+            buffer += out ? "error line " + to_string(lineNumber) + ": " : "error: ";
+            buffer += ex.what();
+            buffer += '\n';
+        }
+        if (out && buffer.size() >= FLUSH_BYTES)
+        {
+            flush();
+        }
+        return ok;
+    }
+
+    // Runs every line of in, returns how many commands failed
+    size_t run(istream &in)
+    {
+        string line;
+        while (getline(in, line))
+        {
+            execute(line);
+        }
+        flush();
+        return failed;
+    }
+
+    void flush()
+    {
+        if (journal)
+        {
+            journal->sync();
+        }
+        if (out)
+        {
+            out->write(buffer.data(), streamsize(buffer.size()));
+            out->flush();
+            buffer.clear();
+        }
+    }
+
+    // Hands over the answers collected so far
+    void takeOutput(string &into)
+    {
+        into.swap(buffer);
+        buffer.clear();
+    }
+
+    size_t commandsExecuted() const { return executed; }
+    size_t commandsFailed() const { return failed; }
+};
+
+// Tokens handed out at login, so a client coming back with resume <token> skips the password check
+// A token lasts an hour from its last use and goes when its account closes, the least recently used go first when full
+class SessionTokens
+{
+private:
+    using Clock = chrono::steady_clock;
+    static const size_t CAPACITY = 1 << 16;
+
+    struct Entry
+    {
+        int accountID;
+        Clock::time_point used;
+    };
+
+    mutex lock;
+    unordered_map<string, Entry> entries;
+    Clock::duration lifetime;
+
+    // Makes room for one more, the lock has to be held
+    void evict(Clock::time_point now)
+    {
+        for (auto it = entries.begin(); it != entries.end();)
+        {
+            it = now - it->second.used > lifetime ? entries.erase(it) : next(it);
+        }
+        if (entries.size() >= CAPACITY)
+        {
+            entries.erase(min_element(entries.begin(), entries.end(), [](const auto &a, const auto &b)
+                                      { return a.second.used < b.second.used; }));
+        }
+    }
+
+public:
+    explicit SessionTokens(Clock::duration tokenLifetime = chrono::hours(1)) : lifetime(tokenLifetime) {}
+
+    string issue(int accountID)
+    {
+        thread_local random_device entropy;
+        char token[33];
+        snprintf(token, sizeof(token), "%08x%08x%08x%08x", entropy(), entropy(), entropy(), entropy());
+        Clock::time_point now = Clock::now();
+        lock_guard<mutex> held(lock);
+        if (entries.size() >= CAPACITY)
+        {
+            evict(now);
+        }
+        entries[token] = {accountID, now};
+        return token;
+    }
+
+    // The account a token was issued for, 0 if it is unknown or expired
+    int redeem(const string &token)
+    {
+        Clock::time_point now = Clock::now();
+        lock_guard<mutex> held(lock);
+        auto found = entries.find(token);
+        if (found == entries.end())
+        {
+            return 0;
+        }
+        if (now - found->second.used > lifetime)
+        {
+            entries.erase(found);
+            return 0;
+        }
+        found->second.used = now;
+        return found->second.accountID;
+    }
+
+    void revoke(int accountID)
+    {
+        lock_guard<mutex> held(lock);
+        for (auto it = entries.begin(); it != entries.end();)
+        {
+            it = it->second.accountID == accountID ? entries.erase(it) : next(it);
+        }
+    }
+
+    size_t size()
+    {
+        lock_guard<mutex> held(lock);
+        return entries.size();
+    }
+};
+
+// The account username and password log in to, 0 if none. Hashes are checked without holding the customer guard
+int checkLogin(CustomerList &customers, const string &username, const string &password)
+{
+    ZBANK_PROBE(Metrics::LOGIN);
+    vector<pair<int, string>> candidates;
+    {
+        shared_lock<shared_mutex> reading(customers.guard);
+        for (Account *acc : customers.findAccounts(username))
+        {
+            candidates.emplace_back(acc->ID, acc->password);
+        }
+    }
+    for (const auto &[accountID, stored] : candidates)
+    {
+        if (PasswordHash::verify(stored, password))
+        {
+            return accountID;
+        }
+    }
+    return 0;
+}
+
+// Checks logins on threads of its own, so a password hash never holds up other sessions' commands
+// At most capacity logins wait for a thread, submit turns away the rest. Finished checks go on a
+// completion queue, notify is called after each one and the owner drains the queue when it suits it
+template <typename Tag>
+class LoginPool
+{
+public:
+    struct Completion
+    {
+        Tag tag;
+        int accountID;
+    };
+
+private:
+    struct Request
+    {
+        Tag tag;
+        string username;
+        string password;
+    };
+
+    CustomerList &customers;
+    size_t capacity;
+    function<void()> notify;
+
+    mutex lock;
+    condition_variable available;
+    deque<Request> requests;
+    bool stopping;
+
+    mutex doneLock;
+    vector<Completion> done;
+    vector<thread> threads;
+
+    void work()
+    {
+        while (true)
+        {
+            Request request;
+            {
+                unique_lock<mutex> held(lock);
+                available.wait(held, [&]
+                               { return stopping || !requests.empty(); });
+                if (stopping)
+                {
+                    return;
+                }
+                request = move(requests.front());
+                requests.pop_front();
+            }
+            int accountID = checkLogin(customers, request.username, request.password);
+            {
+                lock_guard<mutex> held(doneLock);
+                done.push_back({move(request.tag), accountID});
+            }
+            notify();
+        }
+    }
+
+public:
+    LoginPool(CustomerList &customerList, size_t threadCount, size_t queueCapacity, function<void()> onCompletion)
+        : customers(customerList), capacity(queueCapacity), notify(move(onCompletion)), stopping(false)
+    {
+        for (size_t i = 0; i < max<size_t>(threadCount, 1); i++)
+        {
+            threads.emplace_back(&LoginPool::work, this);
+        }
+    }
+    LoginPool(const LoginPool &) = delete;
+    LoginPool &operator=(const LoginPool &) = delete;
+
+    // Logins still waiting are dropped without a completion
+    ~LoginPool()
+    {
+        {
+            lock_guard<mutex> held(lock);
+            stopping = true;
+        }
+        available.notify_all();
+        for (thread &t : threads)
+        {
+            t.join();
+        }
+    }
+
+    // Queues a login, false when capacity logins are already waiting
+    bool submit(Tag tag, string username, string password)
+    {
+        {
+            lock_guard<mutex> held(lock);
+            if (requests.size() >= capacity)
+            {
+                return false;
+            }
+            requests.push_back({move(tag), move(username), move(password)});
+        }
+        available.notify_one();
+        return true;
+    }
+
+    // Moves every finished check into into
+    void drain(vector<Completion> &into)
+    {
+        lock_guard<mutex> held(doneLock);
+        move(done.begin(), done.end(), back_inserter(into));
+        done.clear();
+    }
+};
+
+// One client's conversation with the bank: log in first, then account commands without the account ID, answered
+// the way batch mode answers. The server runs one for every connection and a replay one for every recorded session
+//   login <username> <password> | resume <token>
+//   balance | deposit <amount> | withdraw <amount> | transfer <account ID> <amount>
+//   transactions [<YYYY-MM-DD> <YYYY-MM-DD>] | statement [text|csv|fixed] [<page> [<page size>]]
+//   totals [<YYYY-MM-DD> <YYYY-MM-DD>] | summary | monthly [<YYYY-MM>] | top [<n>]
+//   order deposit|withdraw <amount> | transfer <account ID> <amount>, monthly <day> | every <days> [<YYYY-MM-DD>]
+//   orders | cancel <order ID> | verify | close | stats [json] | help | quit
+class Session
+{
+private:
+    CustomerList &customers;
+    Journal *journal;
+    SessionTokens *tokens;
+    int accountID;
+    bool finished;
+
+public:
+    // Changes are only answered once the journal has them on disk, when there is a journal
+    // Logins are given a token for resume when there are tokens
+    Session(CustomerList &customerList, Journal *commitJournal = nullptr, SessionTokens *sessionTokens = nullptr)
+        : customers(customerList), journal(commitJournal), tokens(sessionTokens), accountID(0), finished(false) {}
+
+    static string help()
+    {
+        return "login <username> <password> | resume <token> | balance | deposit <amount> | withdraw <amount> | transfer <account ID> <amount> | "
+               "transactions [<YYYY-MM-DD> <YYYY-MM-DD>] | statement [text|csv|fixed] [<page> [<page size>]] | "
+               "totals [<YYYY-MM-DD> <YYYY-MM-DD>] | summary | monthly [<YYYY-MM>] | top [<n>] | "
+               "order deposit|withdraw <amount> | transfer <account ID> <amount> monthly <day> | every <days> [<YYYY-MM-DD>] | "
+               "orders | cancel <order ID> | verify | close | stats [json] | quit\nok\n";
+    }
+
+    // Account commands that change nothing, so they need no journal sync
+    static bool readsOnly(const string &command)
+    {
+        return command == "balance" || command == "transactions" || command == "statement" || command == "totals" || command == "verify" ||
+               command == "summary" || command == "monthly" || command == "top" || command == "orders";
+    }
+
+    // Set once the client has said quit
+    bool quit() const { return finished; }
+
+    // The account logged in to, 0 when there is none
+    int account() const { return accountID; }
+
+    static bool isLogin(const string &line)
+    {
+        size_t from = line.find_first_not_of(" \t");
+        return from != string::npos && line.compare(from, 6, "login ") == 0;
+    }
+
+    // Logs in to accountID, or out again when it is 0 because the password was wrong, and returns the answer
+    string loggedIn(int loginID)
+    {
+        accountID = loginID;
+        if (accountID == 0)
+        {
+            return "error: Incorrect username or password.\n";
+        }
+        string reply = "ok logged in to account " + to_string(accountID);
+        if (tokens)
+        {
+            reply += " token " + tokens->issue(accountID);
+        }
+        return reply + "\n";
+    }
+
+    // Runs one command and returns the answer, engine is the caller's own
+    string handle(BatchEngine &engine, const string &line)
+    {
+        istringstream words(line);
+        string command, rest;
+        words >> command;
+        getline(words, rest);
+        string reply;
+
+        if (command.empty())
+        {
+            return "";
+        }
+        if (command == "login")
+        {
+            istringstream credentials(rest);
+            string username, password;
+            credentials >> username >> password;
+            return loggedIn(checkLogin(customers, username, password));
+        }
+        if (command == "resume")
+        {
+            istringstream words(rest);
+            string token;
+            words >> token;
+            int resumed = tokens ? tokens->redeem(token) : 0;
+            shared_lock<shared_mutex> reading(customers.guard);
+            accountID = resumed && customers.findAccount(resumed) ? resumed : 0;
+            return accountID ? "ok resumed account " + to_string(accountID) + "\n" : "error: Unknown or expired token.\n";
+        }
+        if (command == "quit")
+        {
+            finished = true;
+            return "ok bye\n";
+        }
+        if (command == "help")
+        {
+            return help();
+        }
+        if (command == "stats")
+        {
+            shared_lock<shared_mutex> reading(customers.guard);
+            engine.execute("stats" + rest);
+            engine.takeOutput(reply);
+            return reply;
+        }
+        if (accountID == 0)
+        {
+            return "error: Please log in first.\n";
+        }
+        if (!readsOnly(command) && command != "deposit" && command != "withdraw" && command != "transfer" && command != "close" &&
+            command != "order" && command != "cancel")
+        {
+            return "error: Unknown command, try help.\n";
+        }
+
+        string scripted = command + " " + to_string(accountID) + rest;
+        if (command == "close")
+        {
+            unique_lock<shared_mutex> writing(customers.guard);
+            engine.execute(scripted);
+            engine.takeOutput(reply);
+            if (reply.compare(0, 2, "ok") == 0)
+            {
+                if (tokens)
+                {
+                    tokens->revoke(accountID);
+                }
+                accountID = 0;
+            }
+        }
+        else
+        {
+            shared_lock<shared_mutex> reading(customers.guard);
+            if (!customers.findAccount(accountID))
+            {
+                accountID = 0;
+                return "error: This account has been closed.\n";
+            }
+            engine.execute(scripted);
+            engine.takeOutput(reply);
+        }
+        // answer only once the change is durable, sessions committing together share the fsync
+        if (journal && !readsOnly(command))
+        {
+            journal->syncUpTo(journal->lastAppended());
+        }
+        return reply;
+    }
+};
+
+// Plays a recording back against the ledger and reports how fast the bank answered it. Each session keeps its order
+// and runs on one worker. Open loop releases every command at its recorded time divided by the speed and measures
+// latency from then, so a bank falling behind shows up in the tail. Closed loop sends each session's commands back
+// to back. Account changes are stamped with the recorded time, read from a ManualClock. Logins go to the account
+// the recording names, so their latency leaves out the password check
+class Replay
+{
+public:
+    struct Options
+    {
+        double speed = 1;
+        bool closed = false;
+        size_t workers = 1;
+    };
+
+private:
+    using Clock = chrono::steady_clock;
+
+    struct Command
+    {
+        int64_t micros;
+        uint64_t session;
+        string line;
+    };
+
+    // What one worker saw, merged once every worker is done
+    struct Outcome
+    {
+        unordered_map<string, vector<uint64_t>> nanos;
+        uint64_t digest = 0;
+        size_t errors = 0;
+    };
+
+    vector<Command> commands;
+    time_t started;
+    size_t sessionCount;
+
+    static string command(const string &line)
+    {
+        size_t from = line.find_first_not_of(" \t");
+        if (from == string::npos)
+            return "";
+        return line.substr(from, line.find_first_of(" \t\r", from) - from);
+    }
+
+    // FNV-1a, so the same replies in the same order give the same digest on every run
+    static uint64_t fold(uint64_t digest, const string &reply)
+    {
+        for (char c : reply)
+        {
+            digest = (digest ^ uint8_t(c)) * 1099511628211ull;
+        }
+        return digest;
+    }
+
+    // The account a recorded login reached. Recordings name it in place of the password, so a replay logs in
+    // without the password check. Recordings from before that still carry the password, which is checked as usual
+    static int loginOf(CustomerList &customers, const string &line)
+    {
+        istringstream words(line);
+        string command, username, password;
+        int accountID = 0;
+        words >> command >> username >> password;
+        if (password != "*")
+        {
+            return checkLogin(customers, username, password);
+        }
+        words >> accountID;
+        ZBANK_PROBE(Metrics::LOGIN);
+        shared_lock<shared_mutex> reading(customers.guard);
+        Account *acc = customers.findAccount(accountID);
+        return acc && acc->username == username ? accountID : 0;
+    }
+
+    static double quantile(const vector<uint64_t> &sorted, double q)
+    {
+        return sorted.empty() ? 0.0 : double(sorted[min(sorted.size() - 1, size_t(q * double(sorted.size())))]) / 1000;
+    }
+
+    void work(CustomerList &customers, const Options &options, ManualClock &clock, Clock::time_point begin, const vector<size_t> &mine, Outcome &outcome) const
+    {
+        BatchEngine engine(customers, nullptr);
+        unordered_map<uint64_t, Session> sessions;
+        unordered_map<uint64_t, uint64_t> digests;
+        for (size_t index : mine)
+        {
+            const Command &next = commands[index];
+            Clock::time_point due = Clock::now();
+            if (!options.closed)
+            {
+                due = begin + chrono::nanoseconds(int64_t(double(next.micros) * 1000 / options.speed));
+                this_thread::sleep_until(due);
+            }
+            clock.advanceTo(started + time_t(next.micros / 1000000));
+
+            string reply;
+            try
+            {
+                if (next.session == 0)
+                {
+                    // batch commands open and close accounts by ID, so they run alone
+                    unique_lock<shared_mutex> writing(customers.guard);
+                    engine.execute(next.line);
+                    engine.takeOutput(reply);
+                }
+                else if (Session::isLogin(next.line))
+                {
+                    reply = sessions.try_emplace(next.session, customers).first->second.loggedIn(loginOf(customers, next.line));
+                }
+                else
+                {
+                    reply = sessions.try_emplace(next.session, customers).first->second.handle(engine, next.line);
+                }
+            }
+            catch (const exception &ex)
+            {
+                reply = string("error: ") + ex.what() + "\n";
+            }
+            uint64_t took = uint64_t(chrono::duration_cast<chrono::nanoseconds>(Clock::now() - due).count());
+
+            outcome.nanos[command(next.line)].push_back(took);
+            if (reply.compare(0, 5, "error") == 0)
+            {
+                outcome.errors++;
+            }
+            auto digest = digests.try_emplace(next.session, 14695981039346656037ull).first;
+            digest->second = fold(digest->second, reply);
+        }
+        // sessions are summed, so the digest doesn't depend on which worker ran which session
+        for (const auto &[session, digest] : digests)
+        {
+            outcome.digest += digest;
+        }
+    }
+
+public:
+    explicit Replay(const string &path) : started(0), sessionCount(0)
+    {
+        ifstream in(path);
+        string line;
+        if (!in || !getline(in, line))
+        {
+            throw runtime_error("Could not read recording '" + path + "'.");
+        }
+        long long start;
+        if (sscanf(line.c_str(), "# zbank recording 1 start %lld", &start) != 1)
+        {
+            throw runtime_error("'" + path + "' is not a zbank recording.");
+        }
+        started = time_t(start);
+
+        unordered_map<uint64_t, bool> seen;
+        size_t lineNumber = 1;
+        while (getline(in, line))
+        {
+            lineNumber++;
+            if (line.empty())
+                continue;
+            Command next;
+            const char *end = line.data() + line.size();
+            auto [afterTime, timeError] = from_chars(line.data(), end, next.micros);
+            auto [afterSession, sessionError] = from_chars(afterTime + (afterTime < end), end, next.session);
+            if (timeError != errc() || sessionError != errc() || *afterTime != ' ' || next.micros < 0)
+            {
+                throw runtime_error("Line " + to_string(lineNumber) + " of '" + path + "' is not a recorded command.");
+            }
+            next.line.assign(afterSession + (afterSession < end), end);
+            seen[next.session] = true;
+            commands.push_back(move(next));
+        }
+        sessionCount = seen.size();
+        // sessions recording at the same moment can reach the file slightly out of order
+        stable_sort(commands.begin(), commands.end(), [](const Command &a, const Command &b)
+                    { return a.micros < b.micros; });
+    }
+
+    size_t size() const { return commands.size(); }
+
+    // Runs every command and writes the report to out, returns how many commands answered with an error
+    size_t run(CustomerList &customers, const Options &options, ostream &out) const
+    {
+        if (!(options.speed > 0))
+        {
+            throw runtime_error("Replay speed has to be more than zero.");
+        }
+        size_t workerCount = max<size_t>(1, options.workers);
+        vector<vector<size_t>> assigned(workerCount);
+        unordered_map<uint64_t, size_t> owner;
+        for (size_t i = 0; i < commands.size(); i++)
+        {
+            auto slot = owner.try_emplace(commands[i].session, owner.size() % workerCount).first;
+            assigned[slot->second].push_back(i);
+        }
+
+        ManualClock clock(started);
+        LedgerClock::install(&clock);
+        vector<Outcome> outcomes(workerCount);
+        Clock::time_point begin = Clock::now();
+        {
+            vector<thread> workers;
+            for (size_t w = 0; w < workerCount; w++)
+            {
+                workers.emplace_back([&, w]
+                                     { work(customers, options, clock, begin, assigned[w], outcomes[w]); });
+            }
+            for (thread &worker : workers)
+            {
+                worker.join();
+            }
+        }
+        double seconds = chrono::duration<double>(Clock::now() - begin).count();
+        LedgerClock::install(nullptr);
+
+        map<string, vector<uint64_t>> byCommand;
+        vector<uint64_t> all;
+        uint64_t digest = 0;
+        size_t errors = 0;
+        for (Outcome &outcome : outcomes)
+        {
+            for (auto &[name, nanos] : outcome.nanos)
+            {
+                vector<uint64_t> &into = byCommand[name];
+                into.insert(into.end(), nanos.begin(), nanos.end());
+                all.insert(all.end(), nanos.begin(), nanos.end());
+            }
+            digest += outcome.digest;
+            errors += outcome.errors;
+        }
+
+        out << "Replayed " << commands.size() << " commands from " << sessionCount << " sessions in " << fixed << setprecision(2) << seconds << " s ("
+            << setprecision(0) << double(commands.size()) / max(seconds, 1e-9) << " commands/sec), ";
+        if (options.closed)
+            out << "closed loop";
+        else
+            out << "open loop at " << setprecision(2) << options.speed << "x";
+        out << " on " << workerCount << " workers, " << errors << " errors" << endl;
+        out << "latencies in microseconds" << (options.closed ? "" : ", from when each command was due") << endl;
+        out << "  " << left << setw(14) << "command" << right << setw(10) << "count" << setw(10) << "p50" << setw(10) << "p90" << setw(10) << "p99"
+            << setw(10) << "p99.9" << setw(12) << "max" << endl;
+        auto row = [&](const string &name, vector<uint64_t> &nanos)
+        {
+            sort(nanos.begin(), nanos.end());
+            out << "  " << left << setw(14) << name << right << setw(10) << nanos.size() << setprecision(2) << setw(10) << quantile(nanos, 0.5)
+                << setw(10) << quantile(nanos, 0.9) << setw(10) << quantile(nanos, 0.99) << setw(10) << quantile(nanos, 0.999) << setw(12)
+                << (nanos.empty() ? 0.0 : double(nanos.back()) / 1000) << endl;
+        };
+        row("all", all);
+        for (auto &[name, nanos] : byCommand)
+        {
+            row(name, nanos);
+        }
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(digest));
+        out << "replies digest " << hex << endl;
+        return errors;
+    }
+};
+
+#ifdef __linux__
+// Multi-session front end: an epoll loop reads command lines from many TCP or unix socket clients and
+// hands them to a pool of workers. Commands run in parallel, the accounts keep themselves consistent,
+// and each connection's commands run in the order sent. One command per line, each connection is a Session
+// Passwords are checked on a LoginPool, the connection waits for the answer while the workers move on
+class Server
+{
+private:
+    static const size_t MAX_LINE = 1 << 16;
+    // lines one worker runs for a connection before giving others a turn
+    static const int FAIRNESS = 16;
+    // logins waiting for a password check before more are turned away
+    static constexpr size_t LOGIN_QUEUE = 1024;
+
+    struct Connection
+    {
+        int fd;
+        // only touched by the event loop
+        string input;
+        // only touched by the worker currently running this connection
+        Session session;
+        uint64_t recorded = 0;
+        // a login being checked, recorded with the account it reached once that is known
+        string loginName;
+        int64_t loginArrived = 0;
+
+        mutex guard;
+        deque<string> pending;
+        string output;
+        bool scheduled = false;
+        bool closing = false;
+        // a login is on the LoginPool, nothing else runs until it is answered
+        bool waiting = false;
+
+        Connection(int socket, CustomerList &customers, Journal *journal, SessionTokens *tokens) : fd(socket), session(customers, journal, tokens) {}
+        ~Connection() { close(fd); }
+    };
+
+    CustomerList &customers;
+    Journal *journal;
+    SessionRecorder *recorder;
+    int listenFd;
+    int epollFd;
+    string unixPath;
+    unordered_map<int, shared_ptr<Connection>> connections;
+
+    SessionTokens tokens;
+    size_t loginThreads;
+    unique_ptr<LoginPool<shared_ptr<Connection>>> logins;
+    // written by the LoginPool when a check is done, wakes the event loop
+    int completionFd;
+    vector<LoginPool<shared_ptr<Connection>>::Completion> completed;
+
+    vector<thread> workers;
+    mutex queueGuard;
+    condition_variable queueReady;
+    deque<shared_ptr<Connection>> ready;
+    atomic<bool> stopping;
+    atomic<uint64_t> commands;
+
+    static void setNonBlocking(int fd)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    void watch(int fd, uint32_t events, bool add)
+    {
+        epoll_event event = {};
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event);
+    }
+
+    // Sends whatever output is waiting, asking the loop for EPOLLOUT if the socket is full
+    // The connection's guard has to be held
+    void sendOutput(Connection &conn)
+    {
+        while (!conn.output.empty())
+        {
+            ssize_t sent = send(conn.fd, conn.output.data(), conn.output.size(), MSG_NOSIGNAL);
+            if (sent < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    watch(conn.fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP, false);
+                    return;
+                }
+                conn.output.clear();
+                break;
+            }
+            conn.output.erase(0, size_t(sent));
+        }
+        if (conn.closing)
+        {
+            shutdown(conn.fd, SHUT_RDWR);
+        }
+    }
+
+    void schedule(const shared_ptr<Connection> &conn)
+    {
+        {
+            lock_guard<mutex> held(queueGuard);
+            ready.push_back(conn);
+        }
+        queueReady.notify_one();
+    }
+
+    void drop(int fd)
+    {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        connections.erase(fd);
+    }
+
+    void acceptClients()
+    {
+        while (true)
+        {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0)
+            {
+                return;
+            }
+            setNonBlocking(fd);
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            connections[fd] = make_shared<Connection>(fd, customers, journal, &tokens);
+            watch(fd, EPOLLIN | EPOLLRDHUP, true);
+        }
+    }
+
+    // Reads what the client sent and queues every complete line, returns false once the client is gone
+    bool readClient(const shared_ptr<Connection> &conn)
+    {
+        char chunk[4096];
+        bool open = true;
+        while (true)
+        {
+            ssize_t got = recv(conn->fd, chunk, sizeof(chunk), 0);
+            if (got > 0)
+            {
+                conn->input.append(chunk, size_t(got));
+                continue;
+            }
+            if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            {
+                open = false;
+            }
+            break;
+        }
+
+        size_t start = 0, newline;
+        bool queued = false;
+        {
+            lock_guard<mutex> held(conn->guard);
+            while ((newline = conn->input.find('\n', start)) != string::npos)
+            {
+                conn->pending.emplace_back(conn->input, start, newline - start);
+                start = newline + 1;
+                queued = true;
+            }
+            if (queued && !conn->scheduled && !conn->waiting)
+            {
+                conn->scheduled = true;
+            }
+            else
+            {
+                queued = false;
+            }
+        }
+        conn->input.erase(0, start);
+        if (queued)
+        {
+            schedule(conn);
+        }
+        return open && conn->input.size() <= MAX_LINE;
+    }
+
+    // Hands a login to the pool and parks the connection, false if the pool is full and the worker has to answer
+    bool submitLogin(const shared_ptr<Connection> &conn, const string &line)
+    {
+        istringstream words(line);
+        string command, username, password;
+        words >> command >> username >> password;
+        {
+            lock_guard<mutex> held(conn->guard);
+            conn->waiting = true;
+            conn->scheduled = false;
+        }
+        if (logins->submit(conn, move(username), move(password)))
+        {
+            return true;
+        }
+        lock_guard<mutex> held(conn->guard);
+        conn->waiting = false;
+        conn->scheduled = true;
+        return false;
+    }
+
+    // Answers the logins the pool has checked and lets their connections carry on
+    void finishLogins()
+    {
+        uint64_t signalled;
+        while (read(completionFd, &signalled, sizeof(signalled)) > 0)
+        {
+        }
+        completed.clear();
+        logins->drain(completed);
+        for (auto &done : completed)
+        {
+            const shared_ptr<Connection> &conn = done.tag;
+            // no worker has the session while it waits
+            string reply = conn->session.loggedIn(done.accountID);
+            if (recorder)
+            {
+                recorder->recordLogin(conn->recorded, conn->loginName, done.accountID, conn->loginArrived);
+            }
+            bool more;
+            {
+                lock_guard<mutex> held(conn->guard);
+                conn->waiting = false;
+                conn->output += reply;
+                sendOutput(*conn);
+                more = !conn->pending.empty() && !conn->closing;
+                conn->scheduled = more;
+            }
+            if (more)
+            {
+                schedule(conn);
+            }
+        }
+    }
+
+    void work()
+    {
+        BatchEngine engine(customers, nullptr);
+        while (true)
+        {
+            shared_ptr<Connection> conn;
+            {
+                unique_lock<mutex> held(queueGuard);
+                queueReady.wait(held, [&]
+                                { return stopping || !ready.empty(); });
+                if (ready.empty())
+                {
+                    return;
+                }
+                conn = ready.front();
+                ready.pop_front();
+            }
+            for (int handled = 0;; handled++)
+            {
+                string line;
+                {
+                    lock_guard<mutex> held(conn->guard);
+                    if (conn->pending.empty() || conn->closing)
+                    {
+                        conn->scheduled = false;
+                        break;
+                    }
+                    if (handled == FAIRNESS)
+                    {
+                        schedule(conn);
+                        break;
+                    }
+                    line = move(conn->pending.front());
+                    conn->pending.pop_front();
+                }
+                bool login = Session::isLogin(line);
+                if (recorder)
+                {
+                    if (!conn->recorded)
+                    {
+                        conn->recorded = recorder->nextSession();
+                    }
+                    if (login)
+                    {
+                        istringstream words(line);
+                        string command;
+                        words >> command >> conn->loginName;
+                        conn->loginArrived = recorder->elapsed();
+                    }
+                    else
+                    {
+                        recorder->record(conn->recorded, line);
+                    }
+                }
+                string reply;
+                if (logins && login)
+                {
+                    commands++;
+                    if (submitLogin(conn, line))
+                    {
+                        break;
+                    }
+                    reply = "error: Too many logins waiting, try again.\n";
+                    if (recorder)
+                    {
+                        recorder->recordLogin(conn->recorded, conn->loginName, 0, conn->loginArrived);
+                    }
+                }
+                else
+                {
+                    try
+                    {
+                        reply = conn->session.handle(engine, line);
+                    }
+                    catch (const exception &ex)
+                    {
+                        reply = string("error: ") + ex.what() + "\n";
+                    }
+                    commands++;
+                    if (recorder && login)
+                    {
+                        recorder->recordLogin(conn->recorded, conn->loginName, conn->session.account(), conn->loginArrived);
+                    }
+                }
+                lock_guard<mutex> held(conn->guard);
+                conn->closing = conn->closing || conn->session.quit();
+                conn->output += reply;
+                sendOutput(*conn);
+            }
+        }
+    }
+
+public:
+    // Set from a signal handler to shut the server down
+    inline static atomic<bool> interrupted{false};
+
+    // Every command received is written to the recorder, when there is one
+    Server(CustomerList &customerList, Journal *commitJournal = nullptr, SessionRecorder *sessionRecorder = nullptr)
+        : customers(customerList), journal(commitJournal), recorder(sessionRecorder), listenFd(-1), epollFd(-1), loginThreads(2), completionFd(-1), stopping(false), commands(0) {}
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
+
+    // Threads checking passwords, 0 checks them on the command workers. Takes effect at run
+    void checkLoginsOn(size_t threads) { loginThreads = threads; }
+
+    // Listens on host:port, port 0 picks a free one, returns the port in use
+    int listenTcp(const string &host, int port)
+    {
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(uint16_t(port));
+        if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1 ||
+            bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listenFd, 1024) != 0)
+        {
+            throw runtime_error("Could not listen on " + host + ":" + to_string(port) + ".");
+        }
+        socklen_t length = sizeof(address);
+        getsockname(listenFd, reinterpret_cast<sockaddr *>(&address), &length);
+        return ntohs(address.sin_port);
+    }
+
+    void listenUnix(const string &path)
+    {
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+        {
+            throw runtime_error("Socket path '" + path + "' is too long.");
+        }
+        strcpy(address.sun_path, path.c_str());
+        unlink(path.c_str());
+        if (bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listenFd, 1024) != 0)
+        {
+            throw runtime_error("Could not listen on '" + path + "'.");
+        }
+        unixPath = path;
+    }
+
+    // Serves clients until stop() is called or the process is interrupted
+    void run(size_t workerCount)
+    {
+        setNonBlocking(listenFd);
+        epollFd = epoll_create1(0);
+        watch(listenFd, EPOLLIN, true);
+        if (loginThreads > 0)
+        {
+            completionFd = eventfd(0, EFD_NONBLOCK);
+            watch(completionFd, EPOLLIN, true);
+            logins = make_unique<LoginPool<shared_ptr<Connection>>>(customers, loginThreads, LOGIN_QUEUE, [this]
+                                                                    {
+                uint64_t one = 1;
+                while (write(completionFd, &one, sizeof(one)) < 0 && errno == EINTR)
+                {
+                } });
+        }
+        for (size_t i = 0; i < max<size_t>(workerCount, 1); i++)
+        {
+            workers.emplace_back(&Server::work, this);
+        }
+
+        epoll_event events[128];
+        while (!stopping && !interrupted)
+        {
+            int count = epoll_wait(epollFd, events, 128, 200);
+            for (int i = 0; i < count; i++)
+            {
+                int fd = events[i].data.fd;
+                if (fd == listenFd)
+                {
+                    acceptClients();
+                    continue;
+                }
+                if (fd == completionFd)
+                {
+                    finishLogins();
+                    continue;
+                }
+                auto found = connections.find(fd);
+                if (found == connections.end())
+                {
+                    continue;
+                }
+                shared_ptr<Connection> conn = found->second;
+                bool open = !(events[i].events & (EPOLLERR | EPOLLHUP));
+                if (open && (events[i].events & (EPOLLIN | EPOLLRDHUP)))
+                {
+                    open = readClient(conn);
+                }
+                if (open && (events[i].events & EPOLLOUT))
+                {
+                    lock_guard<mutex> held(conn->guard);
+                    watch(fd, EPOLLIN | EPOLLRDHUP, false);
+                    sendOutput(*conn);
+                }
+                if (!open)
+                {
+                    drop(fd);
+                }
+            }
+        }
+
+        stopping = true;
+        queueReady.notify_all();
+        for (thread &worker : workers)
+        {
+            worker.join();
+        }
+        workers.clear();
+        if (logins)
+        {
+            logins.reset();
+            completed.clear();
+            close(completionFd);
+            completionFd = -1;
+        }
+        connections.clear();
+        close(epollFd);
+        close(listenFd);
+        if (!unixPath.empty())
+        {
+            unlink(unixPath.c_str());
+        }
+    }
+
+    void stop()
+    {
+        stopping = true;
+    }
+
+    uint64_t commandsHandled() const { return commands; }
+};
+#endif
+
+// Benchmarks, run with "zbank bench <name>"
+namespace Bench
+{
+    using Clock = chrono::steady_clock;
+
+    double nanosSince(Clock::time_point start, size_t ops)
+    {
+        return chrono::duration<double, nano>(Clock::now() - start).count() / (ops ? ops : 1);
+    }
+
+    // Deterministic synthetic bank: the same seed always gives the same customers, accounts and histories
+    // Usernames own one to three accounts like zachary does, and every account gets a year of history
+    // with weekday and business hour heavy timestamps, a monthly salary and lots of small card payments
+    class Population
+    {
+    private:
+        uint64_t state;
+
+        // Daily activity by hour, most of it between 8:00 and 20:00
+        static constexpr int HOUR_WEIGHTS[24] = {1, 1, 1, 1, 1, 2, 4, 8, 12, 14, 14, 15, 18, 16, 14, 14, 15, 17, 15, 12, 9, 6, 3, 2};
+
+        int hourOfDay()
+        {
+            int total = 0;
+            for (int weight : HOUR_WEIGHTS)
+                total += weight;
+            int pick = int(below(uint64_t(total)));
+            int hour = 0;
+            while (pick >= HOUR_WEIGHTS[hour])
+                pick -= HOUR_WEIGHTS[hour++];
+            return hour;
+        }
+
+    public:
+        static const int64_t START = 1735689600; // 2025-01-01 00:00 UTC
+        static const int64_t DAYS = 365;
+
+        vector<string> usernames;
+        vector<Account *> accounts;
+
+        Population(uint64_t seed = 1) : state(seed) {}
+
+        // splitmix64
+        uint64_t next()
+        {
+            uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return z ^ (z >> 31);
+        }
+        uint64_t below(uint64_t bound) { return next() % bound; }
+        double uniform() { return double(next() >> 11) * 0x1.0p-53; }
+
+        // Cents, log-normally spread around a typical amount
+        int64_t amountAround(double typicalDollars)
+        {
+            double normal = sqrt(-2 * log(1 - uniform())) * cos(6.283185307179586 * uniform());
+            return max<int64_t>(1, llround(typicalDollars * 100 * exp(0.8 * normal)));
+        }
+
+        // Adds accountCount accounts with transactionsPerAccount transactions each to customers
+        void generate(CustomerList &customers, size_t accountCount, size_t transactionsPerAccount)
+        {
+            vector<int64_t> dates;
+            while (accounts.size() < accountCount)
+            {
+                string username = "customer" + to_string(usernames.size());
+                usernames.push_back(username);
+                size_t owned = min<size_t>(1 + (below(10) < 3) + (below(10) < 1), accountCount - accounts.size());
+                for (size_t a = 0; a < owned; a++)
+                {
+                    Account *acc;
+                    if (a == 0)
+                        acc = customers.create<CheckingAccount>(username, "checking", overdraftLimit_V<Money>);
+                    else
+                        acc = customers.create<SavingsAccount>(username, "savings" + to_string(a), 0.01 + double(below(400)) / 10000);
+                    customers.addCustomer(acc);
+                    accounts.push_back(acc);
+
+                    // arrivals are uniform over the year, weekends keep only a third of theirs
+                    dates.clear();
+                    while (dates.size() < transactionsPerAccount)
+                    {
+                        int64_t day = int64_t(below(DAYS));
+                        bool weekend = (day + 3) % 7 >= 5; // 2025-01-01 was a Wednesday
+                        if (weekend && below(3) != 0)
+                            continue;
+                        dates.push_back(START + day * 86400 + hourOfDay() * 3600 + int64_t(below(3600)));
+                    }
+                    sort(dates.begin(), dates.end());
+                    for (size_t t = 0; t < dates.size(); t++)
+                    {
+                        if (t % 12 == 0)
+                            acc->post(Transaction("Deposit", Money::fromCents(amountAround(2500)), TransactionType::DEPOSIT, time_t(dates[t])));
+                        else if (below(4) == 0)
+                            acc->post(Transaction("Deposit", Money::fromCents(amountAround(120)), TransactionType::DEPOSIT, time_t(dates[t])));
+                        else
+                            acc->post(Transaction("Withdrawal", -Money::fromCents(amountAround(35)), TransactionType::WITHDRAW, time_t(dates[t])));
+                    }
+                }
+            }
+        }
+    };
+
+    // Per operation latencies of one benchmarked path
+    class Latencies
+    {
+    private:
+        vector<uint64_t> nanos;
+        double seconds = 0;
+
+    public:
+        template <typename Op>
+        void measure(size_t samples, Op op)
+        {
+            nanos.reserve(nanos.size() + samples);
+            auto begin = Clock::now();
+            for (size_t i = 0; i < samples; i++)
+            {
+                auto start = Clock::now();
+                op(i);
+                nanos.push_back(uint64_t(chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count()));
+            }
+            seconds += chrono::duration<double>(Clock::now() - begin).count();
+        }
+
+        void report(const string &label)
+        {
+            sort(nanos.begin(), nanos.end());
+            auto at = [&](double q)
+            { return nanos.empty() ? 0.0 : double(nanos[min(nanos.size() - 1, size_t(q * double(nanos.size())))]) / 1000; };
+            cout << "  " << left << setw(14) << label << right << setw(12) << fixed << setprecision(0) << double(nanos.size()) / seconds
+                 << setprecision(2) << setw(10) << at(0.5) << setw(10) << at(0.9) << setw(10) << at(0.99) << setw(10) << at(0.999)
+                 << setw(12) << (nanos.empty() ? 0.0 : double(nanos.back()) / 1000) << endl;
+        }
+    };
+
+    // Discards everything written to it, statements are rendered into this so the terminal isn't measured
+    class NullBuffer : public streambuf
+    {
+    protected:
+        int overflow(int c) override { return c; }
+        streamsize xsputn(const char *, streamsize count) override { return count; }
+    };
+
+    // The paths customers hit, at 10^3 accounts and up by factors of ten: login lookup, posting a transaction,
+    // a 30 day range statement, a full history statement and closing an account
+    // Everything comes from a fixed seed, so two runs see exactly the same bank and the same requests
+    void suite(size_t maxAccounts, size_t transactionsPerAccount)
+    {
+        cout << transactionsPerAccount << " transactions per account, latencies in microseconds" << endl;
+        for (size_t accountCount = 1000; accountCount <= maxAccounts; accountCount *= 10)
+        {
+            CustomerList customers;
+            Population population(accountCount);
+            auto start = Clock::now();
+            population.generate(customers, accountCount, transactionsPerAccount);
+            cout << accountCount << " accounts (" << population.usernames.size() << " customers), generated in " << fixed << setprecision(2)
+                 << chrono::duration<double>(Clock::now() - start).count() << " s" << endl;
+            cout << "  " << left << setw(14) << "operation" << right << setw(12) << "ops/sec" << setw(10) << "p50" << setw(10) << "p90"
+                 << setw(10) << "p99" << setw(10) << "p99.9" << setw(12) << "max" << endl;
+
+            const vector<Account *> &accounts = population.accounts;
+            Population requests(42);
+            vector<size_t> picks(200000);
+            for (size_t &pick : picks)
+                pick = requests.below(accounts.size());
+
+            Latencies login;
+            size_t hits = 0;
+            login.measure(picks.size(), [&](size_t i)
+                          {
+                Account *wanted = accounts[picks[i]];
+                for (Account *acc : customers.findAccounts(wanted->username))
+                    if (acc->authenticate(wanted->username, wanted->password))
+                    {
+                        hits++;
+                        break;
+                    } });
+            login.report("login");
+
+            NullBuffer discard;
+            streambuf *terminal = cout.rdbuf(&discard);
+            Latencies range, statement;
+            const size_t statements = min<size_t>(20000, accounts.size() * 4);
+            range.measure(statements, [&](size_t i)
+                          {
+                time_t from = time_t(Population::START + int64_t(picks[i] % (Population::DAYS - 30)) * 86400);
+                accounts[picks[i]]->displayTransactionHistoryInRange(from, from + 30 * 86400); });
+            statement.measure(statements, [&](size_t i)
+                              { accounts[picks[i]]->displayTransactionHistory(); });
+            cout.rdbuf(terminal);
+            range.report("range");
+            statement.report("statement");
+
+            Latencies append;
+            const time_t now = time_t(Population::START + Population::DAYS * 86400);
+            append.measure(picks.size(), [&](size_t i)
+                           { accounts[picks[i]]->post(Transaction("Deposit", Money::dollars(1), TransactionType::DEPOSIT, now)); });
+            append.report("add");
+
+            // close accounts from all over the list in a shuffled order, each one only once
+            Latencies closure;
+            const size_t closures = min(picks.size(), accounts.size() / 2);
+            closure.measure(closures, [&](size_t i)
+                            { customers.removeCustomer(accounts[(i * 7919) % closures * (accounts.size() / closures)]); });
+            closure.report("close");
+            if (hits != picks.size())
+            {
+                cout << "  login missed " << picks.size() - hits << " accounts" << endl;
+            }
+        }
+    }
+
+    // Append cost should stay flat no matter how long the history already is
+    void ledgerAppend()
+    {
+        const size_t window = 10000;
+        TransactionList list;
+        time_t now = time(nullptr);
+        cout << setw(12) << "history" << setw(16) << "ns/append" << endl;
+        for (size_t target = 1000; target <= 10000000; target *= 10)
+        {
+            while (list.size() < target)
+            {
+                list.addTransaction(Transaction("Deposit", Money::dollars(1), TransactionType::DEPOSIT, now));
+            }
+            auto start = Clock::now();
+            for (size_t i = 0; i < window; i++)
+            {
+                list.addTransaction(Transaction("Deposit", Money::dollars(1), TransactionType::DEPOSIT, now));
+            }
+            cout << setw(12) << list.size() << setw(16) << fixed << setprecision(1) << nanosSince(start, window) << endl;
+        }
+        cout << "arena bytes: " << list.capacityBytes() << " (" << fixed << setprecision(1) << double(list.capacityBytes()) / double(list.size())
+             << " per transaction, " << sizeof(TransactionRecord) << " byte records)" << endl;
+    }
+
+    // One day out of ten years of history, indexed lookup against a full scan
+    void rangeQuery()
+    {
+        const time_t begin = 1262304000; // 2010-01-01
+        const time_t step = 300;
+        const size_t total = 10 * 365 * 24 * 12;
+        TransactionList list;
+        for (size_t i = 0; i < total; i++)
+        {
+            list.addTransaction(Transaction("Deposit", Money::dollars(1), TransactionType::DEPOSIT, begin + time_t(i) * step));
+        }
+
+        const size_t queries = 1000;
+        size_t found = 0;
+        auto start = Clock::now();
+        for (size_t q = 0; q < queries; q++)
+        {
+            time_t from = begin + time_t((q * 7919) % 3650) * 86400;
+            for (const Transaction &transaction : list.range(from, from + 86399))
+            {
+                found += transaction.getAmount() > Money();
+            }
+        }
+        double indexed = nanosSince(start, queries);
+
+        size_t scanned = 0;
+        start = Clock::now();
+        for (size_t q = 0; q < queries / 100; q++)
+        {
+            time_t from = begin + time_t((q * 7919) % 3650) * 86400;
+            for (const Transaction &transaction : list)
+            {
+                scanned += transaction.getDate() >= from && transaction.getDate() <= from + 86399;
+            }
+        }
+        double scan = nanosSince(start, queries / 100);
+
+        cout << "history: " << list.size() << " transactions, " << found / queries << " per window" << endl;
+        cout << fixed << setprecision(1);
+        cout << "indexed range: " << indexed / 1000 << " us/query" << endl;
+        cout << "full scan:     " << scan / 1000 << " us/query" << endl;
+        if (scanned * 100 != found)
+        {
+            cout << "MISMATCH between indexed and scanned results" << endl;
+        }
+    }
+
+    // Balance on a past date from the running balance checkpoints, against summing the history up to that date
+    void balanceQuery()
+    {
+        const time_t begin = 1262304000; // 2010-01-01
+        const time_t step = 300;
+        const size_t total = 10 * 365 * 24 * 12;
+        TransactionList list;
+        for (size_t i = 0; i < total; i++)
+        {
+            int64_t cents = int64_t(i * 2654435761u % 20001) - 10000;
+            list.addTransaction(Transaction("Deposit", Money::fromCents(cents), TransactionType::DEPOSIT, begin + time_t(i) * step));
+        }
+
+        const size_t queries = 100000;
+        auto dateOf = [&](size_t q)
+        { return begin + time_t(q * 7919 % (total * size_t(step))); };
+        int64_t checkpointed = 0;
+        auto start = Clock::now();
+        for (size_t q = 0; q < queries; q++)
+        {
+            checkpointed += list.balanceAsOf(dateOf(q)).getCents();
+        }
+        double indexed = nanosSince(start, queries);
+
+        const size_t scans = 100;
+        int64_t summed = 0, expected = 0;
+        start = Clock::now();
+        for (size_t q = 0; q < scans; q++)
+        {
+            time_t date = dateOf(q);
+            int64_t sum = 0;
+            for (const Transaction &transaction : list)
+            {
+                sum += transaction.getDate() <= date ? transaction.getAmount().getCents() : 0;
+            }
+            summed += sum;
+        }
+        double scan = nanosSince(start, scans);
+        for (size_t q = 0; q < scans; q++)
+        {
+            expected += list.balanceAsOf(dateOf(q)).getCents();
+        }
+
+        cout << "history: " << list.size() << " transactions" << endl;
+        cout << fixed << setprecision(1);
+        cout << "checkpoints: " << indexed << " ns/query" << endl;
+        cout << "full sum:    " << scan / 1000 << " us/query" << endl;
+        if (summed != expected || checkpointed == 0)
+        {
+            cout << "MISMATCH between checkpointed and summed balances" << endl;
+        }
+    }
+
+    // Monthly summaries and the largest transactions of one account, read from the maintained aggregates
+    // against working them out from the history on every request, and what maintaining them adds to each append
+    bool analyticsViews()
+    {
+        const time_t from = 1672531200; // 2023-01-01
+        const time_t span = 3 * 365 * 86400;
+        DateCache &dates = DateCache::local();
+        bool agree = true;
+        cout << "transactions  append ns  +views ns  month scan us  month view ns  top scan us  top view ns" << endl;
+        for (size_t total : {10000, 100000, 1000000})
+        {
+            vector<Transaction> history;
+            history.reserve(total);
+            for (size_t i = 0; i < total; i++)
+            {
+                int64_t cents = int64_t(i * 2654435761u % 40001) - 20000;
+                history.emplace_back(cents >= 0 ? "Deposit" : "Withdrawal", Money::fromCents(cents), cents >= 0 ? TransactionType::DEPOSIT : TransactionType::WITHDRAW,
+                                     from + time_t(i * size_t(span) / total));
+            }
+            TransactionList plain, viewed;
+            viewed.analyze();
+            auto start = Clock::now();
+            for (const Transaction &transaction : history)
+            {
+                plain.addTransaction(transaction);
+            }
+            double appendPlain = nanosSince(start, total);
+            start = Clock::now();
+            for (const Transaction &transaction : history)
+            {
+                viewed.addTransaction(transaction);
+            }
+            double appendViewed = nanosSince(start, total);
+
+            // every month of the three years, the way a report would ask for them without the views
+            vector<int> months;
+            for (int month = dates.monthOf(from); month <= dates.monthOf(from + span - 1); month++)
+            {
+                months.push_back(month);
+            }
+            vector<TransactionAnalytics::Month> scanned;
+            start = Clock::now();
+            for (int number : months)
+            {
+                TransactionAnalytics::Month month(number);
+                plain.forEachRecordInRange(dates.monthStart(number), dates.monthStart(number + 1) - 1, [&](const TransactionRecord &record)
+                                           {
+                    size_t type = min<size_t>(record.type, 2);
+                    month.sums[type] += record.amount;
+                    month.counts[type]++;
+                    month.smallest = min(month.smallest, record.amount);
+                    month.largest = max(month.largest, record.amount); });
+                scanned.push_back(month);
+            }
+            double monthScan = nanosSince(start, months.size());
+
+            const size_t lookups = 1000000;
+            const TransactionAnalytics &analytics = viewed.analyze();
+            int64_t sink = 0;
+            start = Clock::now();
+            for (size_t i = 0; i < lookups; i++)
+            {
+                const TransactionAnalytics::Month *month = analytics.find(months[i % months.size()]);
+                sink += month ? month->sums[0] + month->largest : 0;
+            }
+            double monthView = nanosSince(start, lookups);
+
+            const size_t topScans = 5;
+            vector<TransactionRecord> largest(TransactionAnalytics::TOP);
+            auto bigger = [](const TransactionRecord &a, const TransactionRecord &b)
+            { return llabs(a.amount) > llabs(b.amount); };
+            start = Clock::now();
+            for (size_t i = 0; i < topScans; i++)
+            {
+                vector<TransactionRecord> all;
+                all.reserve(plain.size());
+                plain.forEachRecord(0, plain.size(), [&](const TransactionRecord &record)
+                                    { all.push_back(record); });
+                partial_sort_copy(all.begin(), all.end(), largest.begin(), largest.end(), bigger);
+            }
+            double topScan = nanosSince(start, topScans);
+            start = Clock::now();
+            for (size_t i = 0; i < lookups; i++)
+            {
+                sink += analytics.topRecords()[i % analytics.topSize()].amount;
+            }
+            double topView = nanosSince(start, lookups);
+
+            for (const TransactionAnalytics::Month &month : scanned)
+            {
+                const TransactionAnalytics::Month *kept = analytics.find(month.month);
+                agree = agree && kept && equal(begin(month.sums), end(month.sums), kept->sums) && equal(begin(month.counts), end(month.counts), kept->counts) &&
+                        month.smallest == kept->smallest && month.largest == kept->largest;
+            }
+            agree = agree && sink != 0;
+            for (size_t i = 0; i < analytics.topSize(); i++)
+            {
+                agree = agree && llabs(analytics.topRecords()[i].amount) == llabs(largest[i].amount);
+            }
+            cout << setw(12) << total << fixed << setprecision(1) << setw(11) << appendPlain << setw(11) << appendViewed - appendPlain
+                 << setw(15) << monthScan / 1000 << setw(15) << monthView << setw(13) << topScan / 1000 << setw(13) << topView << endl;
+        }
+        cout << (agree ? "views match the scans" : "MISMATCH between views and scans") << endl;
+        return agree;
+    }
+
+    // Login latency should not depend on how many customers there are
+    void loginLookup()
+    {
+        cout << setw(12) << "customers" << setw(16) << "ns/login" << endl;
+        for (size_t customers = 1000; customers <= 1000000; customers *= 10)
+        {
+            CustomerList list;
+            for (size_t i = 0; i < customers; i++)
+            {
+                list.addCustomer(list.create<CheckingAccount>("user" + to_string(i), "checking", overdraftLimit_V<Money>));
+            }
+            const size_t logins = 200000;
+            vector<string> names;
+            for (size_t i = 0; i < 1024; i++)
+            {
+                names.push_back("user" + to_string((i * 2654435761u) % customers));
+            }
+            size_t hits = 0;
+            auto start = Clock::now();
+            for (size_t i = 0; i < logins; i++)
+            {
+                for (Account *account : list.findAccounts(names[i & 1023]))
+                {
+                    hits += account->authenticate(names[i & 1023], "checking");
+                }
+            }
+            double ns = nanosSince(start, logins);
+            cout << setw(12) << customers << setw(16) << fixed << setprecision(1) << ns << (hits == logins ? "" : "  MISSED") << endl;
+        }
+    }
+
+    // Durable deposits per second for different group commit sizes, then how fast the result replays
+    void journalCommit()
+    {
+        const string path = "zbank-bench.journal";
+        cout << setw(12) << "group" << setw(16) << "ops/sec" << endl;
+        for (size_t group : {1, 8, 64, 512, 4096})
+        {
+            filesystem::remove(path);
+            CustomerList customers;
+            Journal journal(path, group);
+            journal.recover(customers);
+            Account::observers.push_back(&journal);
+            Account *acc = customers.create<CheckingAccount>("bench", "bench", overdraftLimit_V<Money>);
+            customers.addCustomer(acc);
+
+            size_t ops = 0;
+            auto start = Clock::now();
+            while (Clock::now() - start < chrono::seconds(1))
+            {
+                for (int i = 0; i < 64; i++, ops++)
+                {
+                    acc->post(Transaction("Deposit", Money::dollars(1), TransactionType::DEPOSIT, time(nullptr)));
+                }
+            }
+            journal.sync();
+            double seconds = chrono::duration<double>(Clock::now() - start).count();
+            Account::observers.clear();
+            cout << setw(12) << group << setw(16) << fixed << setprecision(0) << ops / seconds << endl;
+        }
+
+        CustomerList customers;
+        Journal journal(path);
+        auto start = Clock::now();
+        size_t records = journal.recover(customers);
+        double seconds = chrono::duration<double>(Clock::now() - start).count();
+        cout << "replayed " << records << " records at " << fixed << setprecision(0) << records / seconds << " records/sec" << endl;
+        filesystem::remove(path);
+    }
+
+    // Cold start from a journal replay against cold start from a mapped snapshot of the same history
+    void snapshotLoad()
+    {
+        const string journalPath = "zbank-bench.journal";
+        const string snapshotPath = "zbank-bench.snapshot";
+        const size_t accounts = 2000, perAccount = 1000;
+        filesystem::remove(journalPath);
+        filesystem::remove(snapshotPath);
+        {
+            CustomerList customers;
+            Journal journal(journalPath, 4096);
+            journal.recover(customers);
+            Account::observers.push_back(&journal);
+            for (size_t i = 0; i < accounts; i++)
+            {
+                Account *acc = customers.create<SavingsAccount>("user" + to_string(i), "savings", 0.05);
+                customers.addCustomer(acc);
+                for (size_t t = 0; t < perAccount; t++)
+                {
+                    acc->post(Transaction("Deposit", Money::dollars(1), TransactionType::DEPOSIT, time_t(1262304000 + t * 3600)));
+                }
+            }
+            journal.sync();
+            Account::observers.clear();
+            Snapshot::write(snapshotPath, customers, 0);
+        }
+
+        double replaySeconds, loadSeconds;
+        {
+            CustomerList customers;
+            Journal journal(journalPath);
+            auto start = Clock::now();
+            journal.recover(customers);
+            replaySeconds = chrono::duration<double>(Clock::now() - start).count();
+        }
+        int64_t total = 0;
+        {
+            Snapshot snapshot;
+            CustomerList customers;
+            auto start = Clock::now();
+            snapshot.load(snapshotPath, customers);
+            loadSeconds = chrono::duration<double>(Clock::now() - start).count();
+            for (const Account *acc : customers.accounts())
+            {
+                const TransactionList &list = acc->transactions;
+                list.forEachRecord(0, list.size(), [&](const TransactionRecord &record)
+                                   { total += record.amount; });
+            }
+        }
+        cout << accounts << " accounts, " << accounts * perAccount << " transactions" << endl;
+        cout << fixed << setprecision(1);
+        cout << "journal replay: " << replaySeconds * 1000 << " ms" << endl;
+        cout << "snapshot load:  " << loadSeconds * 1000 << " ms" << endl;
+        if (total != int64_t(accounts * perAccount) * 100)
+        {
+            cout << "MISMATCH in snapshot contents" << endl;
+        }
+        filesystem::remove(journalPath);
+        filesystem::remove(snapshotPath);
+    }
+
+    // Scripted deposits and withdrawals through the batch engine, with and without the journal
+    void batchThroughput()
+    {
+        const size_t commands = 1000000;
+        string script;
+        for (size_t i = 0; i < commands; i++)
+        {
+            script += (i % 4 == 3 ? "withdraw " : "deposit ") + to_string(1 + (i / 4) % 100) + " 10\n";
+        }
+        const string path = "zbank-bench.journal";
+        for (bool journaled : {false, true})
+        {
+            filesystem::remove(path);
+            CustomerList customers;
+            Journal journal(path, 1024);
+            journal.recover(customers);
+            if (journaled)
+            {
+                Account::observers.push_back(&journal);
+            }
+            for (int i = 0; i < 100; i++)
+            {
+                customers.addCustomer(customers.create<CheckingAccount>("user" + to_string(i), "checking", overdraftLimit_V<Money>));
+            }
+            ostringstream output;
+            istringstream input(script);
+            BatchEngine engine(customers, &output, journaled ? &journal : nullptr);
+            auto start = Clock::now();
+            size_t failed = engine.run(input);
+            double seconds = chrono::duration<double>(Clock::now() - start).count();
+            Account::observers.clear();
+            cout << (journaled ? "journaled:   " : "in memory:   ") << fixed << setprecision(0) << commands / seconds << " commands/sec"
+                 << (failed ? "  (" + to_string(failed) + " failed)" : "") << endl;
+        }
+        filesystem::remove(path);
+    }
+
+    // Deposit totals, window totals and balance verification: the old linked list walk against the
+    // record arena and the column kernels
+    void columnKernels()
+    {
+        struct OldNode // what TransactionList used to allocate per transaction
+        {
+            Transaction transaction;
+            OldNode *next;
+        };
+        const size_t n = 4000000;
+        TransactionList list;
+        OldNode *head = nullptr, **tail = &head;
+        uint64_t seed = 42;
+        for (size_t i = 0; i < n; i++)
+        {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            bool deposit = (seed >> 33) % 3 != 0;
+            Money amount = Money::fromCents(int64_t((seed >> 40) % 100000) + 1);
+            Transaction trans(deposit ? "Deposit" : "Withdrawal", deposit ? amount : -amount, deposit ? TransactionType::DEPOSIT : TransactionType::WITHDRAW, time_t(1262304000 + i * 60));
+            list.addTransaction(trans);
+            *tail = new OldNode{trans, nullptr};
+            tail = &(*tail)->next;
+        }
+        const int64_t start = 1262304000 + 600000, end = start + 86400 * 365;
+
+        auto report = [](const char *label, double nanos, int64_t result)
+        {
+            cout << left << setw(22) << label << right << setw(10) << fixed << setprecision(2) << nanos << " ns/txn   " << Money::fromCents(result) << endl;
+        };
+        auto time = [&](auto func)
+        {
+            auto begin = Clock::now();
+            int64_t result = 0;
+            for (int r = 0; r < 5; r++)
+                result = func();
+            return make_pair(nanosSince(begin, n * 5), result);
+        };
+
+        cout << n << " transactions" << endl
+             << "-- deposit totals" << endl;
+        auto r = time([&]
+                      { int64_t sum = 0; for (OldNode *node = head; node; node = node->next) if (node->transaction.getType() == TransactionType::DEPOSIT) sum += node->transaction.getAmount().getCents(); return sum; });
+        report("linked list", r.first, r.second);
+        r = time([&]
+                 { return list.totalOfType(TransactionType::DEPOSIT).getCents(); });
+        report("record arena", r.first, r.second);
+        list.enableColumns();
+        const TransactionColumns &columns = *list.getColumns();
+        vector<Kernels::Isa> levels = {Kernels::Isa::SCALAR};
+        if (Kernels::detect() >= Kernels::Isa::SSE42)
+            levels.push_back(Kernels::Isa::SSE42);
+        if (Kernels::detect() >= Kernels::Isa::AVX2)
+            levels.push_back(Kernels::Isa::AVX2);
+        for (Kernels::Isa isa : levels)
+        {
+            r = time([&]
+                     { return Kernels::totalOfType(columns.amounts.data(), columns.types.data(), n, uint8_t(TransactionType::DEPOSIT), isa); });
+            report((string("columns ") + Kernels::isaName(isa)).c_str(), r.first, r.second);
+        }
+
+        cout << "-- one year window total (full scan, as for an unordered history)" << endl;
+        r = time([&]
+                 { int64_t sum = 0; for (OldNode *node = head; node; node = node->next) if (node->transaction.getDate() >= start && node->transaction.getDate() <= end) sum += node->transaction.getAmount().getCents(); return sum; });
+        report("linked list", r.first, r.second);
+        for (Kernels::Isa isa : levels)
+        {
+            r = time([&]
+                     { return Kernels::totalInWindow(columns.amounts.data(), columns.dates.data(), n, start, end, isa); });
+            report((string("columns ") + Kernels::isaName(isa)).c_str(), r.first, r.second);
+        }
+
+        cout << "-- balance verification" << endl;
+        r = time([&]
+                 { int64_t sum = 0; for (OldNode *node = head; node; node = node->next) sum += node->transaction.getAmount().getCents(); return sum; });
+        report("linked list", r.first, r.second);
+        for (Kernels::Isa isa : levels)
+        {
+            r = time([&]
+                     { return Kernels::total(columns.amounts.data(), n, isa); });
+            report((string("columns ") + Kernels::isaName(isa)).c_str(), r.first, r.second);
+        }
+
+        while (head)
+        {
+            OldNode *next = head->next;
+            delete head;
+            head = next;
+        }
+    }
+
+    // Deposits, withdrawals and transfers from many threads at once, first spread over many accounts and
+    // then all on two accounts sending money back and forth. Afterwards no money may have appeared or
+    // vanished, no account may ever have been seen past its overdraft limit, and every history has to add up
+    bool concurrentLedger()
+    {
+        const size_t opsPerThread = 200000;
+        const Money limit = overdraftLimit_V<Money>;
+        const size_t maxThreads = max<size_t>(8, thread::hardware_concurrency());
+        bool allHeld = true;
+        cout << "accounts  threads      ops/sec  rejected  invariants" << endl;
+        for (int accountCount : {64, 2})
+        {
+            for (size_t threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+            {
+                CustomerList customers;
+                vector<Account *> accounts;
+                for (int i = 0; i < accountCount; i++)
+                {
+                    Account *acc = customers.create<CheckingAccount>("user" + to_string(i), "checking", limit);
+                    customers.addCustomer(acc);
+                    acc->credit(Money::dollars(1000));
+                    accounts.push_back(acc);
+                }
+                const Money opening = Money::dollars(1000 * accountCount);
+
+                atomic<int64_t> netCents(0);
+                atomic<size_t> rejected(0);
+                atomic<bool> overdrawn(false);
+                auto start = Clock::now();
+                vector<thread> threads;
+                for (size_t t = 0; t < threadCount; t++)
+                {
+                    threads.emplace_back([&, t]
+                                         {
+                        uint64_t seed = 0x9e3779b97f4a7c15ull * (t + 1);
+                        for (size_t i = 0; i < opsPerThread; i++)
+                        {
+                            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+                            Account &a = *accounts[(seed >> 20) % accountCount];
+                            Account &b = *accounts[((seed >> 30) % (accountCount - 1) + (seed >> 20) % accountCount + 1) % accountCount];
+                            Money amount = Money::dollars(int64_t((seed >> 40) % 200) + 1);
+                            try
+                            {
+                                switch ((seed >> 56) % 8)
+                                {
+                                case 0:
+                                    a.credit(amount);
+                                    netCents += amount.getCents();
+                                    break;
+                                case 1:
+                                    a.debit(amount);
+                                    netCents -= amount.getCents();
+                                    break;
+                                default:
+                                    Account::transfer(a, b, amount);
+                                    break;
+                                }
+                            }
+                            catch (const runtime_error &)
+                            {
+                                rejected++;
+                            }
+                            if (a.getBalance() < -limit)
+                                overdrawn = true;
+                        } });
+                }
+                for (thread &worker : threads)
+                {
+                    worker.join();
+                }
+                double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+                Money total;
+                bool histories = true;
+                for (Account *acc : accounts)
+                {
+                    total += acc->getBalance();
+                    histories = histories && acc->verifyBalance() && acc->getBalance() >= -limit;
+                }
+                bool held = !overdrawn && histories && total == opening + Money::fromCents(netCents);
+                allHeld = allHeld && held;
+                size_t ops = opsPerThread * threadCount;
+                cout << setw(8) << accountCount << setw(9) << threadCount << setw(13) << fixed << setprecision(0) << ops / seconds
+                     << setw(9) << setprecision(1) << 100.0 * rejected / ops << "%  " << (held ? "held" : "BROKEN") << endl;
+            }
+        }
+        cout << (allHeld ? "all invariants held" : "INVARIANTS BROKEN") << endl;
+        return allHeld;
+    }
+
+    // Cost of the audit trail to the thread making the change: deposits per thread with no audit, with every event
+    // written and flushed under a lock on the spot, and with the ring and writer thread under each backpressure policy
+    // The ring is kept small (4K events) so that a writer falling behind shows up in the dropped and spilled columns
+    bool auditTrail()
+    {
+        const size_t opsPerThread = 200000;
+        const size_t maxThreads = max<size_t>(4, thread::hardware_concurrency());
+        string dir = (filesystem::temp_directory_path() / ("zbank-bench-audit-" + to_string(getpid()))).string();
+        filesystem::create_directories(dir);
+
+        // What auditing used to look like: one write and flush per event, one at a time
+        class SyncAudit : public LedgerObserver
+        {
+        private:
+            FILE *file;
+            mutex lock;
+
+        public:
+            explicit SyncAudit(const string &path) : file(fopen(path.c_str(), "wb")) {}
+            ~SyncAudit() { fclose(file); }
+            void accountOpened(const Account &) override {}
+            void accountClosed(const Account &) override {}
+            void transactionPosted(const Account &acc, const Transaction &trans) override
+            {
+                AuditEvent event = {};
+                event.at = int64_t(chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count());
+                event.amount = trans.getAmount().getCents();
+                event.account = acc.ID;
+                event.kind = AuditLog::DEPOSIT;
+                lock_guard<mutex> held(lock);
+                fwrite(&event, sizeof(event), 1, file);
+                fflush(file);
+            }
+        };
+
+        bool complete = true;
+        cout << "audit           threads   ns/deposit      dropped      spilled   events" << endl;
+        for (const char *mode : {"none", "sync", "block", "drop", "spill"})
+        {
+            for (size_t threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+            {
+                CustomerList customers;
+                vector<Account *> accounts;
+                for (size_t i = 0; i < threadCount; i++)
+                {
+                    Account *acc = customers.create<CheckingAccount>("user" + to_string(i), "checking", overdraftLimit_V<Money>);
+                    customers.addCustomer(acc);
+                    accounts.push_back(acc);
+                }
+                string path = dir + "/" + mode + ".audit";
+                unique_ptr<SyncAudit> sync;
+                unique_ptr<AuditLog> audit;
+                AuditLog::Policy policy;
+                if (string(mode) == "sync")
+                {
+                    sync = make_unique<SyncAudit>(path);
+                    Account::observers.push_back(sync.get());
+                }
+                else if (AuditLog::parsePolicy(mode, policy))
+                {
+                    audit = make_unique<AuditLog>(path, policy, uint64_t(64) << 20, 4096);
+                    audit->start();
+                    Account::observers.push_back(audit.get());
+                }
+
+                auto start = Clock::now();
+                vector<thread> threads;
+                for (size_t t = 0; t < threadCount; t++)
+                {
+                    threads.emplace_back([&, t]
+                                         {
+                        for (size_t i = 0; i < opsPerThread; i++)
+                        {
+                            accounts[t]->credit(Money::fromCents(int64_t(i % 5000) + 1));
+                        } });
+                }
+                for (thread &worker : threads)
+                {
+                    worker.join();
+                }
+                double nanos = nanosSince(start, opsPerThread);
+                Account::observers.clear();
+
+                cout << left << setw(16) << mode << right << setw(7) << threadCount << setw(13) << fixed << setprecision(1) << nanos;
+                if (audit)
+                {
+                    audit->stop();
+                    AuditLog::Counters counters = audit->counters();
+                    bool whole = counters.published == opsPerThread * threadCount && counters.written + counters.dropped == counters.published;
+                    complete = complete && whole;
+                    cout << setw(13) << counters.dropped << setw(13) << counters.spilled << "   " << (whole ? "accounted" : "LOST");
+                }
+                cout << endl;
+                audit.reset();
+                sync.reset();
+                filesystem::remove_all(dir);
+                filesystem::create_directories(dir);
+            }
+        }
+        filesystem::remove_all(dir);
+        cout << (complete ? "every event written or counted as dropped" : "AUDIT EVENTS LOST") << endl;
+        return complete;
+    }
+
+    // A year-end statement for an account with a million transactions: the old per-line asctime and endl
+    // against the renderer in each format, written to a stream that discards everything
+    void statementRendering()
+    {
+        const size_t n = 1000000;
+        TransactionList list;
+        for (size_t i = 0; i < n; i++)
+        {
+            bool deposit = i % 3 == 0;
+            list.addTransaction(Transaction(deposit ? "Deposit" : "Withdrawal", Money::fromCents(deposit ? 250000 : -int64_t(i % 9000) - 1),
+                                            deposit ? TransactionType::DEPOSIT : TransactionType::WITHDRAW, time_t(1735689600 + i * 31)));
+        }
+        NullBuffer discard;
+        ostream sink(&discard);
+        auto report = [&](const char *label, auto render)
+        {
+            auto start = Clock::now();
+            render();
+            double seconds = chrono::duration<double>(Clock::now() - start).count();
+            cout << left << setw(16) << label << right << setw(12) << fixed << setprecision(0) << n / seconds << " rows/sec" << endl;
+        };
+        report("asctime + endl", [&]
+               { list.forEachRecord(0, n, [&](const TransactionRecord &record)
+                                    {
+                    time_t date = time_t(record.date);
+                    sink << "Description: " << transactionTypeName(TransactionType(record.type)) << " | " << transactionTypeName(TransactionType(record.type))
+                         << " of $" << Money::fromCents(record.amount) << " | Date: " << asctime(localtime(&date)) << endl; }); });
+        const pair<const char *, StatementRenderer::Format> formats[] = {
+            {"text", StatementRenderer::Format::TEXT}, {"csv", StatementRenderer::Format::CSV}, {"fixed width", StatementRenderer::Format::FIXED}};
+        for (const auto &format : formats)
+        {
+            report(format.first, [&]
+                   {
+                StatementRenderer renderer(StatementRenderer::scratch(), &sink, format.second);
+                renderer.header();
+                list.render(renderer); });
+        }
+        report("text, page 500", [&]
+               {
+            StatementRenderer renderer(StatementRenderer::scratch(), &sink);
+            renderer.page(500, 1000);
+            list.render(renderer); });
+    }
+
+    // Bulk history files: the date parser against istringstream and get_time, then the same synthetic ledger exported
+    // and imported again as CSV and as binary, on one thread and on every thread, in rows/sec
+    bool bulkHistory(size_t rows)
+    {
+        const size_t perAccount = 100;
+        const size_t accountCount = max<size_t>(1, rows / perAccount);
+        const size_t threads = max(1u, thread::hardware_concurrency());
+        Population population;
+
+        vector<string> dates(1000000);
+        for (string &date : dates)
+        {
+            char text[32];
+            date.assign(text, DateCache::formatUtc(time_t(Population::START + int64_t(population.below(Population::DAYS * 86400))), text) - 1);
+        }
+        int64_t classicSum = 0, parserSum = 0;
+        auto start = Clock::now();
+        for (const string &date : dates)
+        {
+            tm parsed = {};
+            istringstream in(date);
+            in >> get_time(&parsed, "%Y-%m-%dT%H:%M:%S");
+            parsed.tm_isdst = -1;
+            classicSum += int64_t(mktime(&parsed));
+        }
+        double classicNanos = nanosSince(start, dates.size());
+        start = Clock::now();
+        for (const string &date : dates)
+        {
+            parserSum += int64_t(DateParser::parseTime(date));
+        }
+        double parserNanos = nanosSince(start, dates.size());
+        cout << fixed << setprecision(0) << "dates: get_time " << 1e9 / classicNanos << " rows/sec, DateParser " << 1e9 / parserNanos << " rows/sec"
+             << (classicSum == parserSum ? "" : " (results differ around daylight saving switches)") << endl;
+
+        CustomerList source;
+        population.generate(source, accountCount, perAccount);
+        vector<Money> balances(source.getLastID() + 1);
+        for (const Account *acc : source.accounts())
+        {
+            balances[size_t(acc->ID)] = acc->getBalance();
+        }
+        const size_t total = accountCount * perAccount;
+        cout << total << " rows in " << accountCount << " accounts" << endl;
+        cout << left << setw(16) << "" << right << setw(14) << "1 thread" << setw(14) << (to_string(threads) + (threads == 1 ? " thread" : " threads")) << endl;
+
+        bool ok = true;
+        for (HistoryExport::Format format : {HistoryExport::Format::CSV, HistoryExport::Format::BINARY})
+        {
+            const bool csv = format == HistoryExport::Format::CSV;
+            const string path = csv ? "zbank-bench.csv" : "zbank-bench.history";
+            double exportRate[2], importRate[2];
+            for (int run = 0; run < 2; run++)
+            {
+                size_t threadCount = run == 0 ? 1 : threads;
+                start = Clock::now();
+                size_t written = HistoryExport::run(path, source, format, threadCount);
+                exportRate[run] = 1e9 / nanosSince(start, written);
+
+                CustomerList target;
+                for (size_t i = 0; i < accountCount; i++)
+                {
+                    target.addCustomer(target.create<CheckingAccount>("user" + to_string(i), "checking", overdraftLimit_V<Money>));
+                }
+                start = Clock::now();
+                HistoryImport::Result result = HistoryImport::run(path, target, threadCount);
+                importRate[run] = 1e9 / nanosSince(start, result.rows);
+
+                for (const Account *acc : target.accounts())
+                {
+                    ok = ok && acc->getBalance() == balances[size_t(acc->ID)] && acc->verifyBalance();
+                }
+                ok = ok && written == total && result.rows == total;
+            }
+            cout << left << setw(16) << (csv ? "csv export" : "binary export") << right << setw(14) << exportRate[0] << setw(14) << exportRate[1] << endl;
+            cout << left << setw(16) << (csv ? "csv import" : "binary import") << right << setw(14) << importRate[0] << setw(14) << importRate[1] << endl;
+            filesystem::remove(path);
+        }
+        if (!ok)
+        {
+            cout << "MISMATCH between the exported and imported ledgers" << endl;
+        }
+        return ok;
+    }
+
+    // An end-of-day pass over a million accounts (who can still withdraw $50, and tomorrow's interest) done the
+    // way the old hierarchy allowed, one heap object per account reached through a linked list and virtual calls,
+    // against the registry's packed pointers and walking the per-type pools where every rule is called directly
+    void accountPolicies()
+    {
+        const size_t n = 1000000;
+        const Money amount = Money::dollars(50);
+        CustomerList customers;
+        struct OldNode
+        {
+            Account *account;
+            OldNode *next;
+        };
+        OldNode *head = nullptr, **tail = &head;
+        uint64_t seed = 3;
+        for (size_t i = 0; i < n; i++)
+        {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            Money opening = Money::fromCents(1 + int64_t((seed >> 20) % 20000));
+            Account *old, *pooled;
+            if (i % 2)
+            {
+                old = ::new CheckingAccount("user" + to_string(i), "checking", overdraftLimit_V<Money>);
+                pooled = customers.create<CheckingAccount>("user" + to_string(i), "checking", overdraftLimit_V<Money>);
+            }
+            else
+            {
+                old = ::new SavingsAccount("user" + to_string(i), "savings", 0.05);
+                pooled = customers.create<SavingsAccount>("user" + to_string(i), "savings", 0.05);
+            }
+            old->credit(opening);
+            pooled->credit(opening);
+            customers.addCustomer(pooled);
+            *tail = new OldNode{old, nullptr};
+            tail = &(*tail)->next;
+        }
+
+        struct Pass
+        {
+            size_t canWithdraw = 0;
+            double interest = 0;
+        };
+        auto visit = [&](const auto &acc, Pass &pass)
+        {
+            pass.canWithdraw += acc.canWithdraw(amount);
+            pass.interest += double(acc.getBalance().getCents()) * acc.getInterestRate() / 365;
+        };
+        auto time = [&](const char *label, auto pass)
+        {
+            Pass result;
+            auto start = Clock::now();
+            for (int r = 0; r < 5; r++)
+            {
+                result = Pass();
+                pass(result);
+            }
+            cout << left << setw(28) << label << right << setw(8) << fixed << setprecision(2) << nanosSince(start, n * 5) << " ns/account   "
+                 << result.canWithdraw << " can withdraw, $" << setprecision(2) << result.interest / 100 << " interest" << endl;
+        };
+        time("virtual, list of new'd", [&](Pass &pass)
+             { for (OldNode *node = head; node; node = node->next) visit(*node->account, pass); });
+        time("virtual, account registry", [&](Pass &pass)
+             { for (const Account *acc : customers.accounts()) visit(*acc, pass); });
+        time("policies, per-type pools", [&](Pass &pass)
+             {
+            customers.forEachOfType<CheckingAccount>([&](const CheckingAccount &acc) { visit(acc, pass); });
+            customers.forEachOfType<SavingsAccount>([&](const SavingsAccount &acc) { visit(acc, pass); }); });
+
+        while (head)
+        {
+            OldNode *next = head->next;
+            ::delete head->account;
+            delete head;
+            head = next;
+        }
+    }
+
+    // End-of-day accrual over a million savings accounts, accounts/sec as the thread count grows
+    // Every run accrues one more day, the last one skips a month to show a catch-up costs the same.
+    // Then batch mode has to refuse accruing a day that hasn't come yet and leave every balance alone
+    bool interestAccrual()
+    {
+        const size_t n = 1000000;
+        CustomerList customers;
+        uint64_t seed = 7;
+        for (size_t i = 0; i < n; i++)
+        {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            Account *acc = customers.create<SavingsAccount>("saver" + to_string(i), "savings", 0.01 + double((seed >> 40) % 500) / 10000);
+            customers.addCustomer(acc);
+            acc->balance = Money::fromCents(int64_t((seed >> 20) % 10000000));
+        }
+        const size_t maxThreads = max<size_t>(8, thread::hardware_concurrency());
+        int64_t day = daysFromCivil(2026, 1, 1);
+        InterestAccrual::run(customers, day, maxThreads); // first accrual, only sets the day every account starts from
+        InterestAccrual::run(customers, ++day, maxThreads); // allocates every history
+
+        cout << n << " savings accounts" << endl;
+        auto report = [&](const string &label, int64_t through, size_t threads)
+        {
+            auto start = Clock::now();
+            InterestAccrual::Result result = InterestAccrual::run(customers, through, threads);
+            double seconds = chrono::duration<double>(Clock::now() - start).count();
+            cout << left << setw(22) << label << right << setw(12) << fixed << setprecision(0) << result.accounts / seconds << " accounts/sec   $"
+                 << result.total << endl;
+        };
+        for (size_t threads = 1; threads <= maxThreads; threads *= 2)
+        {
+            report(to_string(threads) + (threads == 1 ? " thread" : " threads"), ++day, threads);
+        }
+        day += 30;
+        report("30 day catch-up", day, maxThreads);
+
+        Money before = customers.findAccount(1)->getBalance();
+        BatchEngine engine(customers, nullptr);
+        int year;
+        unsigned month, mday;
+        civilFromDays(InterestAccrual::today() + 1, year, month, mday);
+        char tomorrow[16];
+        snprintf(tomorrow, sizeof(tomorrow), "%04d-%02u-%02u", year, month, mday);
+        bool refused = !engine.execute("accrue " + string(tomorrow)) &&
+                       customers.findAccount(1)->getBalance() == before;
+        cout << (refused ? "future accrual refused" : "FUTURE ACCRUAL POSTED") << endl;
+        return refused;
+    }
+
+    // A million standing orders over 100000 accounts, all paying every day: how fast they are placed and cancelled,
+    // then a million due payments by thread count, with a journal, and catching up after a week and a month down.
+    // No payment may be refused and every balance has to come out exactly where the orders say
+    bool standingOrders()
+    {
+        const size_t accountCount = 100000, orderCount = 1000000;
+        CustomerList customers;
+        for (size_t i = 0; i < accountCount; i++)
+        {
+            Account *acc = customers.create<CheckingAccount>("payer" + to_string(i), "checking", Money());
+            customers.addCustomer(acc);
+            acc->credit(Money::dollars(1000000));
+        }
+        const int64_t start = daysFromCivil(2026, 1, 1);
+        vector<StandingOrder> orders(orderCount);
+        uint64_t seed = 11;
+        int64_t netPerDay = 0;
+        for (StandingOrder &order : orders)
+        {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            StandingOrder::Kind kind = StandingOrder::Kind(1 + (seed >> 33) % 3);
+            int32_t from = int32_t(1 + (seed >> 13) % accountCount), to = int32_t(1 + (seed >> 45) % accountCount);
+            to = to == from ? int32_t(from % accountCount + 1) : to;
+            order = StandingOrders::make(kind, from, to, Money::fromCents(int64_t(100 + (seed >> 24) % 10000)), 1, 0, start);
+            netPerDay += kind == StandingOrder::DEPOSIT ? order.amount : kind == StandingOrder::WITHDRAW ? -order.amount : 0;
+        }
+        auto nanosEach = [](Clock::time_point since, size_t n)
+        { return double(chrono::duration_cast<chrono::nanoseconds>(Clock::now() - since).count()) / double(n); };
+
+        StandingOrders &book = customers.orders;
+        auto began = Clock::now();
+        for (StandingOrder &order : orders)
+        {
+            order.id = book.place(order);
+        }
+        double placeNanos = nanosEach(began, orderCount);
+        began = Clock::now();
+        for (size_t i = 0; i < orderCount; i += 10)
+        {
+            book.cancel(orders[i].id);
+        }
+        double cancelNanos = nanosEach(began, orderCount / 10);
+        for (size_t i = 0; i < orderCount; i += 10)
+        {
+            orders[i].id = book.place(orders[i]);
+        }
+        cout << accountCount << " accounts, " << orderCount << " orders paying every day" << endl
+             << fixed << setprecision(1) << "place " << placeNanos << " ns/order, cancel " << cancelNanos << " ns/order, "
+             << double(book.bytes()) / double(book.size()) << " bytes/order" << endl;
+
+        size_t paid = 0, failed = 0;
+        int64_t day = start;
+        auto report = [&](const string &label, int64_t through, size_t threads, bool catchUp = true)
+        {
+            auto began = Clock::now();
+            StandingOrderRun::Result result = StandingOrderRun::run(customers, through, threads, catchUp);
+            double seconds = chrono::duration<double>(Clock::now() - began).count();
+            paid += result.paid;
+            failed += result.failed;
+            cout << left << setw(24) << label << right << setw(10) << result.paid << " paid" << setw(10) << result.skipped << " skipped" << setw(12)
+                 << setprecision(0) << (result.paid + result.skipped) / seconds << " orders/sec" << setw(10) << setprecision(1)
+                 << seconds * 1e9 / double(result.paid + result.skipped) << " ns/order" << endl;
+        };
+        const size_t maxThreads = max<size_t>(8, thread::hardware_concurrency());
+        for (size_t threads = 1; threads <= maxThreads; threads *= 2)
+        {
+            report(to_string(threads) + (threads == 1 ? " thread" : " threads"), day++, threads);
+        }
+        {
+            const string path = "zbank-bench.journal";
+            filesystem::remove(path);
+            Journal journal(path, 4096);
+            journal.recover(customers);
+            Account::observers.push_back(&journal);
+            report("journaled, " + to_string(maxThreads) + " threads", day++, maxThreads);
+            journal.sync();
+            Account::observers.clear();
+            filesystem::remove(path);
+        }
+        report("7 day catch-up", day += 6, maxThreads);
+        report("30 day catch-up, skip", day += 30, maxThreads, false);
+
+        Money total;
+        bool exact = true;
+        for (const Account *acc : customers.accounts())
+        {
+            total += acc->getBalance();
+            exact = exact && acc->verifyBalance();
+        }
+        Money expected = Money::fromCents(100000000 * int64_t(accountCount) + netPerDay * int64_t(paid / orderCount));
+        bool ok = exact && failed == 0 && paid % orderCount == 0 && total == expected;
+        cout << (ok ? "balances check out" : "BALANCES WRONG: $" + total.toString() + " instead of $" + expected.toString() + ", " + to_string(failed) + " refused") << endl;
+        return ok;
+    }
+
+#ifdef __linux__
+    int connectLoopback(int port)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(uint16_t(port));
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+        {
+            throw runtime_error("Could not connect to the server.");
+        }
+        return fd;
+    }
+
+    // Sends one line and waits for the whole answer, every answer ends with an ok or error line
+    string request(int fd, const string &line)
+    {
+        string out = line + "\n", reply;
+        send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+        char chunk[4096];
+        while (true)
+        {
+            ssize_t got = recv(fd, chunk, sizeof(chunk), 0);
+            if (got <= 0)
+                return reply;
+            reply.append(chunk, size_t(got));
+            size_t last = reply.rfind('\n', reply.size() - 2);
+            last = last == string::npos ? 0 : last + 1;
+            if (reply.back() == '\n' && (reply.compare(last, 2, "ok") == 0 || reply.compare(last, 5, "error") == 0))
+                return reply;
+        }
+    }
+
+    // Loopback clients against the server: each logs in to its own account and to one shared account,
+    // alternating commands between them, then the balances have to add up exactly
+    void serverLoopback()
+    {
+        const int clients = 8, rounds = 5000;
+        const string path = "zbank-bench.journal";
+        filesystem::remove(path);
+        CustomerList customers;
+        Journal journal(path, 1024);
+        journal.recover(customers);
+        Account::observers.push_back(&journal);
+        for (int i = 0; i < clients; i++)
+        {
+            customers.addCustomer(customers.create<CheckingAccount>("client" + to_string(i), "secret", overdraftLimit_V<Money>));
+        }
+        Account *shared = customers.create<CheckingAccount>("shared", "secret", overdraftLimit_V<Money>);
+        customers.addCustomer(shared);
+
+        Server server(customers, &journal);
+        int port = server.listenTcp("127.0.0.1", 0);
+        thread loop(&Server::run, &server, size_t(4));
+
+        atomic<int> failures(0);
+        auto start = Clock::now();
+        vector<thread> threads;
+        for (int c = 0; c < clients; c++)
+        {
+            threads.emplace_back([&, c]
+                                 {
+                int own = connectLoopback(port), common = connectLoopback(port);
+                request(own, "login client" + to_string(c) + " secret");
+                request(common, "login shared secret");
+                for (int r = 0; r < rounds; r++)
+                {
+                    string reply = request(own, r % 2 ? "withdraw 1" : "deposit 3");
+                    reply += request(common, "deposit 1");
+                    if (reply.find("error") != string::npos)
+                        failures++;
+                }
+                request(own, "quit");
+                request(common, "quit");
+                close(own);
+                close(common); });
+        }
+        for (thread &t : threads)
+        {
+            t.join();
+        }
+        double seconds = chrono::duration<double>(Clock::now() - start).count();
+        server.stop();
+        loop.join();
+        Account::observers.clear();
+
+        bool exact = shared->getBalance() == Money::dollars(clients * rounds);
+        for (int c = 0; c < clients; c++)
+        {
+            exact = exact && customers.findAccount(c + 1)->getBalance() == Money::dollars(rounds);
+        }
+        cout << clients << " clients, " << server.commandsHandled() << " commands in " << fixed << setprecision(2) << seconds << " s: "
+             << setprecision(0) << 2.0 * clients * rounds / seconds << " ops/sec" << endl;
+        cout << "balances " << (exact ? "exact" : "WRONG") << ", " << failures << " failed commands" << endl;
+        filesystem::remove(path);
+    }
+
+    // A login storm against the server: storm clients log in over and over with scrypt hashed passwords while
+    // steady clients run balance and deposit. Once with no storm, once with passwords checked on the command
+    // workers, once on the login pool and once with the storm resuming session tokens instead
+    void loginStorm(int cost)
+    {
+        const int stormClients = 8, steadyClients = 2;
+        const auto duration = chrono::seconds(2);
+        PasswordHash::cost = cost;
+        auto start = Clock::now();
+        string hashed = PasswordHash::make("secret");
+        cout << "scrypt N = 2^" << cost << ", " << fixed << setprecision(1) << chrono::duration<double, milli>(Clock::now() - start).count()
+             << " ms per hash, " << stormClients << " storm and " << steadyClients << " steady clients on 4 workers, latencies in microseconds" << endl;
+        cout << "  " << left << setw(16) << "logins" << right << setw(12) << "logins/sec" << setw(14) << "commands/sec" << setw(10) << "p50" << setw(10)
+             << "p99" << setw(10) << "p99.9" << setw(12) << "max" << endl;
+
+        enum Mode
+        {
+            QUIET,
+            WORKERS,
+            POOL,
+            TOKENS
+        };
+        const char *const labels[] = {"none", "on workers", "login pool", "resume tokens"};
+        for (Mode mode : {QUIET, WORKERS, POOL, TOKENS})
+        {
+            CustomerList customers;
+            for (int i = 0; i < stormClients + steadyClients; i++)
+            {
+                customers.addCustomer(customers.create<CheckingAccount>("client" + to_string(i), hashed, overdraftLimit_V<Money>));
+            }
+            Server server(customers);
+            server.checkLoginsOn(mode == WORKERS ? 0 : 2);
+            int port = server.listenTcp("127.0.0.1", 0);
+            thread loop(&Server::run, &server, size_t(4));
+
+            atomic<bool> done(false);
+            atomic<uint64_t> logins(0), failures(0);
+            vector<vector<uint64_t>> nanos(steadyClients);
+            vector<thread> threads;
+            for (int c = 0; mode != QUIET && c < stormClients; c++)
+            {
+                threads.emplace_back([&, c]
+                                     {
+                    int fd = connectLoopback(port);
+                    string login = "login client" + to_string(c) + " secret";
+                    string reply = request(fd, login);
+                    string resume = "resume " + reply.substr(reply.rfind(' ') + 1, 32);
+                    while (!done)
+                    {
+                        if (request(fd, mode == TOKENS ? resume : login).compare(0, 2, "ok") != 0)
+                            failures++;
+                        logins++;
+                    }
+                    close(fd); });
+            }
+            for (int c = 0; c < steadyClients; c++)
+            {
+                threads.emplace_back([&, c]
+                                     {
+                    int fd = connectLoopback(port);
+                    request(fd, "login client" + to_string(stormClients + c) + " secret");
+                    for (uint64_t r = 0; !done; r++)
+                    {
+                        auto sent = Clock::now();
+                        if (request(fd, r % 2 ? "balance" : "deposit 1").compare(0, 2, "ok") != 0)
+                            failures++;
+                        nanos[c].push_back(uint64_t(chrono::duration_cast<chrono::nanoseconds>(Clock::now() - sent).count()));
+                    }
+                    close(fd); });
+            }
+            this_thread::sleep_for(duration);
+            done = true;
+            for (thread &t : threads)
+            {
+                t.join();
+            }
+            server.stop();
+            loop.join();
+
+            vector<uint64_t> all;
+            for (const vector<uint64_t> &client : nanos)
+            {
+                all.insert(all.end(), client.begin(), client.end());
+            }
+            sort(all.begin(), all.end());
+            double seconds = chrono::duration<double>(duration).count();
+            auto at = [&](double q)
+            { return all.empty() ? 0.0 : double(all[min(all.size() - 1, size_t(q * double(all.size())))]) / 1000; };
+            cout << "  " << left << setw(16) << labels[mode] << right << setw(12) << setprecision(0) << double(logins) / seconds << setw(14)
+                 << double(all.size()) / seconds << setprecision(2) << setw(10) << at(0.5) << setw(10) << at(0.99) << setw(10) << at(0.999)
+                 << setw(12) << (all.empty() ? 0.0 : double(all.back()) / 1000) << (failures ? "  " + to_string(failures) + " FAILED" : "") << endl;
+        }
+    }
+#endif
+
+    int run(const string &name, const vector<string> &args)
+    {
+        if (name == "suite")
+        {
+            // zbank bench suite [max accounts] [transactions per account]
+            size_t maxAccounts = args.size() > 0 ? size_t(atoll(args[0].c_str())) : 1000000;
+            size_t transactions = args.size() > 1 ? size_t(atoll(args[1].c_str())) : 16;
+            suite(maxAccounts, max<size_t>(transactions, 1));
+            return 0;
+        }
+        if (name == "ledger")
+        {
+            ledgerAppend();
+            return 0;
+        }
+        if (name == "range")
+        {
+            rangeQuery();
+            return 0;
+        }
+        if (name == "asof")
+        {
+            balanceQuery();
+            return 0;
+        }
+        if (name == "analytics")
+        {
+            return analyticsViews() ? 0 : 1;
+        }
+        if (name == "login")
+        {
+            loginLookup();
+            return 0;
+        }
+        if (name == "journal")
+        {
+            journalCommit();
+            return 0;
+        }
+        if (name == "snapshot")
+        {
+            snapshotLoad();
+            return 0;
+        }
+        if (name == "batch")
+        {
+            batchThroughput();
+            return 0;
+        }
+        if (name == "columns")
+        {
+            columnKernels();
+            return 0;
+        }
+        if (name == "import")
+        {
+            // zbank bench import [rows]
+            return bulkHistory(args.size() > 0 ? size_t(atoll(args[0].c_str())) : 2000000) ? 0 : 1;
+        }
+        if (name == "policies")
+        {
+            accountPolicies();
+            return 0;
+        }
+        if (name == "statement")
+        {
+            statementRendering();
+            return 0;
+        }
+        if (name == "interest")
+        {
+            return interestAccrual() ? 0 : 1;
+        }
+        if (name == "orders")
+        {
+            return standingOrders() ? 0 : 1;
+        }
+        if (name == "transfer")
+        {
+            return concurrentLedger() ? 0 : 1;
+        }
+        if (name == "audit")
+        {
+            return auditTrail() ? 0 : 1;
+        }
+#ifdef __linux__
+        if (name == "server")
+        {
+            serverLoopback();
+            return 0;
+        }
+        if (name == "logins")
+        {
+            // zbank bench logins [log2 of the scrypt N]
+            loginStorm(args.size() > 0 ? min(20, max(1, atoi(args[0].c_str()))) : PasswordHash::cost);
+            return 0;
+        }
+#endif
+        cerr << "Unknown benchmark: " << name << endl;
+        cerr << "Available: ledger, range, asof, analytics, login, journal, snapshot, batch, columns, transfer, audit, interest, orders, statement, policies, import, server, logins, suite" << endl;
+        return 1;
+    }
+}
+
+// Runs the command loop for a logged in account until the user quits or closes the account
+// When commands are being recorded, each one is noted under session in the server's dialect
+void runSession(CustomerList &customers, Account *account, uint64_t session = 0)
+{
+    while (true)
+    {
+        string userInput;
+        cout << ">>> ";
+        if (!(cin >> userInput))
+        {
+            return;
+        }
+        if (startswith(userInput, 'b')) // balance
+        {
+            ZBANK_PROBE(Metrics::BALANCE);
+            SessionRecorder::note(session, "balance");
+            cout << "Your current balance is: $" << account->getBalance() << endl;
+        }
+        else if (startswith(userInput, 'd')) // deposit
+        {
+            cout << "Are you sure you would like to deposit? (yes/no)" << endl;
+            cin >> userInput;
+            if (startswith(userInput, 'y')) // yes
+            {
+                string amountText;
+                Money depositAmount;
+                cout << "Deposit amount: $";
+                cin >> amountText;
+                SessionRecorder::note(session, "deposit " + amountText);
+                Money::parse(amountText, depositAmount); // anything unparsable stays at zero, which deposit rejects
+                account->deposit(depositAmount);
+            }
+            else
+            {
+                cout << "Cancelling deposit process." << endl;
+            }
+        }
+        else if (startswith(userInput, 'w')) // withdraw
+        {
+            cout << "Are you sure you would like to withdraw? (yes/no)" << endl;
+            cin >> userInput;
+            if (startswith(userInput, 'y')) // yes
+            {
+                string amountText;
+                Money withdrawAmount;
+                cout << "Withdraw amount: $";
+                cin >> amountText;
+                SessionRecorder::note(session, "withdraw " + amountText);
+                Money::parse(amountText, withdrawAmount); // anything unparsable stays at zero, which withdraw rejects
+                account->withdraw(withdrawAmount);
+            }
+            else
+            {
+                cout << "Cancelling withdrawal process." << endl;
+            }
+        }
+        else if (userInput == "transfer") // checked before transactions, they share a first letter
+        {
+            string amountText;
+            int toID = 0;
+            Money transferAmount;
+            cout << "Transfer to account ID: ";
+            cin >> toID;
+            cout << "Transfer amount: $";
+            cin >> amountText;
+            SessionRecorder::note(session, "transfer " + to_string(toID) + " " + amountText);
+            Money::parse(amountText, transferAmount); // anything unparsable stays at zero, which transfer rejects
+            try
+            {
+                Account *to = customers.findAccount(toID);
+                if (!to)
+                {
+                    throw runtime_error("No account with ID " + to_string(toID) + ".");
+                }
+                Account::transfer(*account, *to, transferAmount);
+                cout << "Transfer of $" << transferAmount << " to account " << toID << " successful.\nRemaining balance: $" << account->getBalance() << endl;
+            }
+            catch (const exception &ex)
+            {
+                cerr << "Error: " << ex.what() << endl;
+                cin.clear();
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            }
+        }
+        else if (startswith(userInput, 't')) // transactions
+        {
+            cout << "Would you like to set range of time? (yes/no)" << endl;
+            cin >> userInput;
+            if (startswith(userInput, 'y'))
+            {
+                cout << "Enter start date (YYYY-MM-DD): ";
+                string startDateStr;
+                cin >> startDateStr;
+
+                cout << "Enter end date (YYYY-MM-DD): ";
+                string endDateStr;
+                cin >> endDateStr;
+                SessionRecorder::note(session, "transactions " + startDateStr + " " + endDateStr);
+
+                try
+                {
+                    time_t startDateTime = DateParser::parseTime(startDateStr);
+                    time_t endDateTime = DateParser::parseTime(endDateStr);
+                    account->displayTransactionHistoryInRange(startDateTime, endDateTime);
+                }
+                catch (const exception &ex)
+                {
+                    cerr << "Error: " << ex.what() << endl;
+                }
+            }
+            else
+            {
+                SessionRecorder::note(session, "transactions");
+                account->displayTransactionHistory();
+            }
+        }
+        else if (startswith(userInput, 's')) // summary
+        {
+            SessionRecorder::note(session, "summary");
+            account->displaySummary();
+        }
+        else if (userInput == "orders") // checked before order
+        {
+            SessionRecorder::note(session, "orders");
+            vector<StandingOrder> mine;
+            {
+                lock_guard<mutex> held(customers.orders.lock);
+                customers.orders.forEach([&](const StandingOrder &order)
+                                         { if (order.account == account->ID) mine.push_back(order); });
+            }
+            sort(mine.begin(), mine.end(), [](const StandingOrder &a, const StandingOrder &b)
+                 { return a.id < b.id; });
+            for (const StandingOrder &order : mine)
+            {
+                cout << "Order " << order.id << ": " << order.describe() << endl;
+            }
+            cout << "You have " << mine.size() << " standing orders." << endl;
+        }
+        else if (startswith(userInput, 'o')) // order
+        {
+            string kindText, amountText, repeat;
+            int toID = 0;
+            long n = 0;
+            cout << "Order type (deposit/withdraw/transfer): ";
+            cin >> kindText;
+            StandingOrder::Kind kind = startswith(kindText, 't') ? StandingOrder::TRANSFER : startswith(kindText, 'w') ? StandingOrder::WITHDRAW : StandingOrder::DEPOSIT;
+            if (kind == StandingOrder::TRANSFER)
+            {
+                cout << "Transfer to account ID: ";
+                cin >> toID;
+            }
+            cout << "Amount: $";
+            cin >> amountText;
+            cout << "Repeat monthly or every so many days? (monthly/every): ";
+            cin >> repeat;
+            bool monthly = !startswith(repeat, 'e');
+            cout << (monthly ? "Day of the month: " : "Days between payments: ");
+            cin >> n;
+            string line = string("order ") + StandingOrder::kindName(kind) + (kind == StandingOrder::TRANSFER ? " " + to_string(toID) : "") + " " + amountText +
+                          (monthly ? " monthly " : " every ") + to_string(n);
+            SessionRecorder::note(session, line);
+            try
+            {
+                ZBANK_PROBE(Metrics::ORDER);
+                Money amount;
+                Money::parse(amountText, amount); // anything unparsable stays at zero, which make rejects
+                if (kind == StandingOrder::TRANSFER && !customers.findAccount(toID))
+                {
+                    throw runtime_error("No account with ID " + to_string(toID) + ".");
+                }
+                StandingOrder order = StandingOrders::make(kind, account->ID, toID, amount, monthly ? 0 : n, monthly ? n : 0);
+                lock_guard<mutex> held(customers.orders.lock);
+                order.id = customers.orders.place(order);
+                cout << "Standing order " << order.id << " set up: " << order.describe() << endl;
+            }
+            catch (const exception &ex)
+            {
+                cerr << "Error: " << ex.what() << endl;
+                cin.clear();
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            }
+        }
+        else if (userInput == "cancel") // checked before close, they share a first letter
+        {
+            uint64_t id = 0;
+            cout << "Standing order ID: ";
+            cin >> id;
+            SessionRecorder::note(session, "cancel " + to_string(id));
+            lock_guard<mutex> held(customers.orders.lock);
+            const StandingOrder *order = customers.orders.find(id);
+            if (order && order->account == account->ID)
+            {
+                customers.orders.cancel(id);
+                cout << "Standing order " << id << " cancelled." << endl;
+            }
+            else
+            {
+                cout << "You have no standing order " << id << "." << endl;
+                cin.clear();
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            }
+        }
+        else if (startswith(userInput, 'c'))
+        {
+            cout << "Are sure you want to close your account? (yes/no)" << endl;
+            cin >> userInput;
+            if (startswith(userInput, 'y'))
+            {
+                cout << "This is the final warning, are you absolutely sure you want to close your account? (yes/no)" << endl;
+                cin >> userInput;
+                if (startswith(userInput, 'y'))
+                {
+                    SessionRecorder::note(session, "close");
+                    if (account->getBalance() > Money())
+                    {
+                        cout << "Sorry, you cannot close your account until you remove all money from your account." << endl;
+                    }
+                    else if (account->getBalance() < Money())
+                    {
+                        cout << "Sorry, you cannot close your account until you pay your debts." << endl;
+                    }
+                    else
+                    {
+                        cout << "Closing account..." << endl;
+                        {
+                            ZBANK_PROBE(Metrics::CLOSE);
+                            customers.removeCustomer(account);
+                        }
+                        clearScreen();
+                        return;
+                    }
+                }
+            }
+            else
+            {
+                cout << "Account closure cancelled." << endl;
+            }
+        }
+        else if (startswith(userInput, 'q') or startswith(userInput, 'l')) // quit
+        {
+            SessionRecorder::note(session, "quit");
+            clearScreen();
+            return;
+        }
+        else if (startswith(userInput, 'h')) // help
+        {
+            cout << "balance        | Displays your current account balance." << endl;
+            cout << "deposit        | Deposits money into your account." << endl;
+            cout << "withdraw       | Withdraws money from your account." << endl;
+            cout << "transfer       | Moves money to another account." << endl;
+            cout << "transactions   | Displays your transaction history." << endl;
+            cout << "summary        | Displays monthly totals, average balances and your largest transactions." << endl;
+            cout << "order          | Sets up a payment repeating monthly or every so many days." << endl;
+            cout << "orders         | Lists your standing orders." << endl;
+            cout << "cancel         | Cancels one of your standing orders." << endl;
+            cout << "close          | Closes your account." << endl;
+            cout << "help           | Displays this message." << endl;
+            cout << "quit           | Logs out of your account." << endl;
+        }
+        else
+        {
+            cout << "We're sorry, the command you issued doesn't seem to exist. Please check your spelling, and if it still doesn't work, ask a nearby employee for help." << endl;
+        }
+    }
+}
 
-public:
-    TransactionList() : head(nullptr) {}
+// Main
+int main(int argc, char *argv[])
+{
+    if (argc > 2 && string(argv[1]) == "bench")
+    {
+        return Bench::run(argv[2], vector<string>(argv + 3, argv + argc));
+    }
 
-    void addTransaction(Transaction trans)
+    string journalPath = "zbank.journal";
+    string snapshotPath = "zbank.snapshot";
+    size_t groupSize = 1;
+    bool batchMode = false;
+    string batchFile = "-";
+    string statsPath;
+    string auditPath;
+    AuditLog::Policy auditPolicy = AuditLog::Policy::BLOCK;
+    uint64_t auditSize = 64;
+    string importPath, exportPath;
+    HistoryExport::Format exportFormat = HistoryExport::Format::CSV;
+    bool serveMode = false;
+    int port = 7070;
+    string socketPath;
+    size_t workerCount = max(1u, thread::hardware_concurrency());
+    size_t loginThreads = 2;
+    string recordPath, replayPath;
+    Replay::Options replayOptions;
+    bool workersGiven = false;
+    for (int i = 1; i < argc; i++)
     {
-        TransactionNode *newNode = new TransactionNode(trans);
-        if (!head)
+        string arg = argv[i];
+        if (arg == "--journal" && i + 1 < argc)
         {
-            head = newNode;
+            journalPath = argv[++i];
         }
-        else
+        else if (arg == "--snapshot" && i + 1 < argc)
+        {
+            snapshotPath = argv[++i];
+        }
+        else if (arg == "--columns")
+        {
+            // keep a column copy of every account's history for fast totals
+            TransactionList::columnsByDefault = true;
+        }
+        else if (arg == "--group" && i + 1 < argc)
+        {
+            groupSize = size_t(max(1, atoi(argv[++i])));
+        }
+        else if (arg == "batch")
         {
-            TransactionNode *temp = head;
-            while (temp->next)
+            batchMode = true;
+            // batch jobs sync the journal in groups unless told otherwise
+            groupSize = max<size_t>(groupSize, 1024);
+            if (i + 1 < argc && argv[i + 1][0] != '-')
             {
-                temp = temp->next;
+                batchFile = argv[++i];
             }
-            temp->next = newNode;
         }
-    }
-
-    void displayTransactions() const
-    {
-        TransactionNode *temp = head;
-        while (temp)
+        else if (arg == "import" && i + 1 < argc)
         {
-            cout << temp->transaction << endl;
-            temp = temp->next;
+            importPath = argv[++i];
+            groupSize = max<size_t>(groupSize, 1024);
         }
-    }
-
-    // Method to filter transactions within a date range
-    void displayTransactionsInRange(time_t startDate, time_t endDate) const
-    {
-        TransactionNode *temp = head;
-        while (temp)
+        else if (arg == "export" && i + 1 < argc)
         {
-            if (temp->transaction.getDate() >= startDate && temp->transaction.getDate() <= endDate)
+            exportPath = argv[++i];
+            if (i + 1 < argc && HistoryExport::parseFormat(argv[i + 1], exportFormat))
             {
-                cout << temp->transaction << endl;
+                i++;
             }
-            temp = temp->next;
         }
-    }
-
-    ~TransactionList()
-    {
-        while (head)
+        else if (arg == "serve")
+        {
+            serveMode = true;
+            // concurrent sessions share fsyncs, so let the commits pile up
+            groupSize = max<size_t>(groupSize, 1024);
+        }
+        else if (arg == "--port" && i + 1 < argc)
+        {
+            port = atoi(argv[++i]);
+        }
+        else if (arg == "--unix" && i + 1 < argc)
         {
-            TransactionNode *temp = head;
-            head = head->next;
-            delete temp;
+            socketPath = argv[++i];
+        }
+        else if (arg == "--stats" && i + 1 < argc)
+        {
+            statsPath = argv[++i];
+        }
+        else if (arg == "--workers" && i + 1 < argc)
+        {
+            workerCount = size_t(max(1, atoi(argv[++i])));
+            workersGiven = true;
+        }
+        else if (arg == "--login-threads" && i + 1 < argc)
+        {
+            loginThreads = size_t(max(0, atoi(argv[++i])));
+        }
+        else if (arg == "--hash-cost" && i + 1 < argc)
+        {
+            // log2 of the scrypt N for passwords hashed from now on
+            PasswordHash::cost = min(20, max(1, atoi(argv[++i])));
+        }
+        else if (arg == "--record" && i + 1 < argc)
+        {
+            recordPath = argv[++i];
+        }
+        else if (arg == "replay" && i + 1 < argc)
+        {
+            replayPath = argv[++i];
+        }
+        else if (arg == "--speed" && i + 1 < argc)
+        {
+            replayOptions.speed = atof(argv[++i]);
+        }
+        else if (arg == "--closed")
+        {
+            replayOptions.closed = true;
+        }
+        else if (arg == "--audit" && i + 1 < argc)
+        {
+            auditPath = argv[++i];
+        }
+        else if (arg == "--audit-policy" && i + 1 < argc)
+        {
+            if (!AuditLog::parsePolicy(argv[++i], auditPolicy))
+            {
+                cerr << "Error: Unknown audit policy '" << argv[i] << "', use block, drop or spill." << endl;
+                return 1;
+            }
+        }
+        else if (arg == "--audit-size" && i + 1 < argc)
+        {
+            auditSize = uint64_t(max(1, atoi(argv[++i])));
         }
     }
-};
-
-// Base Account class
-class Account
-{
-public:
-    string username;
-    string password;
-    int ID;
-    double balance;
-    TransactionList transactions;
-
-    Account(string accUsername, string accPassword) : username(accUsername), password(accPassword), balance(0) {}
-
-    double getBalance() const { return balance; }
-    virtual void deposit(double amount) = 0;
-    virtual void withdraw(double amount) = 0;
-    virtual void displayTransactionHistory() const = 0;
-    virtual void displayTransactionHistoryInRange(time_t startDate, time_t endDate) const = 0;
-    virtual bool authenticate(string accUsername, string accPassword) const = 0;
-};
 
-// Interest calculator class
-class InterestCalculator
-{
-public:
-    static double calculateInterest(double balance, double interestRate)
+    // The snapshot owns the mapped transaction records, so it has to outlive the customers
+    Snapshot snapshot;
+    CustomerList customers;
+    Journal journal(journalPath, groupSize);
+    bool loaded;
+    size_t restored;
+    try
     {
-        return balance * interestRate;
+        loaded = snapshot.load(snapshotPath, customers);
+        restored = journal.recover(customers, snapshot.coveredEpoch());
     }
-};
-
-// Overdraft protection class
-class OverdraftProtection
-{
-public:
-    static bool checkOverdraft(double balance, double amount, double overdraftLimit)
+    catch (const exception &ex)
     {
-        return balance + overdraftLimit >= amount;
+        cerr << "Error: " << ex.what() << endl;
+        return 1;
     }
-};
-
-// Checking Account subclass
-class CheckingAccount : public Account
-{
-private:
-    double overdraftLimit;
-
-public:
-    CheckingAccount(string accUsername, string accPassword, double overdraft) : Account(accUsername, accPassword), overdraftLimit(overdraft) {}
-
-    void deposit(double amount) override
+    Account::observers.push_back(&journal);
+    unique_ptr<AuditLog> audit;
+    if (!auditPath.empty())
     {
         try
         {
-            if (amount <= 0 or cin.fail())
-            {
-                throw runtime_error("Invalid amount entered.");
-            }
-            else
-            {
-                balance += amount;
-                time_t currentTime = time(nullptr);
-                transactions.addTransaction(Transaction("Deposit", amount, TransactionType::DEPOSIT, currentTime));
-                cout << "Deposit of $" << amount << " successful.\nCurrent balance: $" << balance << endl;
-            }
+            audit = make_unique<AuditLog>(auditPath, auditPolicy, auditSize << 20);
+            audit->start();
         }
         catch (const exception &ex)
         {
             cerr << "Error: " << ex.what() << endl;
-            cin.clear();
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            return 1;
         }
+        Account::observers.push_back(audit.get());
     }
 
-    void withdraw(double amount) override
+    // Everything after this point leaves through finish, which flushes the audit trail and writes the stats file when asked for one
+    auto finish = [&](int status)
     {
-        try
+        Account::observers.clear();
+        if (audit)
         {
-            if (amount <= 0 or cin.fail())
-            {
-                throw runtime_error("Invalid amount entered.");
-            }
-            else if (OverdraftProtection::checkOverdraft(balance, amount, overdraftLimit))
-            {
-                balance -= amount;
-                time_t currentTime = time(nullptr);
-                transactions.addTransaction(Transaction("Withdrawal", -amount, TransactionType::WITHDRAW, currentTime));
-                cout << "Withdrawal of $" << amount << " successful.\nRemaining balance: $" << balance << endl;
-            }
-            else
-            {
-                throw runtime_error("Insufficient funds.");
-            }
+            audit->stop();
         }
-        catch (const exception &ex)
+        if (!statsPath.empty())
         {
-            cerr << "Error: " << ex.what() << endl;
-            cin.clear();
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            ofstream out(statsPath);
+            bool json = statsPath.size() >= 5 && statsPath.compare(statsPath.size() - 5, 5, ".json") == 0;
+            Metrics::report(out, customers, json);
         }
-    }
-
-    void displayTransactionHistory() const override
-    {
-        cout << "Transaction History for Checking Account " << username << ":" << endl;
-        transactions.displayTransactions();
-        cout << "Current Balance: $" << balance << endl;
-    }
+        return status;
+    };
 
-    void displayTransactionHistoryInRange(time_t startDate, time_t endDate) const override
+    // This is to display how the application can handle multiple users, and users with multiple accounts
+    // In real use, this would be replaced with something that links with a database
+    // but for now, this hardcoded sample usage is fine, i hope
+    // The accounts are only created on the very first run, after that they come back from the snapshot and journal
+    if (!loaded && restored == 0)
     {
-        cout << "Transaction History for Checking Account " << username << " within date range:" << endl;
-        transactions.displayTransactionsInRange(startDate, endDate);
-        cout << "Current Balance: $" << balance << endl;
-    }
+        CheckingAccount *_zacharychecking = customers.create<CheckingAccount>("zachary", PasswordHash::make("checking"), overdraftLimit_V<Money>);
+        CheckingAccount *_zacharysavings = customers.create<CheckingAccount>("zachary", PasswordHash::make("savings"), overdraftLimit_V<Money>);
+        SavingsAccount *_johnsavings = customers.create<SavingsAccount>("john", PasswordHash::make("savings"), 0.05);
 
-    bool authenticate(string accUsername, string accPassword) const override
-    {
-        return (accUsername == username && accPassword == password);
+        customers.addCustomer(_zacharychecking);
+        customers.addCustomer(_zacharysavings);
+        customers.addCustomer(_johnsavings);
     }
-};
-
-// Savings Account subclass
-class SavingsAccount : public Account
-{
-private:
-    double interestRate;
 
-public:
-    SavingsAccount(string accUsername, string accPassword, double interest) : Account(accUsername, accPassword), interestRate(interest) {}
-
-    void deposit(double amount) override
+    if (!importPath.empty() || !exportPath.empty())
     {
         try
         {
-            if (amount <= 0 or cin.fail())
+            auto start = chrono::steady_clock::now();
+            size_t rows;
+            if (!importPath.empty())
             {
-                throw runtime_error("Invalid amount entered.");
+                ZBANK_PROBE(Metrics::IMPORT);
+                HistoryImport::Result result = HistoryImport::run(importPath, customers, thread::hardware_concurrency());
+                journal.sync();
+                rows = result.rows;
+                cerr << "Imported " << rows << " rows into " << result.accounts << " accounts, $" << result.total << " in total";
             }
             else
             {
-                balance += amount;
-                time_t currentTime = time(nullptr);
-                transactions.addTransaction(Transaction("Deposit", amount, TransactionType::DEPOSIT, currentTime));
-                cout << "Deposit of $" << amount << " successful.\nCurrent balance: $" << balance << endl;
+                ZBANK_PROBE(Metrics::EXPORT);
+                rows = HistoryExport::run(exportPath, customers, exportFormat, thread::hardware_concurrency());
+                cerr << "Exported " << rows << " rows";
             }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cerr << " in " << fixed << setprecision(2) << seconds << " s (" << setprecision(0) << double(rows) / max(seconds, 1e-9) << " rows/sec)" << endl;
         }
         catch (const exception &ex)
         {
             cerr << "Error: " << ex.what() << endl;
-            cin.clear();
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            return finish(1);
         }
+        return finish(0);
     }
 
-    void withdraw(double amount) override
+    if (!replayPath.empty())
     {
+        // the replay only measures, nothing it does is written back
+        Account::observers.clear();
         try
         {
-            if (amount <= 0 or cin.fail())
-            {
-                throw runtime_error("Invalid amount entered.");
-            }
-            else if (balance >= amount)
-            {
-                balance -= amount;
-                time_t currentTime = time(nullptr);
-                transactions.addTransaction(Transaction("Withdrawal", -amount, TransactionType::WITHDRAW, currentTime));
-                cout << "Withdrawal of $" << amount << " successful.\nRemaining balance: $" << balance << endl;
-            }
-            else
-            {
-                throw runtime_error("Insufficient funds.");
-            }
+            Replay replay(replayPath);
+            // a replay runs one worker unless told otherwise, so the same recording always gives the same answers
+            replayOptions.workers = workersGiven ? workerCount : 1;
+            replay.run(customers, replayOptions, cout);
         }
         catch (const exception &ex)
         {
             cerr << "Error: " << ex.what() << endl;
-            cin.clear();
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            return finish(1);
         }
+        return finish(0);
     }
 
-    void displayTransactionHistory() const override
-    {
-        cout << "Transaction History for Savings Account " << username << ":" << endl;
-        transactions.displayTransactions();
-        cout << "Current Balance: $" << balance << endl;
-    }
-    void displayTransactionHistoryInRange(time_t startDate, time_t endDate) const override
-    {
-        cout << "Transaction History for Savings Account " << username << " within date range:" << endl;
-        transactions.displayTransactionsInRange(startDate, endDate);
-        cout << "Current Balance: $" << balance << endl;
-    }
-
-    bool authenticate(string accUsername, string accPassword) const override
+    unique_ptr<SessionRecorder> recorder;
+    if (!recordPath.empty())
     {
-        return (accUsername == username && accPassword == password);
+        try
+        {
+            recorder = make_unique<SessionRecorder>(recordPath);
+        }
+        catch (const exception &ex)
+        {
+            cerr << "Error: " << ex.what() << endl;
+            return finish(1);
+        }
+        SessionRecorder::active = recorder.get();
     }
-};
-
-// Customer Node
-class CustomerNode
-{
-public:
-    Account *account;
-    CustomerNode *next;
-
-    CustomerNode(Account *acc) : account(acc), next(nullptr) {}
-};
-
-// Customer List
-class CustomerList
-{
-public:
-    CustomerNode *head;
 
-    CustomerList() : head(nullptr) {}
-
-    void addCustomer(Account *acc)
+    if (batchMode)
     {
-        CustomerNode *newNode = new CustomerNode(acc);
-        if (!head)
+        ios::sync_with_stdio(false);
+        BatchEngine engine(customers, &cout, &journal);
+        engine.recordTo(recorder.get());
+        size_t failed;
+        if (batchFile == "-")
         {
-            head = newNode;
+            failed = engine.run(cin);
         }
         else
         {
-            CustomerNode *temp = head;
-            while (temp->next)
+            ifstream in(batchFile);
+            if (!in)
             {
-                temp = temp->next;
+                cerr << "Error: Could not open '" << batchFile << "'." << endl;
+                return finish(1);
             }
-            temp->next = newNode;
+            failed = engine.run(in);
         }
+        cerr << engine.commandsExecuted() << " commands, " << failed << " failed" << endl;
+        return finish(failed ? 2 : 0);
     }
 
-    void displayCustomers() const
+    if (serveMode)
     {
-        CustomerNode *temp = head;
-        while (temp)
+#ifdef __linux__
+        Server server(customers, &journal, recorder.get());
+        server.checkLoginsOn(loginThreads);
+        try
         {
-            cout << "Username: " << temp->account->username << endl;
-            temp = temp->next;
+            if (socketPath.empty())
+            {
+                port = server.listenTcp("127.0.0.1", port);
+                cerr << "Listening on 127.0.0.1:" << port;
+            }
+            else
+            {
+                server.listenUnix(socketPath);
+                cerr << "Listening on " << socketPath;
+            }
+            cerr << " with " << workerCount << " workers" << endl;
+            signal(SIGINT, [](int)
+                   { Server::interrupted = true; });
+            signal(SIGTERM, [](int)
+                   { Server::interrupted = true; });
+            server.run(workerCount);
+            journal.sync();
         }
-    }
-
-    ~CustomerList()
-    {
-        while (head)
+        catch (const exception &ex)
         {
-            CustomerNode *temp = head;
-            head = head->next;
-            delete temp->account;
-            delete temp;
+            cerr << "Error: " << ex.what() << endl;
+            return finish(1);
         }
+        cerr << server.commandsHandled() << " commands served" << endl;
+        return finish(0);
+#else
+        cerr << "Error: Server mode is only available on Linux." << endl;
+        return finish(1);
+#endif
     }
-};
-
-// Main
-int main()
-{
-    CustomerList customers;
-
-    // This is to display how the application can handle multiple users, and users with multiple accounts
-    // In real use, this would be replaced with something that links with a database
-    // but for now, this hardcoded sample usage is fine, i hope
-    CheckingAccount *_zacharychecking = new CheckingAccount("zachary", "checking", overdraftLimit_V<double>);
-    CheckingAccount *_zacharysavings = new CheckingAccount("zachary", "savings", overdraftLimit_V<double>);
-    SavingsAccount *_johnsavings = new SavingsAccount("john", "savings", 0.05);
-
-    customers.addCustomer(_zacharychecking);
-    customers.addCustomer(_zacharysavings);
-    customers.addCustomer(_johnsavings);
 
     while (true)
     {
         string process;
         cout << "Welcome to ZBanking, what would you like to do?" << endl;
-        cin >> process;
+        if (!(cin >> process))
+        {
+            break;
+        }
         if (startswith(process, 'l')) // login
         {
             // Authentication
@@ -448,163 +9552,83 @@ int main()
             cin >> password;
             clearScreen();
 
-            bool loggedIn = false;
-            CustomerNode *temp = customers.head;
-            while (temp)
+            // every login at the prompt is a session of its own in a recording
+            uint64_t session = recorder ? recorder->nextSession() : 0;
+            int64_t arrived = recorder ? recorder->elapsed() : 0;
+            Account *account = nullptr;
             {
-                if (temp->account->authenticate(username, password))
+                ZBANK_PROBE(Metrics::LOGIN);
+                // one username can own several accounts, the password says which one
+                for (Account *candidate : customers.findAccounts(username))
                 {
-                    loggedIn = true;
-                    cout << "Authentication successful.\n\nWelcome to ZBanking, " << username << "!" << endl;
-                    while (true)
+                    if (candidate->authenticate(username, password))
                     {
-                        string userInput;
-                        cout << ">>> ";
-                        cin >> userInput;
-                        if (startswith(userInput, 'b')) // balance
-                        {
-                            cout << "Your current balance is: $" << temp->account->getBalance() << endl;
-                        }
-                        else if (startswith(userInput, 'd')) // deposit
-                        {
-                            cout << "Are you sure you would like to deposit? (yes/no)" << endl;
-                            cin >> userInput;
-                            if (startswith(userInput, 'y')) // yes
-                            {
-                                int depositAmount;
-                                cout << "Deposit amount: $";
-                                cin >> depositAmount;
-                                temp->account->deposit(depositAmount);
-                            }
-                            else
-                            {
-                                cout << "Cancelling deposit process." << endl;
-                            }
-                        }
-                        else if (startswith(userInput, 'w')) // withdraw
-                        {
-                            cout << "Are you sure you would like to withdraw? (yes/no)" << endl;
-                            cin >> userInput;
-                            if (startswith(userInput, 'y')) // yes
-                            {
-                                int withdrawAmount;
-                                cout << "Withdraw amount: $";
-                                cin >> withdrawAmount;
-                                temp->account->withdraw(withdrawAmount);
-                            }
-                            else
-                            {
-                                cout << "Cancelling withdrawal process." << endl;
-                            }
-                        }
-                        else if (startswith(userInput, 't')) // transactions
-                        {
-                            cout << "Would you like to set range of time? (yes/no)" << endl;
-                            cin >> userInput;
-                            if (startswith(userInput, 'y'))
-                            {
-                                cout << "Enter start date (YYYY-MM-DD): ";
-                                string startDateStr;
-                                cin >> startDateStr;
-                                tm startDate = DateParser::parseDate(startDateStr);
-
-                                cout << "Enter end date (YYYY-MM-DD): ";
-                                string endDateStr;
-                                cin >> endDateStr;
-                                tm endDate = DateParser::parseDate(endDateStr);
-
-                                time_t startDateTime = mktime(&startDate);
-                                time_t endDateTime = mktime(&endDate);
-
-                                temp->account->displayTransactionHistoryInRange(startDateTime, endDateTime);
-                            }
-                            else
-                            {
-                                temp->account->displayTransactionHistory();
-                            }
-                        }
-                        else if (startswith(userInput, 'c'))
-                        {
-                            cout << "Are sure you want to close your account? (yes/no)" << endl;
-                            cin >> userInput;
-                            if (startswith(userInput, 'y'))
-                            {
-                                cout << "This is the final warning, are you absolutely sure you want to close your account? (yes/no)" << endl;
-                                cin >> userInput;
-                                if (startswith(userInput, 'y'))
-                                {
-                                    if (temp->account->getBalance() > 0)
-                                    {
-                                        cout << "Sorry, you cannot close your account until you remove all money from your account." << endl;
-                                    }
-                                    else if (temp->account->getBalance() < 0)
-                                    {
-                                        cout << "Sorry, you cannot close your account until you pay your debts." << endl;
-                                    }
-                                    else
-                                    {
-                                        cout << "Closing account..." << endl;
-                                        delete temp->account;
-                                        // Delete node from list
-                                        if (temp == customers.head)
-                                        {
-                                            customers.head = temp->next;
-                                        }
-                                        else
-                                        {
-                                            CustomerNode *prev = customers.head;
-                                            while (prev->next != temp)
-                                            {
-                                                prev = prev->next;
-                                            }
-                                            prev->next = temp->next;
-                                        }
-                                        delete temp;
-                                        clearScreen();
-                                        break;
-                                    }
-                                }
-                            }
-                            else
-                            {
-                                cout << "Account closure cancelled." << endl;
-                            }
-                        }
-                        else if (startswith(userInput, 'q') or startswith(userInput, 'l')) // quit
-                        {
-                            clearScreen();
-                            break;
-                        }
-                        else if (startswith(userInput, 'h')) // help
-                        {
-                            cout << "balance        | Displays your current account balance." << endl;
-                            cout << "deposit        | Deposits money into your account." << endl;
-                            cout << "withdraw       | Withdraws money from your account." << endl;
-                            cout << "transactions   | Displays your transaction history." << endl;
-                            cout << "close          | Closes your account." << endl;
-                            cout << "help           | Displays this message." << endl;
-                            cout << "quit           | Logs out of your account." << endl;
-                        }
-                        else
-                        {
-                            cout << "We're sorry, the command you issued doesn't seem to exist. Please check your spelling, and if it still doesn't work, ask a nearby employee for help." << endl;
-                        }
+                        account = candidate;
+                        break;
                     }
                 }
-                temp = temp->next;
             }
-            if (!loggedIn)
+            if (recorder)
+            {
+                recorder->recordLogin(session, username, account ? account->ID : 0, arrived);
+            }
+            if (account)
+            {
+                cout << "Authentication successful.\n\nWelcome to ZBanking, " << username << "! This is account " << account->ID << "." << endl;
+                runSession(customers, account, session);
+            }
+            else
             {
                 cout << "Incorrect username or password. Please try again." << endl;
                 cin.get();
             }
         }
+        else if (process == "stats") // checked before snapshot, they share a first letter
+        {
+            Metrics::report(cout, customers, false);
+        }
+        else if (startswith(process, 's')) // snapshot
+        {
+            try
+            {
+                ZBANK_PROBE(Metrics::SNAPSHOT);
+                journal.sync();
+                Snapshot::write(snapshotPath, customers, journal.getEpoch());
+                journal.truncate();
+                cout << "Snapshot saved to " << snapshotPath << "." << endl;
+            }
+            catch (const exception &ex)
+            {
+                cerr << "Error: " << ex.what() << endl;
+            }
+        }
+        else if (startswith(process, 'a')) // accrue
+        {
+            ZBANK_PROBE(Metrics::ACCRUE);
+            SessionRecorder::note(0, "accrue");
+            InterestAccrual::Result result = InterestAccrual::run(customers, InterestAccrual::today(), thread::hardware_concurrency());
+            journal.sync();
+            cout << "Accrued interest on " << result.accounts << " accounts, $" << result.total << " in total." << endl;
+        }
+        else if (startswith(process, 'p')) // pay
+        {
+            ZBANK_PROBE(Metrics::PAY);
+            SessionRecorder::note(0, "pay");
+            StandingOrderRun::Result result = StandingOrderRun::run(customers, InterestAccrual::today(), thread::hardware_concurrency());
+            journal.sync();
+            cout << "Paid " << result.paid << " standing orders, $" << result.total << " in total. " << result.failed << " were refused";
+            cout << " and " << result.dropped << " belonged to closed accounts." << endl;
+        }
         else if (startswith(process, 'h'))
         {
             cout << "login          | Log into your ZBanking account." << endl;
+            cout << "snapshot       | Saves every account to the snapshot file and empties the journal." << endl;
+            cout << "accrue         | Posts the interest every savings account has earned up to today." << endl;
+            cout << "pay            | Pays every standing order that has come due, missed days included." << endl;
+            cout << "stats          | Displays command counts, latencies and ledger size." << endl;
             cout << "help           | Displays this message." << endl;
         }
     }
 
-    return 0;
+    return finish(0);
 }